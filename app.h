@@ -10,8 +10,12 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <inttypes.h>
+#include <time.h>
+#include "sock.h"
 
 #define BUF_SIZE 1500
+#define MAX_PROBES 1000
+#define PROBE_TIMEOUT 1000 // msec to wait for an echo reply
 
 int proper_usage(int argc, char *argv[], int arg_req, char type);
 
@@ -23,4 +27,21 @@ int send_fileinfo(int sockfd, uint8_t mip_addr, uint16_t port, uint16_t size);
 
 int send_file(int sockfd, char *file, uint16_t filesize);
 
+/* MIPPING FUNCTIONS */
+
+int handle_ping_args(int argc, char *argv[], int *count, int *interval, \
+                                                                  int *trace);
+
+uint64_t get_nsec(void);
+
+int send_probe(int sockfd, uint8_t mip_dst, uint8_t ttl, uint16_t ident, \
+                                                                uint16_t seq);
+
+int recv_probe(int sockfd, uint16_t ident, uint16_t seq, \
+                                                  struct ctrl_msg *msg);
+
+double percentile(double *rtts, int count, double percent);
+
+void print_rtts(double *rtts, int count);
+
 #endif
\ No newline at end of file
@@ -21,6 +21,10 @@ int proper_usage(int argc, char *argv[], int arg_req, char type){
       fprintf(stderr, "USAGE: %s [-d] <MIP_destination> <Port_number> " \
                                   "<File_name> <Application_path>\n", argv[0]);
     }
+    else if(type == 'p'){
+      fprintf(stderr, "USAGE: %s [-d] [-t] [-c <Count>] [-i <Interval_msec>]" \
+                          " <Echo_socket> <MIP_destination>\n", argv[0]);
+    }
 
     return 0;
   }
@@ -162,6 +166,233 @@ int send_file(int sockfd, char *file, uint16_t filesize){
   return retv;
 }
 
+/*
+INPUT PARAMETERS
+  - argc: number of arguments given when running the program
+  - argv: arguments given when running the program
+
+OUTPUT PARAMETERS
+  - count: number of echo requests, per hop when tracing
+  - interval: milliseconds between echo requests
+  - trace: 1 if the path is traced hop by hop
+
+This function handles the options of mipping. -1 is returned upon incorrect 
+usage.
+  -d: activates debug mode
+  -t: trace the path with TTL-limited echo requests
+  -c: number of echo requests to send, to each hop when tracing
+  -i: milliseconds between echo requests
+*/
+int handle_ping_args(int argc, char *argv[], int *count, int *interval, \
+                                                                  int *trace){
+  int retv;
+
+  opterr = 0; //to make getopt not print error message
+  while((retv = getopt(argc, argv, "dtc:i:")) != -1){
+    switch(retv){
+      case 'd':
+        debug = 1;
+        break;
+      case 't':
+        *trace = 1;
+        break;
+      case 'c':
+        *count = strtol(optarg, NULL, 10);
+        if(*count <= 0 || *count > MAX_PROBES){
+          fprintf(stderr, "INVALID COUNT: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'i':
+        *interval = strtol(optarg, NULL, 10);
+        if(*interval < 0){
+          fprintf(stderr, "INVALID INTERVAL: %s\n", optarg);
+          return -1;
+        }
+        break;
+      default:
+        proper_usage(argc, argv, argc + 1, 'p');
+        return -1;
+    }
+  }
+
+  if(!proper_usage(argc - optind, argv, 2, 'p'))
+    return -1;
+
+  return 0;
+}
+
+/*
+This function returns the time of CLOCK_MONOTONIC in nanoseconds.
+*/
+uint64_t get_nsec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: echo socket connected to the MIP daemon
+  - mip_dst: MIP address the echo request is sent to
+  - ttl: TTL the echo request is sent with
+  - ident: identifies the replies to this mipping
+  - seq: sequence number of the echo request
+
+This function sends an echo request stamped with the current time to the MIP
+daemon. The return value of sendmsg() is returned.
+*/
+int send_probe(int sockfd, uint8_t mip_dst, uint8_t ttl, uint16_t ident, \
+                                                                uint16_t seq){
+  int retv;
+  struct ctrl_msg probe = { 0 };
+
+  probe.type = CTRL_ECHO_REQUEST;
+  probe.ttl = ttl;
+  probe.ident = ident;
+  probe.seq = seq;
+  probe.stamp = get_nsec();
+
+  struct iovec iov[2];
+  iov[0].iov_base = &mip_dst;
+  iov[0].iov_len = sizeof(uint8_t);
+  iov[1].iov_base = &probe;
+  iov[1].iov_len = CTRL_SIZE;
+
+  struct msghdr msg = { 0 };
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  retv = sendmsg(sockfd, &msg, 0);
+  if(retv == -1)
+    perror("send_probe(): sendmsg()");
+
+  return retv;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: echo socket connected to the MIP daemon
+  - ident: identifier of the echo request
+  - seq: sequence number of the echo request
+
+INPUT-OUTPUT PARAMETER
+  - msg: receive buffer of the reply
+
+This function waits up to PROBE_TIMEOUT milliseconds for the reply to echo 
+request 'seq'. Late replies to earlier requests are thrown. 1 is returned if
+the reply arrived, 0 on timeout and -1 if an error occur.
+*/
+int recv_probe(int sockfd, uint16_t ident, uint16_t seq, \
+                                                  struct ctrl_msg *msg){
+  int retv;
+  uint8_t mip_src;
+  fd_set readfds;
+  struct timeval tv;
+  uint64_t now;
+  uint64_t deadline = get_nsec() + (uint64_t)PROBE_TIMEOUT * 1000000;
+
+  struct iovec iov[2];
+  iov[0].iov_base = &mip_src;
+  iov[0].iov_len = sizeof(uint8_t);
+  iov[1].iov_base = msg;
+  iov[1].iov_len = CTRL_SIZE;
+
+  struct msghdr hdr = { 0 };
+  hdr.msg_iov = iov;
+  hdr.msg_iovlen = 2;
+
+  while((now = get_nsec()) < deadline){
+    tv.tv_sec = (deadline - now) / 1000000000;
+    tv.tv_usec = (deadline - now) % 1000000000 / 1000;
+
+    FD_ZERO(&readfds);
+    FD_SET(sockfd, &readfds);
+
+    retv = select(sockfd + 1, &readfds, NULL, NULL, &tv);
+    if(retv == -1){
+      perror("recv_probe(): select()");
+      return -1;
+    }
+    else if(retv == 0){
+      break;
+    }
+
+    retv = recvmsg(sockfd, &hdr, 0);
+    if(retv == -1){
+      perror("recv_probe(): recvmsg()");
+      return -1;
+    }
+    else if(retv == 0){
+      fprintf(stderr, "Connection closed!\n");
+      return -1;
+    }
+
+    if(retv == sizeof(mip_src) + CTRL_SIZE && msg->ident == ident && \
+                                                              msg->seq == seq)
+      return 1;
+
+    DLOG("throwing late reply");
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - rtts: round-trip times
+  - count: number of round-trip times in 'rtts'
+  - percent: percentile to be returned
+
+This function returns the nearest-rank percentile of 'rtts', which must be
+sorted.
+*/
+double percentile(double *rtts, int count, double percent){
+  double pos = (percent / 100) * count;
+  int rank = pos;
+
+  // rounding up
+  if(rank < pos)
+    rank++;
+
+  if(rank < 1)
+    rank = 1;
+  if(rank > count)
+    rank = count;
+
+  return rtts[rank - 1];
+}
+
+static int cmp_rtt(const void *a, const void *b){
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*
+INPUT PARAMETERS
+  - rtts: round-trip times in milliseconds
+  - count: number of round-trip times in 'rtts'
+
+This function sorts 'rtts' and prints its minimum, median, 90th and 99th
+percentile and maximum.
+*/
+void print_rtts(double *rtts, int count){
+  if(count == 0){
+    printf("%10s%10s%10s%10s%10s", "*", "*", "*", "*", "*");
+    return;
+  }
+
+  qsort(rtts, count, sizeof(double), cmp_rtt);
+
+  printf("%10.3f%10.3f%10.3f%10.3f%10.3f", rtts[0], \
+              percentile(rtts, count, 50), percentile(rtts, count, 90), \
+              percentile(rtts, count, 99), rtts[count - 1]);
+}
+
 // /*
 // INPUT PARAMETERS
 //   - sockfd: socket file descriptor connected to MIP daemon on the same host
@@ -0,0 +1,203 @@
+#include "router.h"
+
+/*
+Microbenchmark of the DVR table. Full updates of 254 destinations are applied
+to the array-indexed table, and to the linked list table the router used
+before, followed by a lookup of every destination.
+
+USAGE: bench_router [rounds]
+*/
+
+int debug;
+
+// route of the linked list table
+struct lroute{
+	uint8_t mip_end;
+	uint8_t cost;
+	uint8_t mip_next;
+	uint8_t changed;
+	struct lroute *next;
+};
+
+static struct lroute *list_add(struct lroute *list, struct lroute *new){
+	struct lroute *temp = list;
+
+	if(temp == NULL)
+		return new;
+
+	while(temp->next != NULL)
+		temp = temp->next;
+	temp->next = new;
+
+	return list;
+}
+
+static struct lroute *list_remove(struct lroute *list, uint8_t mip_addr){
+	struct lroute *temp = list;
+	struct lroute *prev = NULL;
+
+	while(temp != NULL){
+		if(temp->mip_end == mip_addr){
+			if(prev == NULL)
+				list = temp->next;
+			else
+				prev->next = temp->next;
+			free(temp);
+			break;
+		}
+		prev = temp;
+		temp = temp->next;
+	}
+
+	return list;
+}
+
+static struct lroute *list_update(struct lroute *table, uint8_t *links, \
+						uint8_t (*dist)[256], char *update, int update_size){
+	uint8_t dst, src, cost, next, buf[update_size];
+	int n, best, count = 0;
+	struct lroute *temp;
+
+	memcpy(buf, update, update_size);
+	src = buf[count++];
+
+	while(count < update_size && buf[count] != 255){
+		dst = buf[count++];
+		cost = buf[count++];
+		dist[src][dst] = cost < infinity ? cost : infinity;
+
+		temp = table;
+		while(temp != NULL && temp->mip_end != dst)
+			temp = temp->next;
+
+		if(cost + links[src] >= infinity){
+			if(temp != NULL && temp->mip_next == src)
+				table = list_remove(table, dst);
+		}
+		else if(temp == NULL){
+			struct lroute *new = malloc(sizeof(struct lroute));
+			new->mip_end = dst;
+			new->cost = cost + links[src];
+			new->mip_next = src;
+			new->changed = 1;
+			new->next = NULL;
+
+			table = list_add(table, new);
+		}
+		else if(temp->mip_next == src && temp->cost != cost + links[src]){
+			best = cost + links[src];
+			next = src;
+
+			// dearer, so a neighbor that advertised a cheaper route takes it over
+			for(n=0; n<256 && cost + links[src] > temp->cost; n++){
+				if(n != src && dist[n][dst] + links[n] < best){
+					best = dist[n][dst] + links[n];
+					next = n;
+				}
+			}
+
+			temp->cost = best;
+			if(next != src){
+				temp->mip_next = next;
+				temp->changed = 1;
+			}
+		}
+		else if(cost + links[src] < temp->cost){
+			temp->cost = cost + links[src];
+			temp->mip_next = src;
+			temp->changed = 1;
+		}
+	}
+
+	return table;
+}
+
+static uint16_t list_next(struct lroute *list, uint8_t mip_req){
+	uint16_t next = 0;
+
+	while(list != NULL){
+		if(list->mip_end == mip_req)
+			next = (list->mip_end << 8) | list->mip_next;
+		list = list->next;
+	}
+
+	return next;
+}
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+Fills 'update' with a full update from 'src' of every destination but 0 and
+255, at a cost that depends on 'round' so every round changes the table.
+*/
+static int fill_update(char *update, uint8_t src, int round){
+	int i;
+	int count = 0;
+
+	update[count++] = src;
+	for(i=1; i<255; i++){
+		update[count++] = i;
+		update[count++] = 1 + (i + round) % 8;
+	}
+	update[count++] = (char)255;
+
+	return count;
+}
+
+int main(int argc, char *argv[]){
+	int i, j, size;
+	int rounds = argc > 1 ? strtol(argv[1], NULL, 10) : 10000;
+	uint64_t start, array_ns, list_ns;
+	uint32_t sum = 0;
+	uint8_t links[256];
+	static uint8_t dist[256][256];
+	char update[2 * 256 + 2];
+	struct router rt;
+	struct lroute *list = NULL, *temp;
+
+	memset(links, 1, sizeof(links));
+	memset(dist, infinity, sizeof(dist));
+	memset(&rt, 0, sizeof(rt));
+	if(init_timers(&rt.timers) == -1)
+		return EXIT_FAILURE;
+
+	start = now_ns();
+	for(i=0; i<rounds; i++){
+		size = fill_update(update, 1 + i % 2, i);
+		update_table(&rt, links, update, size);
+		for(j=1; j<255; j++)
+			sum += get_next(&rt, j);
+	}
+	array_ns = now_ns() - start;
+
+	start = now_ns();
+	for(i=0; i<rounds; i++){
+		size = fill_update(update, 1 + i % 2, i);
+		list = list_update(list, links, dist, update, size);
+		for(j=1; j<255; j++)
+			sum -= list_next(list, j);
+	}
+	list_ns = now_ns() - start;
+
+	while(list != NULL){
+		temp = list;
+		list = list->next;
+		free(temp);
+	}
+
+	printf("%d full updates of 254 destinations, each with 254 lookups\n", \
+																																rounds);
+	printf("%-8s%14s\n", "table", "ns/update");
+	printf("%-8s%14.0f\n", "array", (double)array_ns / rounds);
+	printf("%-8s%14.0f\n", "list", (double)list_ns / rounds);
+	printf("speedup %.1fx%s\n", (double)list_ns / array_ns, \
+																sum ? " (TABLES DISAGREE)" : "");
+
+	return sum ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -16,10 +16,49 @@
 #include <unistd.h>
 #include <sys/un.h>
 #include <sys/uio.h>
+#include <time.h>
+#include <errno.h>
 
 #define BUF_SIZE 1500
 #define MIP_HDR_SIZE 4
 #define MAC_SIZE 6
+#define MAX_IFS 16
+#define MIP_TTL 15
+
+#define STATS_INTERVAL 1000000 // usec between reads of kernel statistics
+#define BUFSIZE_MAX (8 * 1024 * 1024)
+#define FRAME_TRUESIZE 2304 // kernel memory charged per full-sized frame
+#define HIST_BUCKETS 128
+#define TX_RING 256 // sent frames waiting for their transmit timestamp
+#define NUM_TRA 8
+#define RX_BUDGET 32 // frames or messages read from a socket per loop
+
+#define PROBE_INTERVAL 1000000 // usec between link probes to each neighbor
+#define LINK_RTT_BASE 1000 // usec of round-trip time a link can have at cost 1
+#define LINK_COST_MAX 8 // also in router.h, where it sets the default infinity
+#define LINK_LOSS_MAX 500 // permille of loss where a link gets LINK_COST_MAX
+#define LINK_SAMPLES 3 // replies needed before a link cost is published
+#define RT_METRIC 1 // routing socket message with the cost of a link
+#define RT_NEIGH_DOWN 2 // routing socket message of a neighbor gone silent
+#define RT_NEIGH_UP 3 // routing socket message of a neighbor heard again
+#define HELLO_MULT 3 // hellos a neighbor can miss before it is down
+
+#define SHAPE_QLEN 256 // frames a shaped interface can hold back
+
+#define CODEL_TARGET 5000 // usec of acceptable standing queue delay
+#define CODEL_INTERVAL 100000 // usec, about a worst-case round-trip time
+
+#define NOTICE_INTERVAL 10000 // usec between congestion notices to a source
+
+#define BUNDLE_MAX 256 // bytes of the largest packet that is bundled
+
+#define POOL_SIZE 1024 // packet buffers in the pool
+#define PKT_HEADROOM 32 // bytes in front of a packet for prepending headers
+#define CACHE_LINE 64
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#define CKPT_MAGIC 0x4d495031 // "MIP1", start of a neighbor checkpoint file
+#define STALE_TIME (3 * PROBE_INTERVAL) // usec a stale neighbor is used
 
 struct header{
   uint8_t tra;
@@ -42,9 +81,25 @@ struct interface{
   uint8_t mip_src;
   uint8_t mac_dst[6];
   uint8_t mac_src[6];
+  uint8_t stale; // loaded from the checkpoint and not heard from yet
   struct interface *next;
 };
 
+/*
+Checkpoint of the ARP cache, in a file mapped by 'mip_daemon -k' and indexed
+by the MIP address of the neighbor. 'mip_src' is the local address of the 
+interface the neighbor is on. It is written whenever a neighbor is learned,
+so a restarted daemon can send to its neighbors without asking for their MAC
+addresses first. The checkpoint is thrown if its 'size' does not match.
+*/
+struct arp_ckpt{
+  uint32_t magic;
+  uint32_t size;
+  uint8_t valid[256];
+  uint8_t mip_src[256];
+  uint8_t mac[256][MAC_SIZE];
+};
+
 struct ifname{
   struct ifname *next;
   char name[];
@@ -59,19 +114,241 @@ struct message{
   char data[];
 };
 
+struct pkt;
+
 struct data{
   struct data *next;
-  uint8_t dst, src, ttl;
+  uint8_t tra, dst, src, ttl;
+  uint8_t follow; // datagrams queued behind this one under its route request
   uint16_t data_size;
-  char datagram[];
+  uint64_t stamp; // time the datagram entered the daemon
+
+  struct pkt *pkt; // buffer holding the datagram
+  char *datagram; // in the buffer of 'pkt'
+};
+
+/*
+Packet buffer from the pool. The packet, a frame or a datagram, is 'len' 
+bytes at 'head' in 'buf', with headroom in front of it for the MIP and 
+Ethernet headers it is sent with. 'refs' counts the queues and the receive 
+loop holding the buffer, and it goes back to the pool when the last lets go.
+'dgram' is the node of the buffer while it waits for a route.
+*/
+struct pkt{
+  struct pkt *next; // in the free list, a shaper or the unbundled frames
+  int refs;
+  uint16_t head, len;
+  uint64_t stamp; // time the buffer was queued in a shaper
+  struct data dgram;
+  char buf[PKT_HEADROOM + sizeof(struct frame) + BUF_SIZE] \
+                                          __attribute__((aligned(CACHE_LINE)));
+};
+
+/*
+Pool of packet buffers, mapped at startup and on huge pages with -P. A buffer
+asked for while the pool is empty is allocated on the heap and freed again
+instead, counted in 'misses'.
+*/
+struct pool{
+  struct pkt *bufs, *free;
+  size_t size; // bytes mapped
+  int used, used_max;
+  int hugepages;
+  uint64_t allocs, misses;
+};
+
+/*
+Socket buffer sizes of an interface, given as -r/-w [ifname=]bytes. An empty
+name is the default for every interface.
+*/
+struct bufsize{
+  char ifname[IF_NAMESIZE];
+  int rcvbuf;
+  int sndbuf;
+};
+
+/*
+Token bucket of an interface, given as -S [ifname=]kbit,bytes. An empty name
+is the default for every interface.
+*/
+struct shapeconf{
+  char ifname[IF_NAMESIZE];
+  int rate; // kbit/s
+  int burst; // bytes
+};
+
+struct config{
+  char *stats_path;
+  char *echo_path;
+  int busy_poll; // usec to spin before sleeping, 0 to always sleep
+  int num_bufs;
+  struct bufsize bufs[MAX_IFS];
+  int num_shapes;
+  struct shapeconf shapes[MAX_IFS];
+  int bundle; // usec a bundle can wait for more packets, 0 to not bundle
+  int hugepages; // map the packet buffer pool on huge pages?
+  int hello; // usec between hellos to each neighbor, 0 to not send them
+  int hello_mult; // hellos a neighbor can miss before it is declared down
+  char *ckpt_path;
+};
+
+// a sent frame waiting for its transmit timestamp
+struct tx_stamp{
+  uint32_t key;
+  uint8_t tra;
+  struct timespec sent;
+};
+
+/*
+CoDel state of a queue. 'first_above' is when the sojourn time will have been
+above CODEL_TARGET for an interval, 0 if it is below. While 'dropping', the
+next datagram is dropped at 'drop_next'.
+*/
+struct codel{
+  uint64_t first_above, drop_next;
+  uint32_t count, lastcount;
+  int dropping;
+  uint64_t drops;
+};
+
+/*
+Token bucket shaper of a local interface. 'tokens' are the bytes that can be 
+sent right away, refilled at 'rate' bytes per second up to 'burst'. Datagrams
+and control messages that do not fit wait in the queue until enough tokens 
+are refilled, while ARP and DVR frames are sent at once but still use tokens.
+'rate' is 0 if the interface is not shaped.
+*/
+struct shaper{
+  uint64_t rate;
+  int64_t tokens, burst;
+  uint64_t last; // time of the last refill
+  struct pkt *head, *tail;
+  int qlen, qmax;
+  uint64_t direct, delayed, drops;
+  struct codel codel;
+};
+
+/*
+Statistics of a local interface. kernel_packets, kernel_drops and burst_max 
+come from PACKET_STATISTICS, rxq_ovfl is the last SO_RXQ_OVFL value seen.
+*/
+struct ifstats{
+  int sockfd;
+  char name[IF_NAMESIZE];
+  int rcvbuf, sndbuf;
+  int rcvbuf_grown, sndbuf_grown;
+  uint64_t rx_frames, tx_frames, tx_drops, last_tx_drops;
+  uint64_t budget_out; // loops the interface used up its RX_BUDGET in
+  uint64_t kernel_packets, kernel_drops;
+  uint32_t rxq_ovfl, burst_max;
+  uint32_t tx_key; // SOF_TIMESTAMPING_OPT_ID of the next frame sent
+  struct tx_stamp tx_ring[TX_RING];
+  struct shaper shaper;
+};
+
+// latencies in microseconds, see hist_bucket() for the bucket layout
+struct histogram{
+  uint64_t count, max;
+  uint64_t buckets[HIST_BUCKETS];
+};
+
+/*
+Counters of the daemon itself. The histograms measure the time a datagram 
+spends in the daemon: 'forward' from arrival to sending on the next hop, 
+'originate' from mip_tp to the first hop and 'deliver' from arrival to mip_tp.
+'kernel_rx' and 'kernel_tx' are indexed by TRA and measure the time from the 
+kernel receive timestamp to the daemon, and from send() to the kernel 
+transmit timestamp.
+*/
+struct counters{
+  uint64_t queue_drops, ttl_drops;
+  uint64_t ttl_replies; // probes answered with a time exceeded, not dropped
+  struct codel codel; // of the datagrams waiting for a route
+  struct codel sweep; // of the oldest datagrams, whose route may never come
+  uint64_t notices_sent, notices_recv;
+  uint64_t tp_segments, tp_messages;
+  uint64_t tp_budget_out; // loops mip_tp used up its RX_BUDGET in
+  uint64_t bundles_sent, bundled, unbundled;
+  uint64_t spins, sleeps;
+  struct histogram forward, originate, deliver;
+  struct histogram kernel_rx[NUM_TRA], kernel_tx[NUM_TRA];
+};
+
+/*
+Round-trip time and loss of the link to a neighbor, measured with link 
+probes. 'loss' is in permille, and 'cost' is the cost last published to the
+router, 0 if none is published yet. A neighbor that sends hellos is 'down' 
+once 'dead_at' passes without one, 0 if no hello is awaited.
+*/
+struct link{
+  uint8_t cost;
+  uint8_t waiting; // probe 'seq' unanswered?
+  uint8_t down;
+  uint16_t seq;
+  uint32_t samples, loss;
+  uint64_t srtt;
+  uint64_t sent, lost;
+  uint64_t dead_at;
+  uint64_t hellos, downs;
+};
+
+/*
+Segments to mip_tp coalesced from one receive batch. 'buf' holds a batch 
+message after its leading 0, see sock.h, and 'stamps' the arrival time of 
+each segment.
+*/
+struct coalesce{
+  int count, size;
+  uint64_t stamps[TP_BATCH];
+  char buf[2 + TP_BATCH * (2 + BUF_SIZE)];
+};
+
+/*
+Packets bundled for the neighbor in 'ifa', sent when 'buf' is full or at 
+'deadline'.
+*/
+struct bundle{
+  struct interface ifa;
+  int count, size;
+  uint64_t deadline;
+  char buf[BUF_SIZE - MIP_HDR_SIZE];
+};
+
+/*
+Congestion notice waiting to be sent to a source, about the segment with 
+'port' and 'seq'. 'last' is when the source was last sent a notice.
+*/
+struct notice{
+  uint64_t last;
+  uint8_t pending, reason;
+  uint16_t port;
+  uint8_t seq;
 };
 
 extern int debug;
+extern struct config conf;
+extern struct counters stats;
+extern struct ifstats ifstats[MAX_IFS];
+extern int num_ifstats;
+extern struct link links[256];
+extern struct notice notices[256];
+extern struct coalesce coalesced;
+extern struct bundle bundles[256];
+extern struct pkt *unbundled;
+extern struct pool pool;
+extern struct arp_ckpt *ckpt;
+extern int notices_pending;
 
 int proper_usage(int arg_req, int argc, char *argv[]);
 
 int handle_args(int argc, char *argv[]);
 
+int add_bufsize(char *arg, int optname);
+
+int add_hello(char *arg);
+
+void get_bufconf(char *ifname, int *rcvbuf, int *sndbuf);
+
 void free_data(struct data *list);
 
 void free_interfaces(struct interface *list);
@@ -96,10 +373,19 @@ struct interface *get_interface(struct interface *list, uint8_t mip_addr);
 
 void add_interface(struct interface *new, struct interface **list);
 
-int recv_data(int sockfd, uint8_t *mip_addr, char *buf);
+struct interface *get_local(struct interface *list, int sockfd);
+
+int learn_neighbor(struct interface **arp_cache, struct interface *local, \
+                                              uint8_t mip_addr, uint8_t mac[6]);
+
+int announce(struct interface *my_interfaces);
+
+int update_filters(struct interface *my_interfaces);
+
+int recv_data(int sockfd, uint8_t *mip_addr, char *buf, int size);
 
-void init_data(struct data *data_ptr, uint8_t dst, uint8_t src, uint8_t ttl, \
-                                            uint16_t data_len, char *datagram);
+void init_data(struct data *data_ptr, uint8_t tra, uint8_t dst, uint8_t src, \
+                                                uint8_t ttl, struct pkt *pkt);
 
 void save_data(struct data *new, struct data **list);
 
@@ -107,33 +393,213 @@ int storage_status(struct data *list);
 
 void remove_data(uint8_t mip_addr, struct data **list);
 
+struct data *drop_data(uint8_t mip_addr, struct data **list);
+
 int size_check(int data_size);
 
+int truncated(struct header *mip_hdr, int frame_size);
+
 struct data *get_data(uint8_t mip_addr, struct data *list);
 
+int queue_pkt(int fwd_fd, struct data **list, uint8_t tra, uint8_t dst, \
+                                      uint8_t src, uint8_t ttl, struct pkt *pkt);
+
+int queue_data(int fwd_fd, struct data **list, uint8_t tra, uint8_t dst, \
+                              uint8_t src, uint8_t ttl, char *buf, int size);
+
+int queue_super(int fwd_fd, struct data **list, char *super, int size);
+
+int ctrl_reply(int fwd_fd, struct data **list, struct header *mip_hdr, \
+                                      uint8_t type, uint8_t hop, char *ctrl);
+
+void write_miphdr(char *buf, uint8_t tra, uint8_t mip_dst, uint8_t mip_src, \
+                                                  int data_size, uint8_t ttl);
+
 char *create_miphdr(uint8_t tra, uint8_t mip_dst, uint16_t mip_src, \
                                                     int msg_len, uint8_t ttl);
 
 char *add_miphdr(char *mip_hdr, int hdr_size, char *msg, int msg_size);
 
+int xmit_frame(int sockfd, struct frame *eth_frame, int frame_size, \
+                                                                  uint8_t tra);
+
+int send_pkt(struct interface *ifa, struct pkt *pkt);
+
 int send_frame(struct interface *ifa, char *packet, int packet_size);
 
+int forward_data(struct interface *ifa, struct data *dgram, struct data **list);
+
 int broadcast(struct interface *my_interfaces, uint8_t mip_dst);
 
 char *create_update(struct interface *list, int update_size);
 
-struct frame *recv_frame(int sockfd);
+struct pkt *recv_frame(int sockfd);
 
 int send_segment(int sockfd, uint8_t mip_addr, char *seg, int seg_size);
 
+void read_header(char *data, struct header *mip_hdr);
+
 struct header *get_header(char *data);
 
 char *recv_update(int sockfd, int *bytes);
 
 int request_route(int sockfd, uint8_t mip_addr);
 
+int request_pending(int sockfd, struct data *list);
+
 int recv_route(int sockfd, uint16_t *route);
 
+/* STATISTICS FUNCTIONS */
+
+uint64_t get_time(void);
+
+struct ifstats *add_ifstats(int sockfd, char *name);
+
+struct ifstats *get_ifstats(int sockfd);
+
+uint64_t ts_diff(struct timespec *end, struct timespec *start);
+
+void count_rx(int sockfd, struct msghdr *msg, uint8_t tra);
+
+void count_tx(int sockfd, int dropped, uint8_t tra, struct timespec *sent);
+
+void read_tx_stamps(int sockfd);
+
+void autotune(struct ifstats *ifs, uint32_t drops, uint32_t tx_drops);
+
+void poll_stats(void);
+
+int hist_bucket(uint64_t usec);
+
+uint64_t hist_limit(int index);
+
+void hist_add(struct histogram *hist, uint64_t usec);
+
+uint64_t hist_percentile(struct histogram *hist, double percent);
+
+void write_hist(int sockfd, char *name, struct histogram *hist);
+
+void write_stats(int sockfd, struct data *data_list);
+
+/* LINK FUNCTIONS */
+
+uint8_t quantize_rtt(uint64_t usec);
+
+uint8_t link_cost(struct link *link);
+
+int send_rtmsg(int rt_fd, uint8_t type, uint8_t mip_addr, uint8_t cost);
+
+int update_metric(int rt_fd, uint8_t mip_addr);
+
+int probe_links(int rt_fd, struct interface *arp_cache);
+
+int link_reply(struct interface *ifa, char *ctrl);
+
+int link_sample(int rt_fd, uint8_t mip_addr, char *ctrl);
+
+int send_hellos(struct interface *arp_cache);
+
+int link_hello(int rt_fd, uint8_t mip_addr, char *hello);
+
+int check_hellos(int rt_fd, uint64_t now);
+
+uint64_t hello_next(void);
+
+void write_links(int sockfd);
+
+/* SHAPER FUNCTIONS */
+
+int add_shape(char *arg);
+
+void init_shaper(struct ifstats *ifs);
+
+void refill(struct shaper *sh, uint64_t now);
+
+int shape_frame(struct ifstats *ifs, struct pkt *pkt, uint8_t tra);
+
+int shape_release(uint64_t now);
+
+uint64_t shape_next(void);
+
+void write_shapers(int sockfd);
+
+/* CODEL FUNCTIONS */
+
+uint64_t isqrt(uint64_t n);
+
+uint64_t control_law(uint64_t t, uint32_t count);
+
+int ok_to_drop(struct codel *c, uint64_t sojourn, uint64_t now, int qlen);
+
+int codel_drop(struct codel *c, uint64_t sojourn, uint64_t now, int qlen);
+
+uint64_t codel_sweep(struct data **list, uint64_t now);
+
+struct data *codel_get(struct data **list, uint8_t mip_addr, uint64_t now);
+
+/* CONGESTION FUNCTIONS */
+
+void note_congestion(uint8_t tra, uint8_t src, char *segment, int size, \
+                                                              uint8_t reason);
+
+void note_frame(struct frame *eth_frame, uint8_t reason);
+
+int deliver_notice(int tp_fd, uint8_t mip_addr, uint16_t port, uint8_t seq, \
+                                                              uint8_t reason);
+
+int send_notices(int fwd_fd, int tp_fd, struct data **list, \
+                                            struct interface *my_interfaces);
+
+/* COALESCING FUNCTIONS */
+
+int flush_segments(int tp_fd);
+
+int coalesce_segment(int tp_fd, uint8_t src, char *seg, int seg_size, \
+                                                            uint64_t stamp);
+
+/* BUNDLE FUNCTIONS */
+
+int flush_bundle(struct bundle *b);
+
+int send_datagram(struct interface *ifa, struct pkt *pkt);
+
+int bundle_release(uint64_t now);
+
+uint64_t bundle_next(void);
+
+void unbundle(struct frame *eth_frame, int frame_size, struct header *mip_hdr);
+
+struct pkt *next_unbundled(void);
+
+/* POOL FUNCTIONS */
+
+int init_pool(void);
+
+struct pkt *pkt_alloc(void);
+
+struct pkt *pkt_get(struct pkt *pkt);
+
+void pkt_put(struct pkt *pkt);
+
+char *pkt_data(struct pkt *pkt);
+
+char *pkt_push(struct pkt *pkt, int size);
+
+char *pkt_pull(struct pkt *pkt, int size);
+
+void write_pool(int sockfd);
+
+/* CHECKPOINT FUNCTIONS */
+
+int init_ckpt(char *path);
+
+int load_neighbors(struct interface **arp_cache, \
+                                            struct interface *my_interfaces);
+
+void save_neighbor(struct interface *ifa);
+
+int expire_stale(struct interface **arp_cache);
+
 /* DEBUG FUNCTIONS */
 
 void print_names(struct ifname *ifnames);
@@ -0,0 +1,210 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct bundle bundles[256];
+struct pkt *unbundled;
+
+static int open_bundles;
+
+/*
+INPUT-OUTPUT PARAMETER
+  - b: bundle
+
+This function sends the packets in 'b' to its neighbor. A single packet is
+sent as it is, more are sent in one TRA 5 frame. -1 is returned if an error
+occur.
+*/
+int flush_bundle(struct bundle *b){
+  int retv;
+  struct pkt *pkt;
+
+  if(!b->count)
+    return 0;
+
+  if(b->count == 1){
+    retv = send_frame(&b->ifa, b->buf, b->size);
+  }
+  else{
+    pkt = pkt_alloc();
+    if(pkt == NULL)
+      return -1;
+
+    memcpy(pkt_data(pkt) + MIP_HDR_SIZE, b->buf, b->size);
+    pkt->len = MIP_HDR_SIZE + b->size;
+    write_miphdr(pkt_data(pkt), TRA_BUNDLE, b->ifa.mip_dst, b->ifa.mip_src, \
+                                                                  b->size, 0);
+
+    DLOG("sending bundle");
+    retv = send_pkt(&b->ifa, pkt);
+    pkt_put(pkt);
+
+    stats.bundles_sent++;
+    stats.bundled += b->count;
+  }
+
+  b->count = 0;
+  b->size = 0;
+  open_bundles--;
+
+  return retv;
+}
+
+/*
+INPUT PARAMETERS
+  - ifa: interface struct of the next hop
+  - pkt: packet buffer holding MIP header + data
+
+This function sends a datagram or control message to the next hop in 'ifa'.
+With bundling on, a small packet is copied to the bundle of the next hop
+instead, which is sent first if the packet does not fit. -1 is returned if
+an error occur.
+*/
+int send_datagram(struct interface *ifa, struct pkt *pkt){
+  int retv;
+  char *packet = pkt_data(pkt);
+  int packet_size = pkt->len;
+  struct bundle *b = &bundles[ifa->mip_dst];
+
+  if(!conf.bundle)
+    return send_pkt(ifa, pkt);
+
+  // too large to bundle, but sent after the packets already bundled
+  if(packet_size > BUNDLE_MAX){
+    retv = flush_bundle(b);
+    if(retv == -1)
+      return -1;
+
+    return send_pkt(ifa, pkt);
+  }
+
+  // full, or the neighbor moved to another interface?
+  if(b->count && (b->size + packet_size > (int)sizeof(b->buf) || \
+                                              b->ifa.sockfd != ifa->sockfd)){
+    retv = flush_bundle(b);
+    if(retv == -1)
+      return -1;
+  }
+
+  if(!b->count){
+    b->ifa = *ifa;
+    b->deadline = get_time() + conf.bundle;
+    open_bundles++;
+  }
+
+  memcpy(&b->buf[b->size], packet, packet_size);
+  b->size += packet_size;
+  b->count++;
+
+  return 0;
+}
+
+/*
+INPUT PARAMETER
+  - now: current time
+
+This function sends the bundles whose deadline has passed. -1 is returned if
+an error occur.
+*/
+int bundle_release(uint64_t now){
+  int i, retv;
+
+  for(i=0; i<256 && open_bundles; i++){
+    if(bundles[i].count && bundles[i].deadline <= now){
+      retv = flush_bundle(&bundles[i]);
+      if(retv == -1)
+        return -1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+This function returns the earliest deadline of the bundles, or 0 if no
+bundle is waiting.
+*/
+uint64_t bundle_next(void){
+  int i;
+  uint64_t next = 0;
+
+  for(i=0; i<256 && open_bundles; i++){
+    if(bundles[i].count && (!next || bundles[i].deadline < next))
+      next = bundles[i].deadline;
+  }
+
+  return next;
+}
+
+/*
+INPUT PARAMETERS
+  - eth_frame: received TRA 5 frame
+  - frame_size: size of 'eth_frame' as received
+  - mip_hdr: MIP header of 'eth_frame'
+
+This function splits a bundle into frames of their own, with the Ethernet
+header of 'eth_frame', which are taken by next_unbundled(). Each frame gets a
+packet buffer of its own, so it can be queued like any received frame. A 
+packet that runs past the end of the bundle ends it, and a bundle whose
+payload runs past the end of the frame is thrown.
+*/
+void unbundle(struct frame *eth_frame, int frame_size, struct header *mip_hdr){
+  int offset = MIP_HDR_SIZE;
+  int end = MIP_HDR_SIZE + (mip_hdr->payload - MIP_HDR_SIZE) * 4;
+  int packet_size;
+  struct header inner;
+  struct pkt *new, *tail = unbundled;
+
+  if(end > frame_size - (int)sizeof(struct frame)){
+    fprintf(stderr, "TRUNCATED BUNDLE IS THROWN\n");
+    return;
+  }
+
+  while(tail != NULL && tail->next != NULL)
+    tail = tail->next;
+
+  while(offset + MIP_HDR_SIZE <= end){
+    read_header(&eth_frame->data[offset], &inner);
+    packet_size = MIP_HDR_SIZE;
+    if(inner.payload > MIP_HDR_SIZE)
+      packet_size += (inner.payload - MIP_HDR_SIZE) * 4;
+
+    if(offset + packet_size > end)
+      break;
+
+    new = pkt_alloc();
+    if(new == NULL)
+      break;
+
+    new->len = sizeof(struct frame) + packet_size;
+    memcpy(pkt_data(new), eth_frame, sizeof(struct frame));
+    memcpy(pkt_data(new) + sizeof(struct frame), &eth_frame->data[offset], \
+                                                                packet_size);
+
+    if(tail == NULL)
+      unbundled = new;
+    else
+      tail->next = new;
+    tail = new;
+
+    stats.unbundled++;
+    offset += packet_size;
+  }
+
+}
+
+/*
+This function returns the packet buffer of the next frame split off a bundle,
+or NULL if there is none. The caller lets go of the buffer with pkt_put().
+*/
+struct pkt *next_unbundled(void){
+  struct pkt *head = unbundled;
+
+  if(head == NULL)
+    return NULL;
+
+  unbundled = head->next;
+  head->next = NULL;
+
+  return head;
+}
@@ -0,0 +1,150 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct arp_ckpt *ckpt;
+
+/*
+INPUT PARAMETER
+  - path: path of the checkpoint file
+
+This function maps the checkpoint file at 'path', and creates it if it does
+not exist. A checkpoint of another size is cleared. -1 is returned if an
+error occur.
+*/
+int init_ckpt(char *path){
+  int fd;
+  void *map;
+  struct stat st;
+
+  fd = open(path, O_RDWR | O_CREAT, 0600);
+  if(fd == -1){
+    perror("init_ckpt(): open()");
+    return -1;
+  }
+
+  if(fstat(fd, &st) == -1 || (st.st_size != sizeof(struct arp_ckpt) && \
+                                ftruncate(fd, sizeof(struct arp_ckpt)) == -1)){
+    perror("init_ckpt(): ftruncate()");
+    close(fd);
+    return -1;
+  }
+
+  map = mmap(NULL, sizeof(struct arp_ckpt), PROT_READ | PROT_WRITE, \
+                                                          MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){
+    perror("init_ckpt(): mmap()");
+    return -1;
+  }
+
+  ckpt = map;
+
+  if(ckpt->magic != CKPT_MAGIC || ckpt->size != sizeof(struct arp_ckpt)){
+    memset(ckpt, 0, sizeof(struct arp_ckpt));
+    ckpt->magic = CKPT_MAGIC;
+    ckpt->size = sizeof(struct arp_ckpt);
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETER
+  - my_interfaces: linked list of the hosts interfaces
+
+INPUT-OUTPUT PARAMETER
+  - arp_cache: linked list of interfaces of direct neighbors
+
+This function adds the neighbors of the checkpoint to 'arp_cache' as stale
+entries. They are sent to right away, and are confirmed by the first frame
+the neighbor sends, see learn_neighbor(). A neighbor on a local address this
+host no longer has is skipped. The number of neighbors added is returned.
+*/
+int load_neighbors(struct interface **arp_cache, \
+                                            struct interface *my_interfaces){
+  int i;
+  int count = 0;
+  struct interface *local, *new;
+
+  if(ckpt == NULL)
+    return 0;
+
+  for(i=1; i<255; i++){
+
+    if(!ckpt->valid[i])
+      continue;
+
+    local = get_interface(my_interfaces, ckpt->mip_src[i]);
+    if(local == NULL || get_interface(*arp_cache, i) != NULL){
+      ckpt->valid[i] = 0;
+      continue;
+    }
+
+    new = malloc(sizeof(struct interface));
+    if(new == NULL){
+      perror("load_neighbors(): malloc()");
+      return count;
+    }
+
+    init_interface(new, local->sockfd, i, local->mip_src, ckpt->mac[i], \
+                                                              local->mac_src);
+    new->stale = 1;
+    add_interface(new, arp_cache);
+    count++;
+  }
+
+  return count;
+}
+
+/*
+INPUT PARAMETER
+  - ifa: entry of a neighbor in the ARP cache
+
+This function writes the entry of a neighbor to the checkpoint, if there is
+one.
+*/
+void save_neighbor(struct interface *ifa){
+  if(ckpt == NULL)
+    return;
+
+  ckpt->valid[ifa->mip_dst] = 1;
+  ckpt->mip_src[ifa->mip_dst] = ifa->mip_src;
+  memcpy(ckpt->mac[ifa->mip_dst], ifa->mac_dst, MAC_SIZE);
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+  - arp_cache: linked list of interfaces of direct neighbors
+
+This function removes the stale neighbors that have not sent a frame since
+they were loaded from the checkpoint, from 'arp_cache' and the checkpoint.
+Datagrams to them ask for their MAC address again. The number of neighbors
+removed is returned.
+*/
+int expire_stale(struct interface **arp_cache){
+  int count = 0;
+  struct interface **link = arp_cache;
+  struct interface *temp;
+
+  while(*link != NULL){
+    temp = *link;
+
+    if(!temp->stale){
+      link = &temp->next;
+      continue;
+    }
+
+    *link = temp->next;
+    if(ckpt != NULL)
+      ckpt->valid[temp->mip_dst] = 0;
+    free(temp);
+    count++;
+  }
+
+  return count;
+}
@@ -0,0 +1,96 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct coalesce coalesced;
+
+/*
+INPUT PARAMETER
+  - tp_fd: MIP-TP socket
+
+This function hands the coalesced segments to mip_tp. A single segment is
+sent as it always was, while more are sent as one batch message. -1 is
+returned if an error occur.
+*/
+int flush_segments(int tp_fd){
+  int i, retv;
+  uint64_t now;
+  uint16_t seg_size;
+  struct coalesce *c = &coalesced;
+
+  if(!c->count)
+    return 0;
+
+  if(c->count == 1){
+    memcpy(&seg_size, &c->buf[2], sizeof(seg_size));
+
+    DLOG("sending segment to MIP-TP daemon");
+    retv = send_segment(tp_fd, (uint8_t)c->buf[0], &c->buf[4], seg_size);
+  }
+  else{
+    c->buf[1] = c->count;
+
+    DLOG("sending coalesced segments to MIP-TP daemon");
+    retv = send_segment(tp_fd, 0, c->buf, c->size);
+  }
+
+  if(retv != -1){
+    now = get_time();
+    for(i=0; i<c->count; i++)
+      hist_add(&stats.deliver, now - c->stamps[i]);
+
+    stats.tp_segments += c->count;
+    stats.tp_messages++;
+  }
+
+  c->count = 0;
+  c->size = 0;
+
+  return retv == -1 ? -1 : 0;
+}
+
+/*
+INPUT PARAMETERS
+  - tp_fd: MIP-TP socket
+  - src: MIP source address of the segment
+  - seg: segment
+  - seg_size: size of 'seg'
+  - stamp: time the segment arrived
+
+This function adds a segment to mip_tp to the coalesced segments. The
+segments coalesced so far are handed to mip_tp first if they are from
+another source, or if there is no room for more. A segment larger than a 
+frame can carry is thrown. -1 is returned if an error occur.
+*/
+int coalesce_segment(int tp_fd, uint8_t src, char *seg, int seg_size, \
+                                                            uint64_t stamp){
+  int retv;
+  uint16_t size = seg_size;
+  struct coalesce *c = &coalesced;
+
+  if(seg_size < 0 || seg_size > BUF_SIZE - MIP_HDR_SIZE){
+    fprintf(stderr, "MALFORMED SEGMENT IS THROWN\n");
+    return 0;
+  }
+
+  if(c->count && ((uint8_t)c->buf[0] != src || c->count == TP_BATCH || \
+                c->size + (int)sizeof(size) + seg_size > (int)sizeof(c->buf))){
+    retv = flush_segments(tp_fd);
+    if(retv == -1)
+      return -1;
+  }
+
+  if(!c->count){
+    c->buf[0] = src;
+    c->size = 2;
+  }
+
+  memcpy(&c->buf[c->size], &size, sizeof(size));
+  memcpy(&c->buf[c->size + sizeof(size)], seg, seg_size);
+  c->size += sizeof(size) + seg_size;
+
+  c->stamps[c->count] = stamp;
+  c->count++;
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+/*
+INPUT PARAMETER
+  - n: integer
+
+This function returns the integer square root of 'n'.
+*/
+uint64_t isqrt(uint64_t n){
+  uint64_t x = n;
+  uint64_t y = (x + 1) / 2;
+
+  while(y < x){
+    x = y;
+    y = (x + n / x) / 2;
+  }
+
+  return x;
+}
+
+/*
+INPUT PARAMETERS
+  - t: time of the last drop
+  - count: number of drops since dropping started
+
+This function returns the time of the next drop. The time between drops 
+shrinks with the square root of 'count', which is what makes the sending rate
+of a TCP-like sender back off linearly.
+*/
+uint64_t control_law(uint64_t t, uint32_t count){
+  return t + CODEL_INTERVAL * 1000 / isqrt((uint64_t)count * 1000000);
+}
+
+/*
+INPUT PARAMETERS
+  - sojourn: time the datagram at the head of the queue spent in the queue
+  - now: current time
+  - qlen: number of datagrams in the queue, the head included
+
+INPUT-OUTPUT PARAMETER
+  - c: CoDel state of the queue
+
+This function returns 1 if the sojourn time has stayed above CODEL_TARGET 
+for at least CODEL_INTERVAL. A queue holding a single datagram is never 
+considered standing.
+*/
+int ok_to_drop(struct codel *c, uint64_t sojourn, uint64_t now, int qlen){
+  if(sojourn < CODEL_TARGET || qlen <= 1){
+    c->first_above = 0;
+    return 0;
+  }
+
+  if(c->first_above == 0){
+    c->first_above = now + CODEL_INTERVAL;
+    return 0;
+  }
+
+  return now >= c->first_above;
+}
+
+/*
+INPUT PARAMETERS
+  - sojourn: time the dequeued datagram spent in the queue
+  - now: current time
+  - qlen: number of datagrams in the queue, the dequeued one included
+
+INPUT-OUTPUT PARAMETER
+  - c: CoDel state of the queue
+
+This function runs CoDel (RFC 8289) for a datagram taken off a queue, and 
+returns 1 if the datagram should be dropped instead of sent. Once the queue
+has stood above the target for an interval, CoDel drops one datagram and 
+keeps dropping at a shrinking interval until the sojourn time is below the 
+target again. The caller takes the next datagram off the queue after a drop.
+*/
+int codel_drop(struct codel *c, uint64_t sojourn, uint64_t now, int qlen){
+  int ok = ok_to_drop(c, sojourn, now, qlen);
+  uint32_t delta;
+
+  if(c->dropping){
+
+    if(!ok){
+      c->dropping = 0;
+      return 0;
+    }
+
+    if(now >= c->drop_next){
+      c->count++;
+      c->drop_next = control_law(c->drop_next, c->count);
+      c->drops++;
+      return 1;
+    }
+
+    return 0;
+  }
+
+  if(ok){
+    c->dropping = 1;
+
+    // dropped recently? start near the old drop rate
+    delta = c->count - c->lastcount;
+    if(delta > 1 && now - c->drop_next < 16 * CODEL_INTERVAL)
+      c->count = delta;
+    else
+      c->count = 1;
+
+    c->drop_next = control_law(now, c->count);
+    c->lastcount = c->count;
+    c->drops++;
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETER
+  - now: current time
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of datagrams waiting for a route
+
+This function runs CoDel on the oldest datagrams in 'list', and throws them
+while CoDel drops. Datagrams whose route never arrives are otherwise only 
+thrown when the list is full. The sweep has its own CoDel state, since it 
+runs whenever the daemon wakes up and not when a datagram is taken off the
+list. The time the sweep can drop next is returned, 0 if it is not waiting
+to drop.
+*/
+uint64_t codel_sweep(struct data **list, uint64_t now){
+  while(*list != NULL && codel_drop(&stats.sweep, now - (*list)->stamp, now, \
+                                                      storage_status(*list))){
+    DLOG("CoDel throwing datagram");
+    drop_data((*list)->dst, list);
+  }
+
+  if(*list == NULL)
+    return 0;
+
+  return stats.sweep.dropping ? stats.sweep.drop_next : stats.sweep.first_above;
+}
+
+/*
+INPUT PARAMETERS
+  - mip_addr: MIP destination address
+  - now: current time
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of datagrams waiting for a route
+
+This function takes the first datagram to 'mip_addr' off 'list' through 
+CoDel. Datagrams CoDel drops are thrown, and the next one to 'mip_addr' is 
+tried. The source of a datagram that is thrown, or that waited while the 
+queue stood above the target, is sent a congestion notice. The datagram is 
+returned but left in 'list', or NULL if there is none.
+*/
+struct data *codel_get(struct data **list, uint8_t mip_addr, uint64_t now){
+  struct data *dgram = get_data(mip_addr, *list);
+
+  while(dgram != NULL && codel_drop(&stats.codel, now - dgram->stamp, now, \
+                                                      storage_status(*list))){
+    DLOG("CoDel throwing datagram");
+    dgram = drop_data(mip_addr, list);
+  }
+
+  if(dgram != NULL && stats.codel.first_above)
+    note_congestion(dgram->tra, dgram->src, dgram->datagram, \
+                                                dgram->data_size, CONG_DELAY);
+
+  return dgram;
+}
@@ -0,0 +1,150 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct notice notices[256];
+int notices_pending;
+
+/*
+INPUT PARAMETERS
+  - tra: TRA-bits of the datagram
+  - src: MIP source address of the datagram, 0 if it is sent from this node
+  - segment: MIP-TP segment carried by the datagram
+  - size: size of 'segment'
+  - reason: CONG_DROP or CONG_DELAY
+
+This function notes that a datagram was dropped or delayed, so send_notices()
+sends a congestion notice to its source. Only datagrams carrying data are
+noted, and a source is sent at most one notice every NOTICE_INTERVAL. A drop
+replaces a delay that is still waiting to be sent.
+*/
+void note_congestion(uint8_t tra, uint8_t src, char *segment, int size, \
+                                                              uint8_t reason){
+  struct notice *n = &notices[src];
+  uint8_t *hdr = (uint8_t *)segment;
+
+  // acks and control messages are not worth a notice
+  if(tra != 4 || size <= TP_HDR_SIZE)
+    return;
+
+  if(n->pending){
+    if(reason != CONG_DROP || n->reason == CONG_DROP)
+      return;
+  }
+  else if(n->last && get_time() - n->last < NOTICE_INTERVAL){
+    return;
+  }
+
+  n->pending = 1;
+  n->reason = reason;
+  n->port = ((hdr[0] & 63) << 8) | hdr[1];
+  n->seq = hdr[3];
+  notices_pending = 1;
+}
+
+/*
+INPUT PARAMETERS
+  - eth_frame: frame that was dropped or delayed
+  - reason: CONG_DROP or CONG_DELAY
+
+This function notes the datagram in 'eth_frame' with note_congestion().
+*/
+void note_frame(struct frame *eth_frame, uint8_t reason){
+  struct header mip_hdr;
+
+  read_header(eth_frame->data, &mip_hdr);
+
+  note_congestion(mip_hdr.tra, mip_hdr.src, &eth_frame->data[MIP_HDR_SIZE], \
+                                  (mip_hdr.payload - MIP_HDR_SIZE) * 4, reason);
+}
+
+/*
+INPUT PARAMETERS
+  - tp_fd: MIP-TP socket
+  - mip_addr: MIP address of the node that sent the notice
+  - port: port of the segment
+  - seq: sequence number of the segment
+  - reason: CONG_DROP or CONG_DELAY
+
+This function hands a congestion notice to mip_tp as a MIP-TP header with
+padding 3, which no segment with data can have, and 'reason' in the unused
+byte. -1 is returned if an error occur.
+*/
+int deliver_notice(int tp_fd, uint8_t mip_addr, uint16_t port, uint8_t seq, \
+                                                              uint8_t reason){
+  uint8_t hdr[TP_HDR_SIZE];
+
+  hdr[0] = (3 << 6) | ((port >> 8) & 63);
+  hdr[1] = port;
+  hdr[2] = reason;
+  hdr[3] = seq;
+
+  stats.notices_recv++;
+
+  return send_segment(tp_fd, mip_addr, (char *)hdr, TP_HDR_SIZE);
+}
+
+/*
+INPUT PARAMETERS
+  - fwd_fd: forwarding socket
+  - tp_fd: MIP-TP socket, 0 if mip_tp is not connected
+  - my_interfaces: local interfaces
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function sends the congestion notices noted since it was last called. A
+notice to a remote source is a control message routed like any other, while
+a notice about a datagram sent from this node goes straight to mip_tp. -1 is
+returned if an error occur while routing a notice.
+*/
+int send_notices(int fwd_fd, int tp_fd, struct data **list, \
+                                            struct interface *my_interfaces){
+  int i, retv;
+  struct notice *n;
+  struct ctrl_msg msg;
+
+  if(!notices_pending)
+    return 0;
+
+  notices_pending = 0;
+
+  for(i=0; i<256; i++){
+    n = &notices[i];
+
+    if(!n->pending)
+      continue;
+
+    n->pending = 0;
+    n->last = get_time();
+
+    if(i == 0 || get_interface(my_interfaces, i) != NULL){
+      if(!tp_fd)
+        continue;
+
+      // the daemon keeps routing even if mip_tp is gone
+      DLOG("sending congestion notice to MIP-TP daemon");
+      deliver_notice(tp_fd, my_interfaces->mip_src, n->port, n->seq, \
+                                                                  n->reason);
+      continue;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = CTRL_CONGESTION;
+    msg.ttl = n->reason;
+    msg.ident = n->port;
+    msg.seq = n->seq;
+    msg.hop = my_interfaces->mip_src;
+    msg.stamp = n->last;
+
+    DLOG("sending congestion notice");
+    retv = queue_data(fwd_fd, list, TRA_CTRL, i, 0, MIP_TTL, (char *)&msg, \
+                                                                  CTRL_SIZE);
+    if(retv == -1)
+      return -1;
+
+    stats.notices_sent++;
+  }
+
+  return 0;
+}
@@ -13,8 +13,12 @@ given is not equal to the number of arguments required and 0 is returned.
 */
 int proper_usage(int arg_req, int argc, char *argv[]){
   if(argc < arg_req){
-    fprintf(stderr, "USAGE: %s [-d] <Transport_socket> <Forwarding_socket>" \
-                            " <Routing_socket> <MIP_addresses...>\n", argv[0]);
+    fprintf(stderr, "USAGE: %s [-d] [-s <Stats_socket>] [-e <Echo_socket>]" \
+                " [-r [ifname=]bytes] [-w [ifname=]bytes] [-p <Busy_poll_usec>]" \
+                " [-S [ifname=]kbit,bytes] [-B <Bundle_usec>] [-P]" \
+                " [-H <Hello_usec>[,multiplier]] [-k <Checkpoint>]" \
+                " <Transport_socket> <Forwarding_socket>" \
+                " <Routing_socket> <MIP_addresses...>\n", argv[0]);
     return 0;
   }
 
@@ -29,28 +33,196 @@ INPUT PARAMETERS
 OUTPUT PARAMETER
   - optind: index of the next argv argument for a subsequent call of getopt()
   - debug: debug-print switch
+  - conf: daemon configuration
 
 This function handles option flags in the cmd-line and makes sure that the user
-starts the program correctly. -d flag activates debug mode. 0 is returned upon
-incorrect usage. 
+starts the program correctly. -1 is returned upon incorrect usage.
+  -d: activates debug mode
+  -s: path of a stats socket where statistics can be read
+  -e: path of an echo socket used by mipping to send echo requests
+  -r: receive buffer size of the raw sockets, optionally for one interface
+  -w: send buffer size of the raw sockets, optionally for one interface
+  -p: busy poll for this many microseconds before sleeping in select()
+  -S: shape the outgoing rate and burst, optionally for one interface
+  -B: bundle small packets to a neighbor for up to this many microseconds
+  -P: map the packet buffer pool on huge pages
+  -H: send hellos to every neighbor at this many microseconds, and declare
+      this daemon down after the multiplier (default HELLO_MULT) is missed
+  -k: path of a checkpoint file the ARP cache is kept in, and loaded from 
+      when the daemon is restarted, see load_neighbors()
 */
 int handle_args(int argc, char *argv[]){
+  int retv;
+
   opterr = 0; //to make getopt not print error message
-  int retv = getopt(argc, argv, "d");
-  if(retv == 'd'){
+  while((retv = getopt(argc, argv, "ds:e:r:w:p:S:B:PH:k:")) != -1){
+    switch(retv){
+      case 'd':
+        debug = 1;
+        break;
+      case 's':
+        conf.stats_path = optarg;
+        break;
+      case 'e':
+        conf.echo_path = optarg;
+        break;
+      case 'r':
+        if(add_bufsize(optarg, SO_RCVBUF) == -1)
+          return -1;
+        break;
+      case 'w':
+        if(add_bufsize(optarg, SO_SNDBUF) == -1)
+          return -1;
+        break;
+      case 'p':
+        conf.busy_poll = strtol(optarg, NULL, 10);
+        if(conf.busy_poll <= 0){
+          fprintf(stderr, "INVALID BUSY POLL BUDGET: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'S':
+        if(add_shape(optarg) == -1)
+          return -1;
+        break;
+      case 'B':
+        conf.bundle = strtol(optarg, NULL, 10);
+        if(conf.bundle <= 0){
+          fprintf(stderr, "INVALID BUNDLE DEADLINE: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'P':
+        conf.hugepages = 1;
+        break;
+      case 'H':
+        if(add_hello(optarg) == -1)
+          return -1;
+        break;
+      case 'k':
+        conf.ckpt_path = optarg;
+        break;
+      default:
+        proper_usage(argc + 1, argc, argv);
+        return -1;
+    }
+  }
+
+  if(!proper_usage(optind + 4, argc, argv))
+    return -1;
+
+  return 0;
+}
+
+/*
+INPUT PARAMETER
+  - arg: hello option, "usec" or "usec,multiplier"
+
+This function stores the hello interval and detection multiplier in the 
+configuration. -1 is returned if 'arg' is not valid.
+*/
+int add_hello(char *arg){
+  char *sep = strchr(arg, ',');
+
+  conf.hello = strtol(arg, NULL, 10);
+  conf.hello_mult = sep != NULL ? strtol(sep + 1, NULL, 10) : HELLO_MULT;
+
+  if(conf.hello <= 0 || conf.hello_mult <= 0 || \
+                          (uint64_t)conf.hello * conf.hello_mult > UINT32_MAX){
+    fprintf(stderr, "INVALID HELLO INTERVAL: %s\n", arg);
+    return -1;
+  }
+
+  return 0;
+}
 
-    if(!proper_usage(6, argc, argv))
+/*
+INPUT PARAMETERS
+  - arg: buffer size option, "bytes" or "ifname=bytes"
+  - optname: SO_RCVBUF or SO_SNDBUF
+
+This function stores a buffer size option in the configuration. -1 is returned
+if 'arg' is not a valid size.
+*/
+int add_bufsize(char *arg, int optname){
+  int i, size;
+  char ifname[IF_NAMESIZE] = { 0 };
+  char *sep = strchr(arg, '=');
+
+  if(sep != NULL){
+    if(sep - arg >= IF_NAMESIZE){
+      fprintf(stderr, "INVALID INTERFACE NAME: %s\n", arg);
       return -1;
-    
-    debug = 1;
+    }
+    memcpy(ifname, arg, sep - arg);
+    arg = sep + 1;
   }
-  else if(!proper_usage(5, argc, argv)){
+
+  size = strtol(arg, NULL, 10);
+  if(size <= 0){
+    fprintf(stderr, "INVALID BUFFER SIZE: %s\n", arg);
     return -1;
   }
 
+  for(i=0; i<conf.num_bufs; i++){
+    if(!strcmp(conf.bufs[i].ifname, ifname))
+      break;
+  }
+
+  if(i == conf.num_bufs){
+    if(conf.num_bufs == MAX_IFS){
+      fprintf(stderr, "TOO MANY BUFFER SIZES\n");
+      return -1;
+    }
+    memset(&conf.bufs[i], 0, sizeof(struct bufsize));
+    memcpy(conf.bufs[i].ifname, ifname, IF_NAMESIZE);
+    conf.num_bufs++;
+  }
+
+  if(optname == SO_RCVBUF)
+    conf.bufs[i].rcvbuf = size;
+  else
+    conf.bufs[i].sndbuf = size;
+
   return 0;
 }
 
+/*
+INPUT PARAMETER
+  - ifname: name of an interface
+
+INPUT-OUTPUT PARAMETERS
+  - rcvbuf: receive buffer size buffer
+  - sndbuf: send buffer size buffer
+
+This function looks up the configured buffer sizes of 'ifname'. Sizes set for
+the interface itself take precedence over the default ones. 0 is stored if no
+size is configured.
+*/
+void get_bufconf(char *ifname, int *rcvbuf, int *sndbuf){
+  int i;
+
+  *rcvbuf = 0;
+  *sndbuf = 0;
+
+  // defaults first
+  for(i=0; i<conf.num_bufs; i++){
+    if(conf.bufs[i].ifname[0] == '\0'){
+      *rcvbuf = conf.bufs[i].rcvbuf;
+      *sndbuf = conf.bufs[i].sndbuf;
+    }
+  }
+
+  for(i=0; i<conf.num_bufs; i++){
+    if(!strcmp(conf.bufs[i].ifname, ifname)){
+      if(conf.bufs[i].rcvbuf)
+        *rcvbuf = conf.bufs[i].rcvbuf;
+      if(conf.bufs[i].sndbuf)
+        *sndbuf = conf.bufs[i].sndbuf;
+    }
+  }
+}
+
 /*
 INPUT-OUTPUT PARAMETER
   - list: linked list of data structs
@@ -63,7 +235,7 @@ void free_data(struct data *list){
   while(list != NULL){
     temp = list;
     list = list->next;
-    free(temp);
+    pkt_put(temp->pkt);
   }
 }
 
@@ -142,7 +314,7 @@ struct ifname *add_ifname(struct ifname *ifnames, char *new_name){
       temp = temp->next;
     }
     temp->next = malloc(sizeof(struct ifname) + strlen(new_name) + 1);
-    memset(temp->next, 0, sizeof(struct ifname) + strlen(new_name+1));
+    memset(temp->next, 0, sizeof(struct ifname) + strlen(new_name) + 1);
     temp = temp->next;
 
     memcpy(temp->name, new_name, strlen(new_name));
@@ -257,6 +429,7 @@ void init_interface(struct interface *ifa, int sockfd, uint8_t mip_dst, \
   ifa->mip_src = mip_src;
   memcpy(ifa->mac_dst, mac_dst, MAC_SIZE);
   memcpy(ifa->mac_src, mac_src, MAC_SIZE);
+  ifa->stale = 0;
   ifa->next = NULL;
 }
 
@@ -308,7 +481,149 @@ void add_interface(struct interface *new, struct interface **list){
 
 /*
 INPUT PARAMETER
+  - list: linked list of the hosts interfaces
+  - sockfd: raw socket file descriptor
+
+This function returns the local interface bound to 'sockfd'. NULL is returned
+if such an interface does not exist in 'list'.
+*/
+struct interface *get_local(struct interface *list, int sockfd){
+  struct interface *temp = list;
+  while(temp != NULL){
+    if(temp->sockfd == sockfd){
+      return temp;
+    }
+    temp = temp->next;
+  }
+
+  return NULL;
+}
+
+/*
+INPUT PARAMETERS
+  - local: local interface the frame arrived on
+  - mip_addr: MIP source address of the frame
+  - mac: MAC source address of the frame
+
+INPUT-OUTPUT PARAMETER
+  - arp_cache: linked list of interfaces of direct neighbors
+
+This function learns the MIP to MAC mapping of a neighbor from the source 
+addresses of any frame it sent. An existing entry for 'mip_addr' is refreshed,
+otherwise a new entry is added to 'arp_cache'. A stale entry from the 
+checkpoint is confirmed, and the entry is written to the checkpoint. 1 is 
+returned if the neighbor is new, 0 if it was already known and -1 if the 
+frame is not from a neighbor.
+*/
+int learn_neighbor(struct interface **arp_cache, struct interface *local, \
+                                              uint8_t mip_addr, uint8_t mac[6]){
+  struct interface *temp;
+
+  // own frame or invalid source?
+  if(local == NULL || mip_addr == 0 || mip_addr == 255 || \
+                                    !memcmp(mac, local->mac_src, MAC_SIZE)){
+    return -1;
+  }
+
+  temp = get_interface(*arp_cache, mip_addr);
+  if(temp != NULL){
+    temp->sockfd = local->sockfd;
+    temp->mip_src = local->mip_src;
+    memcpy(temp->mac_dst, mac, MAC_SIZE);
+    memcpy(temp->mac_src, local->mac_src, MAC_SIZE);
+    temp->stale = 0;
+    save_neighbor(temp);
+
+    return 0;
+  }
+
+  temp = malloc(sizeof(struct interface));
+  init_interface(temp, local->sockfd, mip_addr, local->mip_src, mac, \
+                                                              local->mac_src);
+  add_interface(temp, arp_cache);
+  save_neighbor(temp);
+
+  return 1;
+}
+
+/*
+INPUT PARAMETER
+  - my_interfaces: linked list of the hosts interfaces
+
+This function broadcasts a gratuitous ARP-response (TRA 0, MIP destination 
+255) on every local interface, so neighbors learn the MIP to MAC mapping of
+this host before they have anything to send to it. It is called at startup,
+and neighbors started later are learned from the frames they send. -1 is 
+returned if an error occur.
+*/
+int announce(struct interface *my_interfaces){
+  int retv;
+  char *mip_hdr;
+
+  struct interface *temp = my_interfaces;
+  while(temp != NULL){
+    mip_hdr = create_miphdr(0, 255, temp->mip_src, 0, 15);
+
+    if(debug)
+      print_status(temp->mac_dst, temp->mac_src, 255, temp->mip_src);
+
+    retv = send_frame(temp, mip_hdr, MIP_HDR_SIZE);
+    if(retv == -1){
+      free(mip_hdr);
+      return -1;
+    }
+
+    free(mip_hdr);
+    temp = temp->next;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETER
+  - my_interfaces: linked list of the hosts interfaces
+
+This function attaches a new MIP filter to the raw socket of every interface
+in 'my_interfaces', built from the current set of local MIP addresses. It is 
+to be called whenever the local addresses change. -1 is returned if an error
+occur.
+*/
+int update_filters(struct interface *my_interfaces){
+  int retv;
+  int count = 0;
+  struct interface *temp = my_interfaces;
+
+  while(temp != NULL){
+    count++;
+    temp = temp->next;
+  }
+
+  uint8_t mip_addrs[count];
+
+  count = 0;
+  temp = my_interfaces;
+  while(temp != NULL){
+    mip_addrs[count++] = temp->mip_src;
+    temp = temp->next;
+  }
+
+  temp = my_interfaces;
+  while(temp != NULL){
+    retv = attach_filter(temp->sockfd, mip_addrs, count);
+    if(retv == -1)
+      return -1;
+
+    temp = temp->next;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
   - sockfd: socket file descriptor where the message is received from
+  - size: size of 'data'
 
 INPUT-OUTPUT PARAMETERS
   - mip_addr: MIP address receive buffer
@@ -318,26 +633,27 @@ OUTPUT PARAMETER
   - retv: number of bytes received/error value/connection closed value
 
 This function receives data and a MIP address from 'sockfd' and stores it in
-'mip_addr' and 'data'. The return value if recvmsg is returned.
+'mip_addr' and 'data'. The return value if recvmsg is returned, -1 with errno
+EAGAIN if nothing is waiting.
 */
-int recv_data(int sockfd, uint8_t *mip_addr, char *data){
+int recv_data(int sockfd, uint8_t *mip_addr, char *data, int size){
   int retv;
 
   struct iovec iov[2];
   iov[0].iov_base = mip_addr;
   iov[0].iov_len = sizeof(uint8_t);
   iov[1].iov_base = data;
-  iov[1].iov_len = BUF_SIZE;
+  iov[1].iov_len = size;
 
   struct msghdr msg = { 0 };
   msg.msg_iov = iov;
   msg.msg_iovlen = 2;
 
-  retv = recvmsg(sockfd, &msg, 0);
+  retv = recvmsg(sockfd, &msg, MSG_DONTWAIT);
   if(retv == 0){
     fprintf(stderr, "Connection closed!\n");
   }
-  else if(retv == -1){
+  else if(retv == -1 && errno != EAGAIN){
     perror("recv_data(): recvmsg()");
   }
 
@@ -346,25 +662,30 @@ int recv_data(int sockfd, uint8_t *mip_addr, char *data){
 
 /*
 INPUT PARAMETERS
+  - tra: TRA-bits the datagram is sent with
   - dst: MIP destination address
   - src: MIP source address
   - ttl: Time-to-live
-  - data_size: size of datagram
-  - datagram: data
+  - pkt: packet buffer holding the datagram
 
 INPUT-OUTPUT PARAMETER
   - data_ptr: data struct
 
-This function initialises a data struct.
+This function initialises a data struct for the datagram in 'pkt', which is
+not copied.
 */
-void init_data(struct data *data_ptr, uint8_t dst, uint8_t src, uint8_t ttl, \
-                                            uint16_t data_size, char *datagram){
+void init_data(struct data *data_ptr, uint8_t tra, uint8_t dst, uint8_t src, \
+                                                uint8_t ttl, struct pkt *pkt){
   data_ptr->next = NULL;
+  data_ptr->tra = tra;
   data_ptr->dst = dst;
   data_ptr->src = src;
   data_ptr->ttl = ttl;
-  data_ptr->data_size = data_size;
-  memcpy(data_ptr->datagram, datagram, data_size);
+  data_ptr->follow = 0;
+  data_ptr->data_size = pkt->len;
+  data_ptr->stamp = get_time();
+  data_ptr->pkt = pkt;
+  data_ptr->datagram = pkt_data(pkt);
 }
 
 /*
@@ -433,24 +754,24 @@ void remove_data(uint8_t mip_addr, struct data **list){
         // first and only node of list?
         if(temp->next == NULL){
           *list = NULL;
-          free(temp);
+          pkt_put(temp->pkt);
           break;
         }
 
         *list = temp->next;
-        free(temp);
+        pkt_put(temp->pkt);
         break;
       }
       // last node in list?
       else if(temp->next == NULL){
         prev->next = NULL;
-        free(temp);
+        pkt_put(temp->pkt);
         break;
       }
       // middle node of list?
       else{
         prev->next = temp->next;
-        free(temp);
+        pkt_put(temp->pkt);
         break;
       }
 
@@ -465,6 +786,38 @@ void remove_data(uint8_t mip_addr, struct data **list){
 
 }
 
+/*
+INPUT PARAMETER
+  - mip_addr: MIP destination address
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function throws the first datagram to 'mip_addr' in 'list', and sends 
+its source a congestion notice. The datagrams of a super-segment that were
+queued behind it are handed on to the next datagram to 'mip_addr', so they
+are still sent when the route arrives. The next datagram to 'mip_addr' is 
+returned, or NULL if there is none.
+*/
+struct data *drop_data(uint8_t mip_addr, struct data **list){
+  struct data *dgram = get_data(mip_addr, *list);
+  uint8_t follow;
+
+  if(dgram == NULL)
+    return NULL;
+
+  note_congestion(dgram->tra, dgram->src, dgram->datagram, dgram->data_size, \
+                                                                  CONG_DROP);
+  follow = dgram->follow;
+  remove_data(mip_addr, list);
+
+  dgram = get_data(mip_addr, *list);
+  if(dgram != NULL && follow)
+    dgram->follow = follow - 1;
+
+  return dgram;
+}
+
 /*
 INPUT PARAMETER
   - data_size: size of data
@@ -496,6 +849,20 @@ int size_check(int data_size){
   return -1;
 }
 
+/*
+INPUT PARAMETERS
+  - mip_hdr: MIP header of a received frame
+  - frame_size: size of the frame as received
+
+This function returns 1 if the payload length in 'mip_hdr' is shorter than
+the MIP header, or runs past the end of the frame, else 0.
+*/
+int truncated(struct header *mip_hdr, int frame_size){
+  return mip_hdr->payload < MIP_HDR_SIZE || \
+                  (mip_hdr->payload - MIP_HDR_SIZE) * 4 > frame_size - \
+                                  (int)(sizeof(struct frame) + MIP_HDR_SIZE);
+}
+
 /*
 INPUT PARAMETERS
   - mip_addr: MIP address
@@ -519,48 +886,333 @@ struct data *get_data(uint8_t mip_addr, struct data *list){
   return NULL;
 }
 
+/*
+INPUT PARAMETERS
+  - fwd_fd: forwarding socket
+  - tra: TRA-bits the datagram is sent with
+  - dst: MIP destination address
+  - src: MIP source address, 0 if it is set by the first hop
+  - ttl: Time-to-live, one more than the TTL the datagram is sent with
+  - pkt: packet buffer holding the datagram
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function requests a route for the datagram in 'pkt' and stores it in 
+'list' until the router answers. 'list' takes a reference to 'pkt' instead of
+a copy, so a received datagram waits in the buffer it arrived in. The oldest 
+datagram in 'list' is thrown if there are more than 100 waiting. -1 is 
+returned if an error occur.
+*/
+int queue_pkt(int fwd_fd, struct data **list, uint8_t tra, uint8_t dst, \
+                                      uint8_t src, uint8_t ttl, struct pkt *pkt){
+  int retv;
+  struct data *new = &pkt->dgram;
+
+  DLOG("requesting route from router");
+  retv = request_route(fwd_fd, dst);
+  if(retv == -1)
+    return -1;
+
+  init_data(new, tra, dst, src, ttl, pkt_get(pkt));
+  save_data(new, list);
+
+  if(storage_status(*list) > 100){
+    // remove first node of the list
+    drop_data((*list)->dst, list);
+    stats.queue_drops++;
+  }
+
+  if(debug)
+    print_data(*list);
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - fwd_fd: forwarding socket
+  - tra: TRA-bits the datagram is sent with
+  - dst: MIP destination address
+  - src: MIP source address, 0 if it is set by the first hop
+  - ttl: Time-to-live, one more than the TTL the datagram is sent with
+  - buf: datagram
+  - size: size of datagram
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function copies a datagram into a packet buffer and queues it with
+queue_pkt(). -1 is returned if an error occur.
+*/
+int queue_data(int fwd_fd, struct data **list, uint8_t tra, uint8_t dst, \
+                              uint8_t src, uint8_t ttl, char *buf, int size){
+  int retv;
+  struct pkt *pkt = pkt_alloc();
+
+  if(pkt == NULL)
+    return -1;
+
+  // room for the MIP and Ethernet headers in front
+  memcpy(pkt_data(pkt), buf, size);
+  pkt->len = size;
+
+  retv = queue_pkt(fwd_fd, list, tra, dst, src, ttl, pkt);
+  pkt_put(pkt);
+
+  return retv;
+}
+
+/*
+INPUT PARAMETERS
+  - fwd_fd: forwarding socket
+  - super: super-segment from mip_tp, past its leading 0
+  - size: size of 'super'
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function slices a super-segment from mip_tp into segments, and stores 
+them in 'list' as datagrams with a single route request. The first datagram
+counts the ones following it, so they are all sent when the route arrives.
+A malformed super-segment, or one of more than TP_BATCH segments, is thrown. -1 is returned if an error occur.
+*/
+int queue_super(int fwd_fd, struct data **list, char *super, int size){
+  int retv, chunk, seg_size, offset;
+  uint8_t dst = super[0];
+  uint8_t *tmpl = (uint8_t *)&super[1];
+  uint16_t data_max, data_size;
+  char *seg;
+  struct pkt *pkt;
+  struct data *new, *first = NULL;
+
+  memcpy(&data_max, &super[1 + TP_HDR_SIZE], sizeof(data_max));
+  memcpy(&data_size, &super[3 + TP_HDR_SIZE], sizeof(data_size));
+
+  // the first datagram counts the rest in a uint8_t, and mip_tp never sends
+  // more than TP_BATCH segments in one go
+  if(!dst || !data_max || data_max > TP_DATA_MAX || \
+        5 + TP_HDR_SIZE + data_size > size || \
+        (data_size + data_max - 1) / data_max > TP_BATCH){
+    fprintf(stderr, "MALFORMED SUPER-SEGMENT IS THROWN\n");
+    return 0;
+  }
+
+  DLOG("requesting route from router");
+  retv = request_route(fwd_fd, dst);
+  if(retv == -1)
+    return -1;
+
+  for(offset=0; offset<data_size; offset+=chunk){
+    chunk = data_size - offset < data_max ? data_size - offset : data_max;
+    // padded to a multiple of 4, like mip_tp does
+    seg_size = TP_HDR_SIZE + chunk + (4 - chunk % 4) % 4;
+
+    // each segment is built in a buffer of its own, held by 'list'
+    pkt = pkt_alloc();
+    if(pkt == NULL)
+      return -1;
+
+    seg = pkt_data(pkt);
+    pkt->len = seg_size;
+
+    memset(seg, 0, seg_size);
+    seg[0] = ((4 - chunk % 4) & 3) << 6 | (tmpl[0] & 63);
+    seg[1] = tmpl[1];
+    seg[2] = tmpl[2];
+    seg[3] = tmpl[3] + (first != NULL ? first->follow + 1 : 0);
+    memcpy(&seg[TP_HDR_SIZE], &super[5 + TP_HDR_SIZE + offset], chunk);
+
+    new = &pkt->dgram;
+    init_data(new, 4, dst, 0, MIP_TTL, pkt);
+    save_data(new, list);
+
+    if(first == NULL)
+      first = new;
+    else
+      first->follow++;
+  }
+
+  while(storage_status(*list) > 100){
+    // remove first node of the list
+    drop_data((*list)->dst, list);
+    stats.queue_drops++;
+  }
+
+  if(debug)
+    print_data(*list);
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - fwd_fd: forwarding socket
+  - mip_hdr: MIP header of the received control message
+  - type: CTRL_ECHO_REPLY or CTRL_TIME_EXCEEDED
+  - hop: local MIP address the reply is sent from
+  - ctrl: received control message
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function answers an echo request by sending it back to its source as a
+control message of 'type'. -1 is returned if an error occur.
+*/
+int ctrl_reply(int fwd_fd, struct data **list, struct header *mip_hdr, \
+                                      uint8_t type, uint8_t hop, char *ctrl){
+  struct ctrl_msg msg;
+
+  memcpy(&msg, ctrl, CTRL_SIZE);
+  msg.type = type;
+  msg.hop = hop;
+
+  return queue_data(fwd_fd, list, TRA_CTRL, mip_hdr->src, hop, MIP_TTL, \
+                                                      (char *)&msg, CTRL_SIZE);
+}
+
 /*
 INPUT PARAMETERS
   - dst: MAC destination address
   - src: MAC source address
-  - packet: MIP header + data
-  - packet: size of packet
 
 INPUT-OUTPUT PARAMETER
   - eth_frame: frame struct
 
-This function initialises 'eth_frame'.
+This function initialises the Ethernet header of 'eth_frame'.
 */
-void init_frame(struct frame *eth_frame, uint8_t *dst, uint8_t *src, \
-                                                char *packet, int packet_size){
+void init_frame(struct frame *eth_frame, uint8_t *dst, uint8_t *src){
   memcpy(eth_frame->dst, dst, MAC_SIZE);
   memcpy(eth_frame->src, src, MAC_SIZE);
   eth_frame->protocol = htons(ETH_P_MIP);
-  memcpy(eth_frame->data, packet, packet_size);
 }
 
 /*
-INPUT
+INPUT PARAMETERS
+  - sockfd: raw socket of a local interface
+  - eth_frame: frame to be sent
+  - frame_size: size of 'eth_frame'
+  - tra: TRA-bits of the MIP header in 'eth_frame'
+
+This function sends 'eth_frame' on 'sockfd'. A frame the kernel has no buffer
+for is lost, counted as dropped and noted for a congestion notice. -1 is 
+returned if an error occur.
 */
-int send_frame(struct interface *ifa, char *packet, int packet_size){
+int xmit_frame(int sockfd, struct frame *eth_frame, int frame_size, \
+                                                                uint8_t tra){
   int retv;
-  int frame_size = sizeof(struct frame) + packet_size;
-  struct frame *eth_frame = malloc(frame_size);
-  
-  init_frame(eth_frame, ifa->mac_dst, ifa->mac_src, packet, packet_size);
+  struct timespec sent;
+
+  clock_gettime(CLOCK_REALTIME, &sent);
 
-  retv = send(ifa->sockfd, eth_frame, frame_size, 0);
+  retv = send(sockfd, eth_frame, frame_size, 0);
   if(retv == -1){
-    perror("send_frame(): send()");
-    free(eth_frame);
+    // kernel out of buffers, the frame is lost but the link is still up
+    if(errno == ENOBUFS || errno == EAGAIN){
+      count_tx(sockfd, 1, tra, &sent);
+      note_frame(eth_frame, CONG_DROP);
+      return 0;
+    }
+
+    perror("xmit_frame(): send()");
     return -1;
   }
 
-  free(eth_frame);
+  count_tx(sockfd, 0, tra, &sent);
 
   return 0;
 }
 
+/*
+INPUT PARAMETERS
+  - ifa: interface struct with the source and destination of the frame
+  - pkt: packet buffer holding MIP header + data
+
+This function sends the packet in 'pkt' in a frame to the neighbor in 'ifa',
+or hands it to the shaper of the interface if the frame has to wait. The 
+Ethernet header is written in the headroom of 'pkt', so the packet is not 
+copied. -1 is returned if an error occur.
+*/
+int send_pkt(struct interface *ifa, struct pkt *pkt){
+  uint8_t tra = (uint8_t)pkt_data(pkt)[0] >> 5;
+  struct frame *eth_frame;
+  struct ifstats *ifs = get_ifstats(ifa->sockfd);
+
+  eth_frame = (struct frame *)pkt_push(pkt, sizeof(struct frame));
+  init_frame(eth_frame, ifa->mac_dst, ifa->mac_src);
+
+  // held back or dropped by the shaper?
+  if(ifs != NULL && shape_frame(ifs, pkt, tra))
+    return 0;
+
+  return xmit_frame(ifa->sockfd, eth_frame, pkt->len, tra);
+}
+
+/*
+INPUT PARAMETERS
+  - ifa: interface struct with the source and destination of the frame
+  - packet: MIP header + data
+  - packet_size: size of packet
+
+This function copies 'packet' into a packet buffer and sends it with 
+send_pkt(). -1 is returned if an error occur.
+*/
+int send_frame(struct interface *ifa, char *packet, int packet_size){
+  int retv;
+  struct pkt *pkt = pkt_alloc();
+
+  if(pkt == NULL)
+    return -1;
+
+  memcpy(pkt_data(pkt), packet, packet_size);
+  pkt->len = packet_size;
+
+  retv = send_pkt(ifa, pkt);
+  pkt_put(pkt);
+
+  return retv;
+}
+
+/*
+INPUT PARAMETERS
+  - ifa: interface struct of the next hop
+  - dgram: datagram in 'list' to be sent
+
+INPUT-OUTPUT PARAMETER
+  - list: linked list of data structs
+
+This function sends 'dgram' to the next hop in 'ifa' and removes it from 
+'list'. The MIP header is written in the headroom of its packet buffer, so a
+datagram is sent from the buffer it was received or queued in. -1 is 
+returned if an error occur.
+*/
+int forward_data(struct interface *ifa, struct data *dgram, struct data **list){
+  int retv;
+  char *packet;
+  struct histogram *hist = &stats.forward;
+
+  // missing source address?
+  if(dgram->src == 0){
+    dgram->src = ifa->mip_src;
+    hist = &stats.originate;
+  }
+
+  packet = pkt_push(dgram->pkt, MIP_HDR_SIZE);
+  write_miphdr(packet, dgram->tra, dgram->dst, dgram->src, dgram->data_size, \
+                                                              dgram->ttl - 1);
+
+  DLOG("forwarding datagram");
+  if(debug)
+    print_status(ifa->mac_dst, ifa->mac_src, dgram->dst, dgram->src);
+
+  retv = send_datagram(ifa, dgram->pkt);
+
+  hist_add(hist, get_time() - dgram->stamp);
+  remove_data(dgram->dst, list);
+
+  return retv;
+}
+
 int broadcast(struct interface *my_interfaces, uint8_t mip_addr){
   int retv;
   char *mip_hdr;
@@ -589,31 +1241,54 @@ int broadcast(struct interface *my_interfaces, uint8_t mip_addr){
 Input parameter:
   - sockfd: socket
 
-This function recv a frame from sockfd, stores it in a buffer and returns the 
-buffer.
+This function recv a frame from sockfd straight into a packet buffer and 
+returns the buffer. The frame is counted in the statistics of 'sockfd' 
+together with the drop counter and receive timestamp the kernel attaches to 
+it. The socket is read without blocking: NULL is returned with errno set to 
+EAGAIN if no frame is waiting.
 */
-struct frame *recv_frame(int sockfd){
+struct pkt *recv_frame(int sockfd){
   int retv;
-  struct frame *eth_frame;
+  struct pkt *pkt;
+  char *frame_buf;
   int frame_size = BUF_SIZE + sizeof(struct frame);
-  char frame_buf[frame_size];
+  char cmsg_buf[CMSG_SPACE(sizeof(uint32_t)) + \
+                                  CMSG_SPACE(sizeof(struct scm_timestamping))];
+
+  pkt = pkt_alloc();
+  if(pkt == NULL)
+    return NULL;
 
-  memset(frame_buf, 0, frame_size);
+  frame_buf = pkt_data(pkt);
 
-  retv = recv(sockfd, frame_buf, frame_size, 0);
+  struct iovec iov[1];
+  iov[0].iov_base = frame_buf;
+  iov[0].iov_len = frame_size;
+
+  struct msghdr msg = { 0 };
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg_buf;
+  msg.msg_controllen = sizeof(cmsg_buf);
+
+  retv = recvmsg(sockfd, &msg, MSG_DONTWAIT);
   if(retv == 0){
     DLOG("connection closed!\n");
+    pkt_put(pkt);
     return NULL;
   }
   else if(retv == -1){
-    perror("recv_frame(): recv()");
+    if(errno != EAGAIN)
+      perror("recv_frame(): recvmsg()");
+    pkt_put(pkt);
     return NULL;
   }
 
-  eth_frame = malloc(retv);
-  memcpy(eth_frame, frame_buf, retv);
+  count_rx(sockfd, &msg, (uint8_t)frame_buf[sizeof(struct frame)] >> 5);
+
+  pkt->len = retv;
 
-  return eth_frame;
+  return pkt;
 }
 
 int send_segment(int sockfd, uint8_t mip_addr, char *seg, int seg_size){
@@ -641,14 +1316,16 @@ INPUT PARAMETERS
   - tra: TRA-bits
   - mip_dst: MIP destination address of the msg to be sent
   - mip_src: MIP source address of the msg to be sent
+  - data_size: size of the msg, 0 for a broadcast
   - ttl: Time-To-Live value
 
-This function creates a MIP-header with the passed parameters and returns the
-header.
+OUTPUT PARAMETER
+  - buf: MIP_HDR_SIZE bytes the header is written to
+
+This function writes a MIP-header with the passed parameters to 'buf'.
 */
-char *create_miphdr(uint8_t tra, uint8_t mip_dst, uint16_t mip_src, \
+void write_miphdr(char *buf, uint8_t tra, uint8_t mip_dst, uint8_t mip_src, \
                                                   int data_size, uint8_t ttl){
-  char *buf;
   uint8_t mip_hdr[MIP_HDR_SIZE] = { 0 };
   uint16_t payload = data_size;
 
@@ -666,9 +1343,24 @@ char *create_miphdr(uint8_t tra, uint8_t mip_dst, uint16_t mip_src, \
   mip_hdr[3] = mip_hdr[3] | (payload << 4);
   mip_hdr[3] = mip_hdr[3] | ttl;
 
-
-  buf = malloc(MIP_HDR_SIZE);
   memcpy(buf, mip_hdr, MIP_HDR_SIZE);
+}
+
+/*
+INPUT PARAMETERS
+  - tra: TRA-bits
+  - mip_dst: MIP destination address of the msg to be sent
+  - mip_src: MIP source address of the msg to be sent
+  - ttl: Time-To-Live value
+
+This function creates a MIP-header with the passed parameters and returns the
+header.
+*/
+char *create_miphdr(uint8_t tra, uint8_t mip_dst, uint16_t mip_src, \
+                                                  int data_size, uint8_t ttl){
+  char *buf = malloc(MIP_HDR_SIZE);
+
+  write_miphdr(buf, tra, mip_dst, mip_src, data_size, ttl);
 
   return buf;
 }
@@ -719,11 +1411,13 @@ char *add_miphdr(char *mip_hdr, int hdr_size, char *msg, int msg_size){
 INPUT PARAMETER
   - data: MIP header and a message from a received frame struct
 
-This function extract and decrypt a MIP header som 'data' and stores the 
-information in a header struct. The header struct is then returned.
+OUTPUT PARAMETER
+  - mip_hdr: header struct
+
+This function extract and decrypt a MIP header from 'data' and stores the 
+information in 'mip_hdr'.
 */
-struct header *get_header(char *data){
-  struct header *mip_hdr = malloc(sizeof(struct header));
+void read_header(char *data, struct header *mip_hdr){
   uint8_t buf[MIP_HDR_SIZE] = { 0 };
   memcpy(buf, data, MIP_HDR_SIZE);
 
@@ -741,6 +1435,19 @@ struct header *get_header(char *data){
   mip_hdr->src = src;
   mip_hdr->payload = payload;
   mip_hdr->ttl = ttl;
+}
+
+/*
+INPUT PARAMETER
+  - data: MIP header and a message from a received frame struct
+
+This function extract and decrypt a MIP header som 'data' and stores the 
+information in a header struct. The header struct is then returned.
+*/
+struct header *get_header(char *data){
+  struct header *mip_hdr = malloc(sizeof(struct header));
+
+  read_header(data, mip_hdr);
 
   return mip_hdr;
 }
@@ -792,6 +1499,31 @@ int request_route(int sockfd, uint8_t mip_addr){
   return 0;
 }
 
+/*
+INPUT PARAMETERS
+  - sockfd: forwarding socket
+  - list: linked list of data structs
+
+This function requests a new route for every datagram waiting in 'list'. It is
+called when a new neighbor is learned, since datagrams whose next hop was 
+unresolved are otherwise left waiting in 'list'. -1 is returned if an error 
+occur.
+*/
+int request_pending(int sockfd, struct data *list){
+  int retv;
+  struct data *temp = list;
+
+  while(temp != NULL){
+    retv = request_route(sockfd, temp->dst);
+    if(retv == -1)
+      return -1;
+
+    temp = temp->next;
+  }
+
+  return 0;
+}
+
 /**/
 int recv_route(int sockfd, uint16_t *route){
   int retv;
@@ -0,0 +1,380 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct link links[256];
+
+/*
+INPUT PARAMETER
+  - usec: effective round-trip time of a link in microseconds
+
+This function quantizes 'usec' into a link cost. A link faster than 
+LINK_RTT_BASE costs 1 like a hop always did, and every doubling of the 
+round-trip time above it costs one more, up to LINK_COST_MAX.
+*/
+uint8_t quantize_rtt(uint64_t usec){
+  uint8_t cost = 1;
+
+  while(usec >= LINK_RTT_BASE && cost < LINK_COST_MAX){
+    usec /= 2;
+    cost++;
+  }
+
+  return cost;
+}
+
+/*
+INPUT PARAMETER
+  - link: link to a neighbor
+
+This function returns the cost 'link' should be published with. Loss 
+inflates the round-trip time, since every lost datagram has to be resent. 
+The cost only moves to a new level once the round-trip time is 25% past the
+level boundary, so a link that sits on a boundary does not make the routes 
+flap.
+*/
+uint8_t link_cost(struct link *link){
+  uint64_t eff;
+  uint8_t cost;
+
+  if(link->loss >= LINK_LOSS_MAX)
+    return LINK_COST_MAX;
+
+  eff = link->srtt + link->srtt * link->loss / 250;
+  cost = quantize_rtt(eff);
+
+  // first cost of the link?
+  if(!link->cost)
+    return cost;
+
+  if(cost > link->cost && quantize_rtt(eff * 4 / 5) <= link->cost)
+    return link->cost;
+  if(cost < link->cost && quantize_rtt(eff * 5 / 4) >= link->cost)
+    return link->cost;
+
+  return cost;
+}
+
+/*
+INPUT PARAMETERS
+  - rt_fd: routing socket
+  - type: RT_METRIC, RT_NEIGH_DOWN or RT_NEIGH_UP
+  - mip_addr: MIP address of the neighbor
+  - cost: cost of the link to 'mip_addr', 0 for RT_NEIGH_DOWN
+
+This function sends a message about the link to 'mip_addr' to the router. The
+message has the form | 0 | type | neighbor | cost |, and the leading 0 tells
+it apart from DVR-table updates. The router takes a neighbor that is down as
+'infinity' away, and does not read the cost of RT_NEIGH_DOWN. -1 is returned 
+if an error occur.
+*/
+int send_rtmsg(int rt_fd, uint8_t type, uint8_t mip_addr, uint8_t cost){
+  int retv;
+  uint8_t msg[4];
+
+  msg[0] = 0;
+  msg[1] = type;
+  msg[2] = mip_addr;
+  msg[3] = cost;
+
+  retv = send(rt_fd, msg, sizeof(msg), 0);
+  if(retv == -1){
+    perror("send_rtmsg(): send()");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - rt_fd: routing socket
+  - mip_addr: MIP address of the neighbor
+
+This function publishes the cost of the link to 'mip_addr' to the router if 
+it changed. Nothing is published while the neighbor is down, the cost goes
+with RT_NEIGH_UP when it is heard again. -1 is returned if an error occur.
+*/
+int update_metric(int rt_fd, uint8_t mip_addr){
+  uint8_t cost;
+  struct link *link = &links[mip_addr];
+
+  // too few samples, neighbor down or no router yet?
+  if(link->samples < LINK_SAMPLES || link->down || !rt_fd)
+    return 0;
+
+  cost = link_cost(link);
+  if(cost == link->cost)
+    return 0;
+
+  if(debug)
+    fprintf(stderr, "link to %d: srtt %" PRIu64 " us, loss %" PRIu32 \
+              " permille, cost %d -> %d\n", mip_addr, link->srtt, link->loss, \
+                                                            link->cost, cost);
+
+  if(send_rtmsg(rt_fd, RT_METRIC, mip_addr, cost) == -1)
+    return -1;
+
+  link->cost = cost;
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - rt_fd: routing socket
+  - arp_cache: linked list of neighbors
+
+This function sends a link probe to every neighbor in 'arp_cache'. A probe 
+that is still unanswered when the next one is sent counts as lost. -1 is 
+returned if an error occur.
+*/
+int probe_links(int rt_fd, struct interface *arp_cache){
+  int retv;
+  char *mip_hdr, *packet;
+  struct ctrl_msg probe = { 0 };
+  struct link *link;
+  struct interface *temp = arp_cache;
+
+  while(temp != NULL){
+    link = &links[temp->mip_dst];
+
+    if(link->waiting){
+      link->lost++;
+      link->loss = (link->loss * 7 + 1000) / 8;
+
+      retv = update_metric(rt_fd, temp->mip_dst);
+      if(retv == -1)
+        return -1;
+    }
+
+    probe.type = CTRL_LINK_PROBE;
+    probe.ttl = 1;
+    probe.seq = ++link->seq;
+    probe.hop = temp->mip_src;
+    probe.stamp = get_time();
+
+    mip_hdr = create_miphdr(TRA_CTRL, temp->mip_dst, temp->mip_src, \
+                                                                CTRL_SIZE, 1);
+    packet = add_miphdr(mip_hdr, MIP_HDR_SIZE, (char *)&probe, CTRL_SIZE);
+
+    retv = send_frame(temp, packet, MIP_HDR_SIZE + CTRL_SIZE);
+
+    free(mip_hdr);
+    free(packet);
+
+    if(retv == -1)
+      return -1;
+
+    link->waiting = 1;
+    link->sent++;
+
+    temp = temp->next;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - ifa: neighbor the probe came from
+  - ctrl: received link probe
+
+This function sends a link probe straight back to the neighbor it came from,
+without asking the router. -1 is returned if an error occur.
+*/
+int link_reply(struct interface *ifa, char *ctrl){
+  int retv;
+  char *mip_hdr, *packet;
+  struct ctrl_msg reply;
+
+  memcpy(&reply, ctrl, CTRL_SIZE);
+  reply.type = CTRL_LINK_REPLY;
+  reply.hop = ifa->mip_src;
+
+  mip_hdr = create_miphdr(TRA_CTRL, ifa->mip_dst, ifa->mip_src, CTRL_SIZE, 1);
+  packet = add_miphdr(mip_hdr, MIP_HDR_SIZE, (char *)&reply, CTRL_SIZE);
+
+  retv = send_frame(ifa, packet, MIP_HDR_SIZE + CTRL_SIZE);
+
+  free(mip_hdr);
+  free(packet);
+
+  return retv;
+}
+
+/*
+INPUT PARAMETERS
+  - rt_fd: routing socket
+  - mip_addr: MIP address of the neighbor that answered
+  - ctrl: received link reply
+
+This function adds the round-trip time of a link reply to the smoothed 
+round-trip time and loss of the link (EWMA with a gain of 1/8, as TCP does).
+Replies to earlier probes count as lost and are thrown. -1 is returned if an
+error occur.
+*/
+int link_sample(int rt_fd, uint8_t mip_addr, char *ctrl){
+  uint64_t rtt;
+  struct ctrl_msg reply;
+  struct link *link = &links[mip_addr];
+
+  memcpy(&reply, ctrl, CTRL_SIZE);
+
+  if(!link->waiting || reply.seq != link->seq)
+    return 0;
+
+  rtt = get_time() - reply.stamp;
+
+  if(link->samples == 0)
+    link->srtt = rtt;
+  else
+    link->srtt = (link->srtt * 7 + rtt) / 8;
+
+  link->loss = link->loss * 7 / 8;
+  link->samples++;
+  link->waiting = 0;
+
+  return update_metric(rt_fd, mip_addr);
+}
+
+/*
+INPUT PARAMETER
+  - arp_cache: linked list of neighbors
+
+This function sends a hello to every neighbor in 'arp_cache', telling it to 
+declare this daemon down if no hello arrives within HELLO_MULT intervals (or
+the multiplier given with -H). -1 is returned if an error occur.
+*/
+int send_hellos(struct interface *arp_cache){
+  int retv;
+  char *mip_hdr, *packet;
+  uint32_t detect = conf.hello * conf.hello_mult;
+  struct interface *temp = arp_cache;
+
+  while(temp != NULL){
+    mip_hdr = create_miphdr(TRA_HELLO, temp->mip_dst, temp->mip_src, \
+                                                              HELLO_SIZE, 1);
+    packet = add_miphdr(mip_hdr, MIP_HDR_SIZE, (char *)&detect, HELLO_SIZE);
+
+    retv = send_frame(temp, packet, MIP_HDR_SIZE + HELLO_SIZE);
+
+    free(mip_hdr);
+    free(packet);
+
+    if(retv == -1)
+      return -1;
+
+    temp = temp->next;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - rt_fd: routing socket
+  - mip_addr: MIP address of the neighbor the hello came from
+  - hello: data of the received hello
+
+This function restarts the detection time of the link to 'mip_addr'. A 
+neighbor that was down is reported up to the router, with the cost its link
+had. -1 is returned if an error occur.
+*/
+int link_hello(int rt_fd, uint8_t mip_addr, char *hello){
+  uint32_t detect;
+  struct link *link = &links[mip_addr];
+
+  memcpy(&detect, hello, HELLO_SIZE);
+
+  link->hellos++;
+  link->dead_at = get_time() + detect;
+
+  if(!link->down)
+    return 0;
+
+  link->down = 0;
+
+  if(debug)
+    fprintf(stderr, "neighbor %d is up\n", mip_addr);
+
+  if(!rt_fd)
+    return 0;
+
+  return send_rtmsg(rt_fd, RT_NEIGH_UP, mip_addr, link->cost ? link->cost : 1);
+}
+
+/*
+INPUT PARAMETERS
+  - rt_fd: routing socket
+  - now: current time
+
+This function reports every neighbor whose detection time ran out since its 
+last hello down to the router, which takes the link out of its routes right
+away. -1 is returned if an error occur.
+*/
+int check_hellos(int rt_fd, uint64_t now){
+  int i;
+  struct link *link;
+
+  for(i=0; i<256; i++){
+    link = &links[i];
+
+    if(!link->dead_at || link->dead_at > now)
+      continue;
+
+    link->dead_at = 0;
+    link->down = 1;
+    link->downs++;
+
+    if(debug)
+      fprintf(stderr, "neighbor %d is down\n", i);
+
+    if(rt_fd && send_rtmsg(rt_fd, RT_NEIGH_DOWN, i, 0) == -1)
+      return -1;
+  }
+
+  return 0;
+}
+
+/*
+This function returns when the next neighbor runs out of detection time, 0 if
+no hello is awaited.
+*/
+uint64_t hello_next(void){
+  int i;
+  uint64_t next = 0;
+
+  for(i=0; i<256; i++){
+    if(links[i].dead_at && (!next || links[i].dead_at < next))
+      next = links[i].dead_at;
+  }
+
+  return next;
+}
+
+/*
+INPUT PARAMETER
+  - sockfd: connected stats socket
+
+This function writes the measured links to 'sockfd' as plain text.
+*/
+void write_links(int sockfd){
+  int i;
+  struct link *link;
+
+  dprintf(sockfd, "%-10s%10s%10s%8s%10s%10s%10s%8s\n", "neighbor", \
+          "srtt_us", "loss_pm", "cost", "probes", "lost", "hellos", "downs");
+
+  for(i=0; i<256; i++){
+    link = &links[i];
+
+    if(!link->sent && !link->hellos)
+      continue;
+
+    dprintf(sockfd, "%-10d%10" PRIu64 "%10" PRIu32 "%8d%10" PRIu64 "%10" \
+              PRIu64 "%10" PRIu64 "%8" PRIu64 "%s\n", i, link->srtt, \
+              link->loss, link->cost, link->sent, link->lost, link->hellos, \
+              link->downs, link->down ? " down" : "");
+  }
+}
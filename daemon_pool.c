@@ -0,0 +1,170 @@
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct pool pool;
+
+/*
+This function maps the packet buffers of the pool and links them into its
+free list. With -P they are mapped on huge pages, which falls back to regular
+pages if the kernel has none to spare. -1 is returned if an error occur.
+*/
+int init_pool(void){
+  int i;
+  void *map = MAP_FAILED;
+
+  if(conf.hugepages){
+    pool.size = (POOL_SIZE * sizeof(struct pkt) + HUGEPAGE_SIZE - 1) & \
+                                                        ~(HUGEPAGE_SIZE - 1);
+    map = mmap(NULL, pool.size, PROT_READ | PROT_WRITE, \
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(map == MAP_FAILED)
+      fprintf(stderr, "NO HUGE PAGES, PACKET POOL ON REGULAR PAGES\n");
+    else
+      pool.hugepages = 1;
+  }
+
+  if(map == MAP_FAILED){
+    pool.size = POOL_SIZE * sizeof(struct pkt);
+    map = mmap(NULL, pool.size, PROT_READ | PROT_WRITE, \
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED){
+      perror("init_pool(): mmap()");
+      return -1;
+    }
+  }
+
+  pool.bufs = map;
+  pool.free = NULL;
+
+  // linked backwards, so the first buffers are handed out first
+  for(i=POOL_SIZE-1; i>=0; i--){
+    pool.bufs[i].next = pool.free;
+    pool.free = &pool.bufs[i];
+  }
+
+  return 0;
+}
+
+/*
+This function takes a buffer off the pool, holding one reference and no
+packet yet, with PKT_HEADROOM bytes in front of it. A buffer is allocated on
+the heap if the pool is empty. NULL is returned if an error occur.
+*/
+struct pkt *pkt_alloc(void){
+  struct pkt *pkt = pool.free;
+
+  if(pkt != NULL){
+    pool.free = pkt->next;
+    pool.used++;
+    if(pool.used > pool.used_max)
+      pool.used_max = pool.used;
+  }
+  else{
+    if(posix_memalign((void **)&pkt, CACHE_LINE, sizeof(struct pkt))){
+      perror("pkt_alloc(): posix_memalign()");
+      return NULL;
+    }
+    pool.misses++;
+  }
+
+  pkt->next = NULL;
+  pkt->refs = 1;
+  pkt->head = PKT_HEADROOM;
+  pkt->len = 0;
+  pool.allocs++;
+
+  return pkt;
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+  - pkt: packet buffer
+
+This function takes another reference to 'pkt', and returns it.
+*/
+struct pkt *pkt_get(struct pkt *pkt){
+  pkt->refs++;
+  return pkt;
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+  - pkt: packet buffer
+
+This function lets go of a reference to 'pkt'. The last one returns it to
+the pool, or frees it if it was allocated on the heap.
+*/
+void pkt_put(struct pkt *pkt){
+  if(pkt == NULL || --pkt->refs > 0)
+    return;
+
+  if(pkt >= pool.bufs && pkt < pool.bufs + POOL_SIZE){
+    pkt->next = pool.free;
+    pool.free = pkt;
+    pool.used--;
+  }
+  else{
+    free(pkt);
+  }
+
+}
+
+/*
+INPUT PARAMETER
+  - pkt: packet buffer
+
+This function returns the start of the packet in 'pkt'.
+*/
+char *pkt_data(struct pkt *pkt){
+  return &pkt->buf[pkt->head];
+}
+
+/*
+INPUT PARAMETERS
+  - size: size of the header to be prepended
+
+INPUT-OUTPUT PARAMETER
+  - pkt: packet buffer
+
+This function grows the packet in 'pkt' into its headroom by 'size' bytes,
+and returns the new start of the packet where the header is written.
+*/
+char *pkt_push(struct pkt *pkt, int size){
+  pkt->head -= size;
+  pkt->len += size;
+
+  return pkt_data(pkt);
+}
+
+/*
+INPUT PARAMETERS
+  - size: size of the header to be stripped
+
+INPUT-OUTPUT PARAMETER
+  - pkt: packet buffer
+
+This function strips 'size' bytes off the start of the packet in 'pkt', and
+returns the new start of the packet.
+*/
+char *pkt_pull(struct pkt *pkt, int size){
+  pkt->head += size;
+  pkt->len -= size;
+
+  return pkt_data(pkt);
+}
+
+/*
+INPUT PARAMETER
+  - sockfd: connected stats socket
+
+This function writes the use of the packet buffer pool to 'sockfd'.
+*/
+void write_pool(int sockfd){
+  dprintf(sockfd, "pool: buffers %d of %zu bytes used %d max %d allocs %" \
+                  PRIu64 " misses %" PRIu64 " hugepages %s\n", POOL_SIZE, \
+                  sizeof(struct pkt), pool.used, pool.used_max, pool.allocs, \
+                  pool.misses, pool.hugepages ? "yes" : "no");
+}
@@ -0,0 +1,291 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+/*
+INPUT PARAMETER
+  - arg: shaper option, "kbit,bytes" or "ifname=kbit,bytes"
+
+This function stores a shaper option in the configuration. -1 is returned if
+'arg' is not a valid rate and burst.
+*/
+int add_shape(char *arg){
+  int i, rate, burst;
+  char ifname[IF_NAMESIZE] = { 0 };
+  char *sep = strchr(arg, '=');
+
+  if(sep != NULL){
+    if(sep - arg >= IF_NAMESIZE){
+      fprintf(stderr, "INVALID INTERFACE NAME: %s\n", arg);
+      return -1;
+    }
+    memcpy(ifname, arg, sep - arg);
+    arg = sep + 1;
+  }
+
+  rate = strtol(arg, &sep, 10);
+  burst = 0;
+  if(*sep == ',')
+    burst = strtol(sep + 1, NULL, 10);
+
+  // a burst has to fit at least one full frame
+  if(rate <= 0 || burst < ETH_HDR_SIZE + BUF_SIZE){
+    fprintf(stderr, "INVALID SHAPER: %s (burst must be at least %d)\n", arg, \
+                                                      ETH_HDR_SIZE + BUF_SIZE);
+    return -1;
+  }
+
+  for(i=0; i<conf.num_shapes; i++){
+    if(!strcmp(conf.shapes[i].ifname, ifname))
+      break;
+  }
+
+  if(i == conf.num_shapes){
+    if(conf.num_shapes == MAX_IFS){
+      fprintf(stderr, "TOO MANY SHAPERS\n");
+      return -1;
+    }
+    memcpy(conf.shapes[i].ifname, ifname, IF_NAMESIZE);
+    conf.num_shapes++;
+  }
+
+  conf.shapes[i].rate = rate;
+  conf.shapes[i].burst = burst;
+
+  return 0;
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+  - ifs: statistics of a local interface
+
+This function sets up the shaper of 'ifs' from the configuration. A shaper 
+set for the interface itself takes precedence over the default one. The 
+bucket starts full.
+*/
+void init_shaper(struct ifstats *ifs){
+  int i;
+  struct shaper *sh = &ifs->shaper;
+  struct shapeconf *found = NULL;
+
+  memset(sh, 0, sizeof(struct shaper));
+
+  // defaults first
+  for(i=0; i<conf.num_shapes; i++){
+    if(conf.shapes[i].ifname[0] == '\0')
+      found = &conf.shapes[i];
+  }
+
+  for(i=0; i<conf.num_shapes; i++){
+    if(!strcmp(conf.shapes[i].ifname, ifs->name))
+      found = &conf.shapes[i];
+  }
+
+  if(found == NULL)
+    return;
+
+  sh->rate = (uint64_t)found->rate * 1000 / 8;
+  sh->burst = found->burst;
+  sh->tokens = sh->burst;
+  sh->last = get_time();
+}
+
+/*
+INPUT PARAMETERS
+  - now: current time
+
+INPUT-OUTPUT PARAMETER
+  - sh: shaper
+
+This function adds the tokens earned since the last refill to 'sh'.
+*/
+void refill(struct shaper *sh, uint64_t now){
+  if(now <= sh->last)
+    return;
+
+  // idle long enough to fill the bucket?
+  if(now - sh->last >= 100000000){
+    sh->tokens = sh->burst;
+    sh->last = now;
+    return;
+  }
+
+  sh->tokens += (now - sh->last) * sh->rate / 1000000;
+  if(sh->tokens > sh->burst)
+    sh->tokens = sh->burst;
+
+  // only advance by the time the tokens were earned for, so the remainder is
+  // not lost at low rates
+  if(sh->tokens == sh->burst)
+    sh->last = now;
+  else
+    sh->last += (now - sh->last) * sh->rate / 1000000 * 1000000 / sh->rate;
+}
+
+/*
+INPUT PARAMETERS
+  - pkt: packet buffer holding the frame to be sent
+  - tra: TRA-bits of the MIP header in the frame
+
+INPUT-OUTPUT PARAMETER
+  - ifs: statistics of the interface the frame is sent on
+
+This function passes the frame in 'pkt' through the shaper of 'ifs'. 0 is 
+returned if the frame can be sent right away, and its size is taken from the
+tokens. 1 is returned if the queue of the shaper takes a reference to 'pkt',
+or the frame is dropped because the queue is full.
+*/
+int shape_frame(struct ifstats *ifs, struct pkt *pkt, uint8_t tra){
+  struct shaper *sh = &ifs->shaper;
+  int frame_size = pkt->len;
+
+  if(!sh->rate)
+    return 0;
+
+  refill(sh, get_time());
+
+  // ARP, DVR and hello frames are never held back, or a busy link would be
+  // taken for a dead one
+  if(tra < TRA_CTRL || tra == TRA_HELLO || \
+                          (sh->head == NULL && sh->tokens >= frame_size)){
+    sh->tokens -= frame_size;
+    sh->direct++;
+    return 0;
+  }
+
+  if(sh->qlen == SHAPE_QLEN){
+    sh->drops++;
+    note_frame((struct frame *)pkt_data(pkt), CONG_DROP);
+    return 1;
+  }
+
+  pkt_get(pkt);
+  pkt->next = NULL;
+  pkt->stamp = get_time();
+
+  if(sh->tail == NULL)
+    sh->head = pkt;
+  else
+    sh->tail->next = pkt;
+  sh->tail = pkt;
+
+  sh->qlen++;
+  if(sh->qlen > sh->qmax)
+    sh->qmax = sh->qlen;
+  sh->delayed++;
+
+  return 1;
+}
+
+/*
+INPUT PARAMETER
+  - now: current time
+
+This function sends the frames waiting in the shapers that enough tokens are
+refilled for, in the order they were queued. Frames are taken off the queue 
+through CoDel, and the frames it drops use no tokens. The sources of dropped 
+frames, and of frames sent from a standing queue, are sent congestion 
+notices. -1 is returned if an error occur.
+*/
+int shape_release(uint64_t now){
+  int i, retv;
+  struct shaper *sh;
+  struct pkt *head;
+  struct frame *eth_frame;
+
+  for(i=0; i<num_ifstats; i++){
+    sh = &ifstats[i].shaper;
+
+    if(sh->head == NULL)
+      continue;
+
+    refill(sh, now);
+
+    while(sh->head != NULL && sh->tokens >= sh->head->len){
+      head = sh->head;
+      sh->head = head->next;
+      if(sh->head == NULL)
+        sh->tail = NULL;
+      sh->qlen--;
+
+      eth_frame = (struct frame *)pkt_data(head);
+
+      if(codel_drop(&sh->codel, now - head->stamp, now, sh->qlen + 1)){
+        note_frame(eth_frame, CONG_DROP);
+        pkt_put(head);
+        continue;
+      }
+
+      // standing queue, the sender should slow down before CoDel drops
+      if(sh->codel.first_above)
+        note_frame(eth_frame, CONG_DELAY);
+
+      sh->tokens -= head->len;
+
+      retv = xmit_frame(ifstats[i].sockfd, eth_frame, head->len, \
+                                            (uint8_t)eth_frame->data[0] >> 5);
+      pkt_put(head);
+      if(retv == -1)
+        return -1;
+    }
+
+  }
+
+  return 0;
+}
+
+/*
+This function returns the earliest time a frame waiting in a shaper has 
+enough tokens to be sent, or 0 if no frames are waiting.
+*/
+uint64_t shape_next(void){
+  int i;
+  uint64_t when, next = 0;
+  struct shaper *sh;
+
+  for(i=0; i<num_ifstats; i++){
+    sh = &ifstats[i].shaper;
+
+    if(sh->head == NULL)
+      continue;
+
+    when = sh->last;
+    if(sh->head->len > sh->tokens)
+      when += ((sh->head->len - sh->tokens) * 1000000 + sh->rate - 1) / \
+                                                                      sh->rate;
+
+    if(!next || when < next)
+      next = when;
+  }
+
+  return next;
+}
+
+/*
+INPUT PARAMETER
+  - sockfd: connected stats socket
+
+This function writes the state of the shaped interfaces to 'sockfd' as plain
+text.
+*/
+void write_shapers(int sockfd){
+  int i;
+  struct shaper *sh;
+
+  dprintf(sockfd, "%-10s%10s%10s%10s%8s%8s%12s%12s%10s%10s\n", "shaper", \
+              "kbit", "burst", "tokens", "queue", "max", "direct", "delayed", \
+                                                        "drops", "codel");
+
+  for(i=0; i<num_ifstats; i++){
+    sh = &ifstats[i].shaper;
+
+    if(!sh->rate)
+      continue;
+
+    dprintf(sockfd, "%-10s%10" PRIu64 "%10" PRId64 "%10" PRId64 "%8d%8d%12" \
+              PRIu64 "%12" PRIu64 "%10" PRIu64 "%10" PRIu64 "\n", \
+              ifstats[i].name, sh->rate * 8 / 1000, sh->burst, sh->tokens, \
+              sh->qlen, sh->qmax, sh->direct, sh->delayed, sh->drops, \
+                                                          sh->codel.drops);
+  }
+}
@@ -0,0 +1,467 @@
+#include "debug.h"
+#include "sock.h"
+#include "daemon.h"
+
+struct counters stats;
+struct ifstats ifstats[MAX_IFS];
+int num_ifstats;
+
+/*
+OUTPUT PARAMETER
+  - usec: monotonic time in microseconds
+
+This function returns the current monotonic time in microseconds.
+*/
+uint64_t get_time(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: raw socket of a local interface
+  - name: name of the interface
+
+This function registers a local interface for statistics and returns its
+ifstats struct. NULL is returned if there is no room for more interfaces.
+*/
+struct ifstats *add_ifstats(int sockfd, char *name){
+  struct ifstats *ifs;
+
+  if(num_ifstats == MAX_IFS){
+    fprintf(stderr, "add_ifstats(): too many interfaces\n");
+    return NULL;
+  }
+
+  ifs = &ifstats[num_ifstats++];
+  memset(ifs, 0, sizeof(struct ifstats));
+
+  ifs->sockfd = sockfd;
+  strncpy(ifs->name, name, IF_NAMESIZE - 1);
+  ifs->rcvbuf = get_bufsize(sockfd, SO_RCVBUF);
+  ifs->sndbuf = get_bufsize(sockfd, SO_SNDBUF);
+
+  return ifs;
+}
+
+/*
+INPUT PARAMETER
+  - sockfd: raw socket of a local interface
+
+This function returns the ifstats struct of 'sockfd'. NULL is returned if
+'sockfd' is not a registered interface.
+*/
+struct ifstats *get_ifstats(int sockfd){
+  int i;
+
+  for(i=0; i<num_ifstats; i++){
+    if(ifstats[i].sockfd == sockfd)
+      return &ifstats[i];
+  }
+
+  return NULL;
+}
+
+/*
+INPUT PARAMETERS
+  - end: later point in time
+  - start: earlier point in time
+
+This function returns the time from 'start' to 'end' in microseconds, or 0 if
+'end' is before 'start'.
+*/
+uint64_t ts_diff(struct timespec *end, struct timespec *start){
+  int64_t usec = (int64_t)(end->tv_sec - start->tv_sec) * 1000000 + \
+                                      (end->tv_nsec - start->tv_nsec) / 1000;
+
+  if(usec < 0)
+    return 0;
+
+  return usec;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: raw socket the frame was received on
+  - msg: msghdr of the received frame, including ancillary data
+  - tra: TRA of the received frame
+
+This function counts a received frame and picks up the drop counter the kernel
+attaches to it with SO_RXQ_OVFL. The time from the kernel receive timestamp 
+until now is added to the kernel_rx histogram of 'tra'.
+*/
+void count_rx(int sockfd, struct msghdr *msg, uint8_t tra){
+  struct cmsghdr *cmsg;
+  struct timespec now;
+  struct ifstats *ifs = get_ifstats(sockfd);
+
+  if(ifs == NULL)
+    return;
+
+  ifs->rx_frames++;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  for(cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)){
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL){
+      uint32_t ovfl;
+      memcpy(&ovfl, CMSG_DATA(cmsg), sizeof(ovfl));
+      ifs->rxq_ovfl = ovfl;
+    }
+    else if(cmsg->cmsg_level == SOL_SOCKET && \
+                                      cmsg->cmsg_type == SO_TIMESTAMPING){
+      struct scm_timestamping ts;
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      // ts[0] holds the software timestamp
+      if(ts.ts[0].tv_sec)
+        hist_add(&stats.kernel_rx[tra & 7], ts_diff(&now, &ts.ts[0]));
+    }
+  }
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: raw socket the frame was sent on
+  - dropped: 1 if the kernel refused the frame, else 0
+  - tra: TRA of the frame
+  - sent: time right before the frame was handed to send()
+
+This function counts a frame handed to the kernel for sending, and remembers 
+when it was sent so read_tx_stamps() can match it with its transmit 
+timestamp. The kernel numbers every frame it accepted for timestamping, 
+including the ones its queue discipline later dropped, but not the frames
+send() refused, so those get no key.
+*/
+void count_tx(int sockfd, int dropped, uint8_t tra, struct timespec *sent){
+  struct tx_stamp *tx;
+  struct ifstats *ifs = get_ifstats(sockfd);
+
+  if(ifs == NULL)
+    return;
+
+  if(dropped){
+    ifs->tx_drops++;
+    return;
+  }
+
+  ifs->tx_frames++;
+
+  tx = &ifs->tx_ring[ifs->tx_key % TX_RING];
+  tx->key = ifs->tx_key++;
+  tx->tra = tra & 7;
+  tx->sent = *sent;
+}
+
+/*
+INPUT PARAMETER
+  - sockfd: raw socket of a local interface
+
+This function drains the transmit timestamps from the error queue of 'sockfd'
+and adds the time from send() to the kernel timestamp to the kernel_tx 
+histogram of the frame's TRA. It must be called before reading frames, since
+select() reports a socket as readable when only timestamps are waiting.
+*/
+void read_tx_stamps(int sockfd){
+  int retv;
+  char cmsg_buf[512];
+  struct cmsghdr *cmsg;
+  struct ifstats *ifs = get_ifstats(sockfd);
+
+  if(ifs == NULL)
+    return;
+
+  for(;;){
+    struct scm_timestamping ts;
+    struct sock_extended_err err;
+    int have_ts = 0;
+    int have_err = 0;
+
+    struct msghdr msg = { 0 };
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    retv = recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+    if(retv == -1)
+      break;
+
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; \
+                                            cmsg = CMSG_NXTHDR(&msg, cmsg)){
+      if(cmsg->cmsg_level == SOL_SOCKET && \
+                                          cmsg->cmsg_type == SO_TIMESTAMPING){
+        memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+        have_ts = 1;
+      }
+      else if(cmsg->cmsg_level == SOL_PACKET && \
+                                      cmsg->cmsg_type == PACKET_TX_TIMESTAMP){
+        memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+        have_err = (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING);
+      }
+    }
+
+    if(have_ts && have_err){
+      struct tx_stamp *tx = &ifs->tx_ring[err.ee_data % TX_RING];
+
+      // still in the ring?
+      if(tx->key == err.ee_data)
+        hist_add(&stats.kernel_tx[tx->tra], ts_diff(&ts.ts[0], &tx->sent));
+    }
+  }
+}
+
+/*
+INPUT PARAMETERS
+  - drops: frames dropped by the kernel on receive since the last poll
+  - tx_drops: frames refused by the kernel on send since the last poll
+
+INPUT-OUTPUT PARAMETER
+  - ifs: statistics of a local interface
+
+This function grows the socket buffers of 'ifs' when the kernel dropped
+frames since the last poll. The receive buffer is sized to hold the largest
+burst seen in one poll interval, and at least doubled, up to BUFSIZE_MAX.
+Buffers are never shrunk.
+*/
+void autotune(struct ifstats *ifs, uint32_t drops, uint32_t tx_drops){
+  int want;
+
+  if(drops > 0 && ifs->rcvbuf < BUFSIZE_MAX){
+    want = ifs->burst_max * FRAME_TRUESIZE;
+    if(want < ifs->rcvbuf * 2)
+      want = ifs->rcvbuf * 2;
+    if(want > BUFSIZE_MAX)
+      want = BUFSIZE_MAX;
+
+    // the kernel doubles the requested size for bookkeeping overhead
+    if(tune_rawfd(ifs->sockfd, want / 2, 0) != -1){
+      ifs->rcvbuf = get_bufsize(ifs->sockfd, SO_RCVBUF);
+      ifs->rcvbuf_grown++;
+    }
+  }
+
+  if(tx_drops > 0 && ifs->sndbuf < BUFSIZE_MAX){
+    want = ifs->sndbuf * 2;
+    if(want > BUFSIZE_MAX)
+      want = BUFSIZE_MAX;
+
+    if(tune_rawfd(ifs->sockfd, 0, want / 2) != -1){
+      ifs->sndbuf = get_bufsize(ifs->sockfd, SO_SNDBUF);
+      ifs->sndbuf_grown++;
+    }
+  }
+}
+
+/*
+This function reads PACKET_STATISTICS from every registered interface, adds
+them to the totals and autotunes the socket buffers. It is called once every
+STATS_INTERVAL from the main loop.
+*/
+void poll_stats(void){
+  int i, retv;
+  uint32_t tx_drops;
+  struct tpacket_stats st;
+  struct ifstats *ifs;
+
+  for(i=0; i<num_ifstats; i++){
+    ifs = &ifstats[i];
+
+    memset(&st, 0, sizeof(st));
+    retv = get_packet_stats(ifs->sockfd, &st);
+    if(retv == -1)
+      continue;
+
+    // tp_packets includes the dropped frames
+    ifs->kernel_packets += st.tp_packets;
+    ifs->kernel_drops += st.tp_drops;
+
+    if(st.tp_packets > ifs->burst_max)
+      ifs->burst_max = st.tp_packets;
+
+    tx_drops = ifs->tx_drops - ifs->last_tx_drops;
+    ifs->last_tx_drops = ifs->tx_drops;
+
+    autotune(ifs, st.tp_drops, tx_drops);
+  }
+}
+
+/*
+INPUT PARAMETER
+  - usec: latency in microseconds
+
+This function returns the histogram bucket of 'usec'. Values below 8 usec get
+a bucket each, above that every power of two is split in 4 buckets, which 
+keeps the error of a percentile below 25%.
+*/
+int hist_bucket(uint64_t usec){
+  int exp, index;
+
+  if(usec < 8)
+    return usec;
+
+  exp = 63 - __builtin_clzll(usec);
+  index = 8 + (exp - 3) * 4 + ((usec >> (exp - 2)) & 3);
+
+  if(index >= HIST_BUCKETS)
+    index = HIST_BUCKETS - 1;
+
+  return index;
+}
+
+/*
+INPUT PARAMETER
+  - index: histogram bucket
+
+This function returns the highest latency in microseconds that falls into 
+bucket 'index'.
+*/
+uint64_t hist_limit(int index){
+  int exp;
+
+  if(index < 8)
+    return index;
+
+  exp = (index - 8) / 4 + 3;
+
+  return ((uint64_t)(4 + (index - 8) % 4 + 1) << (exp - 2)) - 1;
+}
+
+/*
+INPUT PARAMETER
+  - usec: latency in microseconds
+
+INPUT-OUTPUT PARAMETER
+  - hist: latency histogram
+
+This function adds a latency sample to 'hist'.
+*/
+void hist_add(struct histogram *hist, uint64_t usec){
+  hist->count++;
+  hist->buckets[hist_bucket(usec)]++;
+
+  if(usec > hist->max)
+    hist->max = usec;
+}
+
+/*
+INPUT PARAMETERS
+  - hist: latency histogram
+  - percent: percentile to look up, 0-100
+
+This function returns the 'percent' percentile of 'hist' in microseconds, as 
+the upper limit of the bucket it falls into. 0 is returned for an empty 
+histogram.
+*/
+uint64_t hist_percentile(struct histogram *hist, double percent){
+  int i;
+  uint64_t seen = 0;
+  uint64_t rank = (hist->count * percent + 99) / 100;
+
+  if(hist->count == 0)
+    return 0;
+  if(rank == 0)
+    rank = 1;
+
+  for(i=0; i<HIST_BUCKETS; i++){
+    seen += hist->buckets[i];
+    if(seen >= rank){
+      if(hist_limit(i) > hist->max)
+        return hist->max;
+      return hist_limit(i);
+    }
+  }
+
+  return hist->max;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: connected stats socket
+  - name: name of the histogram
+  - hist: latency histogram
+
+This function writes the sample count and the p50/p90/p99/max latencies of 
+'hist' to 'sockfd' as one line.
+*/
+void write_hist(int sockfd, char *name, struct histogram *hist){
+  dprintf(sockfd, "%-12s%10" PRIu64 "%10" PRIu64 "%10" PRIu64 "%10" PRIu64 \
+              "%10" PRIu64 "\n", name, hist->count, hist_percentile(hist, 50), \
+              hist_percentile(hist, 90), hist_percentile(hist, 99), hist->max);
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: connected stats socket
+  - data_list: linked list of datagrams waiting for a route
+
+This function writes the daemon statistics to 'sockfd' as plain text. Drops
+in the kernel (kernel_drops, rxq_ovfl, tx_drops) are listed per interface,
+while drops in the daemon itself are listed under the queue. 'budget' counts 
+the loops an interface had more frames waiting than RX_BUDGET in.
+*/
+void write_stats(int sockfd, struct data *data_list){
+  int i;
+  struct ifstats *ifs;
+
+  dprintf(sockfd, "%-10s%10s%10s%12s%12s%12s%10s%8s%12s%10s%10s\n", \
+              "interface", "rcvbuf", "sndbuf", "rx", "kernel_rx", \
+              "kernel_drop", "rxq_ovfl", "burst", "tx", "tx_drop", "budget");
+
+  for(i=0; i<num_ifstats; i++){
+    ifs = &ifstats[i];
+
+    dprintf(sockfd, "%-10s%10d%10d%12" PRIu64 "%12" PRIu64 "%12" PRIu64 \
+              "%10" PRIu32 "%8" PRIu32 "%12" PRIu64 "%10" PRIu64 "%10" PRIu64 \
+              "\n", ifs->name, ifs->rcvbuf, ifs->sndbuf, ifs->rx_frames, \
+              ifs->kernel_packets, ifs->kernel_drops, ifs->rxq_ovfl, \
+              ifs->burst_max, ifs->tx_frames, ifs->tx_drops, ifs->budget_out);
+  }
+
+  dprintf(sockfd, "queue: length %d cap_drops %" PRIu64 " ttl_drops %" \
+                PRIu64 " ttl_replies %" PRIu64 " codel_drops %" PRIu64 \
+                " sweep_drops %" PRIu64 "\n", storage_status(data_list), \
+                stats.queue_drops, stats.ttl_drops, stats.ttl_replies, \
+                stats.codel.drops, stats.sweep.drops);
+  dprintf(sockfd, "congestion: notices_sent %" PRIu64 " notices_received %" \
+                  PRIu64 "\n", stats.notices_sent, stats.notices_recv);
+  dprintf(sockfd, "delivery: segments %" PRIu64 " messages %" PRIu64 "\n", \
+                                        stats.tp_segments, stats.tp_messages);
+  dprintf(sockfd, "budget: %d per source, used up by mip_tp %" PRIu64 "\n", \
+                                              RX_BUDGET, stats.tp_budget_out);
+  dprintf(sockfd, "bundles: sent %" PRIu64 " packets %" PRIu64 " unbundled %" \
+          PRIu64 "\n", stats.bundles_sent, stats.bundled, stats.unbundled);
+  write_pool(sockfd);
+
+  dprintf(sockfd, "\n");
+  write_links(sockfd);
+
+  dprintf(sockfd, "\n");
+  write_shapers(sockfd);
+
+  if(conf.busy_poll)
+    dprintf(sockfd, "\nmode: busy-poll %d usec", conf.busy_poll);
+  else
+    dprintf(sockfd, "\nmode: blocking");
+  dprintf(sockfd, " (spins %" PRIu64 " sleeps %" PRIu64 ")\n", stats.spins, \
+                                                                stats.sleeps);
+
+  dprintf(sockfd, "%-12s%10s%10s%10s%10s%10s\n", "latency", "samples", \
+                                          "p50_us", "p90_us", "p99_us", "max_us");
+  write_hist(sockfd, "forward", &stats.forward);
+  write_hist(sockfd, "originate", &stats.originate);
+  write_hist(sockfd, "deliver", &stats.deliver);
+
+  for(i=0; i<NUM_TRA; i++){
+    char name[16];
+
+    if(stats.kernel_rx[i].count){
+      snprintf(name, sizeof(name), "rx_tra%d", i);
+      write_hist(sockfd, name, &stats.kernel_rx[i]);
+    }
+    if(stats.kernel_tx[i].count){
+      snprintf(name, sizeof(name), "tx_tra%d", i);
+      write_hist(sockfd, name, &stats.kernel_tx[i]);
+    }
+  }
+}
@@ -1,3 +1,4 @@
+#include "sock.h"
 #include "daemon.h"
 
 /*
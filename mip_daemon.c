@@ -3,10 +3,21 @@
 #include "debug.h"
 
 int debug;
+struct config conf;
 
 int main (int argc, char *argv[]){
   int retv, ifcount, num_of_mips, count;
   int tp_listen, fwd_listen, rt_listen;
+  int stats_listen = -1;
+  int echo_listen = -1;
+  int echo_fd = -1;
+  uint64_t now, next_poll, next_probe, next_event, next_shape, next_bundle;
+  uint64_t next_sweep;
+  uint64_t next_hello, next_dead;
+  uint64_t next_stale = 0;
+  uint64_t spin_until;
+  int first_fd = 0;
+  struct timeval tv;
   char *tp_path, *fwd_path, *rt_path;
 
   int fdmax = 0;
@@ -27,6 +38,10 @@ int main (int argc, char *argv[]){
   if(retv == -1)
     exit(EXIT_SUCCESS);
 
+  retv = init_pool();
+  if(retv == -1)
+    exit(EXIT_FAILURE);
+
   tp_path = argv[optind];
   fwd_path = argv[optind+1];
   rt_path = argv[optind+2];
@@ -58,9 +73,20 @@ int main (int argc, char *argv[]){
       uint8_t mac[6] = { 0 };
       uint8_t mac_broadcast[6] = {255, 255, 255, 255, 255, 255};
       uint8_t mip_addr = strtol(argv[count], NULL, 10);
+      int rcvbuf, sndbuf;
+      struct ifstats *ifs;
       int rawfd = init_rawfd(temp->name); //feil i valgrind bind()
       get_mac_addr(rawfd, mac, temp->name);
 
+      get_bufconf(temp->name, &rcvbuf, &sndbuf);
+      tune_rawfd(rawfd, rcvbuf, sndbuf);
+      ifs = add_ifstats(rawfd, temp->name);
+      if(ifs != NULL)
+        init_shaper(ifs);
+
+      if(conf.busy_poll)
+        busy_poll_rawfd(rawfd, conf.busy_poll);
+
       struct interface *new = malloc(sizeof(struct interface));
 
       init_interface(new, rawfd, mip_addr, mip_addr, mac_broadcast, mac);
@@ -76,6 +102,37 @@ int main (int argc, char *argv[]){
 
   free_names(ifnames);
 
+  DLOG("attaching MIP filter to raw sockets");
+  retv = update_filters(my_interfaces);
+  if(retv == -1){
+    close_all(master, fdmax);
+    free_interfaces(my_interfaces);
+    exit(EXIT_FAILURE);
+  }
+
+  // neighbors of the last run are sent to until they are heard from again
+  if(conf.ckpt_path != NULL){
+    retv = init_ckpt(conf.ckpt_path);
+    if(retv == -1){
+      close_all(master, fdmax);
+      free_interfaces(my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    retv = load_neighbors(&arp_cache, my_interfaces);
+    fprintf(stderr, "STALE NEIGHBORS LOADED: %d\n", retv);
+    if(retv)
+      next_stale = get_time() + STALE_TIME;
+  }
+
+  DLOG("announcing local interfaces");
+  retv = announce(my_interfaces);
+  if(retv == -1){
+    close_all(master, fdmax);
+    free_interfaces(my_interfaces);
+    exit(EXIT_FAILURE);
+  }
+
   if(debug){
     fprintf(stderr, "\n-- LOCAL INTERFACE(S)--\n");
     print_list(my_interfaces);
@@ -114,21 +171,163 @@ int main (int argc, char *argv[]){
   FD_SET(rt_listen, &master);
   update_fdmax(rt_listen, &fdmax);
 
+  if(conf.stats_path != NULL){
+    stats_listen = create_statsfd(conf.stats_path);
+    if(stats_listen == -1){
+      close_all(master, fdmax);
+      free_interfaces(my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    FD_SET(stats_listen, &master);
+    update_fdmax(stats_listen, &fdmax);
+  }
+
+  if(conf.echo_path != NULL){
+    echo_listen = create_listenfd(conf.echo_path);
+    if(echo_listen == -1){
+      close_all(master, fdmax);
+      free_interfaces(my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    FD_SET(echo_listen, &master);
+    update_fdmax(echo_listen, &fdmax);
+  }
+
 /* ------------------------------------------------------------------------- */
 
+  next_poll = get_time() + STATS_INTERVAL;
+  next_probe = get_time() + PROBE_INTERVAL;
+  next_hello = get_time() + conf.hello;
+  spin_until = 0;
+
   for(;;){
-    DLOG("looking for activiy in socket set...");
+    now = get_time();
+    if(now >= next_poll){
+      poll_stats();
+      next_poll = now + STATS_INTERVAL;
+    }
+
+    if(now >= next_probe){
+      retv = probe_links(rt_fd, arp_cache);
+      if(retv == -1){
+        clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+        exit(EXIT_FAILURE);
+      }
+
+      next_probe = now + PROBE_INTERVAL;
+    }
+
+    next_event = next_poll < next_probe ? next_poll : next_probe;
+
+    // stale neighbors that have not been heard from are forgotten
+    if(next_stale && now >= next_stale){
+      retv = expire_stale(&arp_cache);
+      if(retv)
+        fprintf(stderr, "STALE NEIGHBORS EXPIRED: %d\n", retv);
+
+      next_stale = 0;
+    }
+
+    if(next_stale && next_stale < next_event)
+      next_event = next_stale;
+
+    // neighbors told we are alive, and the ones gone silent reported down
+    if(conf.hello && now >= next_hello){
+      retv = send_hellos(arp_cache);
+      if(retv == -1){
+        clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+        exit(EXIT_FAILURE);
+      }
+
+      next_hello = now + conf.hello;
+    }
+
+    if(conf.hello && next_hello < next_event)
+      next_event = next_hello;
+
+    retv = check_hellos(rt_fd, now);
+    if(retv == -1){
+      clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    next_dead = hello_next();
+    if(next_dead && next_dead < next_event)
+      next_event = next_dead;
+
+    // frames held back by a shaper released by now?
+    retv = shape_release(now);
+    if(retv == -1){
+      clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    next_shape = shape_next();
+    if(next_shape && next_shape < next_event)
+      next_event = next_shape > now ? next_shape : now;
+
+    // bundles that waited long enough for more packets
+    retv = bundle_release(now);
+    if(retv == -1){
+      clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    next_bundle = bundle_next();
+    if(next_bundle && next_bundle < next_event)
+      next_event = next_bundle > now ? next_bundle : now;
+
+    // datagrams whose route never arrives are thrown by CoDel as well
+    next_sweep = codel_sweep(&data_list, now);
+    if(next_sweep && next_sweep < next_event)
+      next_event = next_sweep > now ? next_sweep : now;
+
+    // sources of dropped and delayed datagrams told to slow down
+    retv = send_notices(fwd_fd, tp_fd, &data_list, my_interfaces);
+    if(retv == -1){
+      clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+      exit(EXIT_FAILURE);
+    }
+
+    // busy poll mode: keep polling without sleeping until the budget since
+    // the last activity is spent
+    if(now < spin_until){
+      tv.tv_sec = 0;
+      tv.tv_usec = 0;
+      stats.spins++;
+    }
+    else{
+      tv.tv_sec = (next_event - now) / 1000000;
+      tv.tv_usec = (next_event - now) % 1000000;
+      stats.sleeps++;
+    }
+
+    if(tv.tv_sec || tv.tv_usec)
+      DLOG("looking for activiy in socket set...");
     readfds = master; //a copy set to keep track of all connections
-    retv = select(fdmax+1, &readfds, NULL, NULL, NULL);
+    retv = select(fdmax+1, &readfds, NULL, NULL, &tv);
     if(retv == -1){
       perror("main(): select()");
       clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
       exit(EXIT_FAILURE);
     }
+    else if(retv == 0){
+      continue;
+    }
     DLOG("found activity!\n");
 
-    int i;
-    for(i=0; i<=fdmax; i++){
+    if(conf.busy_poll)
+      spin_until = get_time() + conf.busy_poll;
+
+    // serving the ready sockets round-robin, from one further each time, so
+    // the socket with the lowest number is not always first
+    int i, k;
+    int nfds = fdmax + 1;
+    for(k=0; k<nfds; k++){
+      i = (first_fd + k) % nfds;
+
       // in fd_set?
       if(FD_ISSET(i, &readfds)){
 
@@ -144,6 +343,16 @@ int main (int argc, char *argv[]){
           FD_SET(tp_fd, &writefds);
           update_fdmax(tp_fd, &fdmax);
         }
+        else if(i == stats_listen){
+          int stats_fd;
+
+          DLOG("writing statistics");
+          stats_fd = init_connection(i, conf.stats_path);
+          if(stats_fd != -1){
+            write_stats(stats_fd, data_list);
+            close(stats_fd);
+          }
+        }
         else if(i == fwd_listen){
           DLOG("connecting forwarding socket...");
           fwd_fd = init_connection(i, fwd_path);
@@ -182,51 +391,110 @@ int main (int argc, char *argv[]){
         else if(i == tp_fd){
           uint8_t mip_addr;
           int data_size = 0;
-          char *data_buf = malloc(BUF_SIZE);
-          memset(data_buf, 0, BUF_SIZE); 
+          int n;
+          char *data_buf = malloc(TP_SUPER_SIZE);
+
+          // mip_tp gets the same budget as an interface
+          for(n=0; n<RX_BUDGET; n++){
+            memset(data_buf, 0, TP_SUPER_SIZE); 
+
+            DLOG("receiving message from application");
+            retv = recv_data(i, &mip_addr, data_buf, TP_SUPER_SIZE);
+            if(retv == -1 && errno == EAGAIN)
+              break;
+
+            // MIP daemon does not shutdown, because it can still be useful as
+            // a router even if communication with the application is cut out.
+            if(retv <= 0){
+              FD_CLR(i, &master);
+              close(i);
+              break;
+            }
 
-          DLOG("receiving message from application");
-          retv = recv_data(i, &mip_addr, data_buf);
-          // MIP daemon does not shutdown, because it can still be useful as a
-          // router even if communication with the application is cut out.
-          if(retv <= 0){
-            FD_CLR(i, &master);
-            close(i);
-          }
+            fprintf(stderr, "Number of bytes received: %d\n", retv);
 
-          fprintf(stderr, "Number of bytes received: %d\n", retv);
+            data_size = retv - sizeof(mip_addr);
 
-          data_size = retv - sizeof(mip_addr);
+            // run of segments to be sliced here?
+            if(!mip_addr){
+              retv = queue_super(fwd_fd, &data_list, data_buf, data_size);
+              if(retv == -1){
+                free(data_buf);
+                clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+                exit(EXIT_FAILURE);
+              }
 
-          if(size_check(data_size) != -1){
-            struct data *new;
+            }
+            else if(size_check(data_size) != -1){
+              retv = queue_data(fwd_fd, &data_list, 4, mip_addr, 0, MIP_TTL, \
+                                                          data_buf, data_size);
+              if(retv == -1){
+                free(data_buf);
+                clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+                exit(EXIT_FAILURE);
+              }
 
-            DLOG("requesting route from router");
-            retv = request_route(fwd_fd, mip_addr);
-            if(retv == -1){
-              free(data_buf);
-              clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
-              exit(EXIT_FAILURE);
             }
 
-            // adding null-byte - invalid pointer when debug-printing
-            new = malloc(sizeof(struct data) + data_size + 1);
-            memset(new, 0, sizeof(struct data) + data_size + 1);
+          }
 
-            init_data(new, mip_addr, 0, 15, data_size, data_buf);
-            save_data(new, &data_list);
+          if(n == RX_BUDGET)
+            stats.tp_budget_out++;
 
-            if(storage_status(data_list) > 100){
-              // remove first node of the list
-              remove_data(data_list->dst, &data_list);
-            }
+          free(data_buf);
+        }
+        else if(i == echo_listen){
+          DLOG("connecting mipping...");
+          // only one mipping at a time
+          if(echo_fd != -1){
+            FD_CLR(echo_fd, &master);
+            close(echo_fd);
+          }
 
-            if(debug)
-              print_data(data_list);
+          echo_fd = init_connection(i, conf.echo_path);
+          if(echo_fd != -1){
+            FD_SET(echo_fd, &master);
+            update_fdmax(echo_fd, &fdmax);
+          }
+
+        }
+        else if(i == echo_fd){
+          uint8_t mip_addr;
+          char ctrl[BUF_SIZE];
+          struct ctrl_msg msg;
 
+          DLOG("receiving echo request from mipping");
+          retv = recv_data(i, &mip_addr, ctrl, BUF_SIZE);
+          if(retv <= 0){
+            FD_CLR(i, &master);
+            close(i);
+            echo_fd = -1;
+            continue;
+          }
+
+          if(retv - (int)sizeof(mip_addr) != CTRL_SIZE)
+            continue;
+
+          memcpy(&msg, ctrl, CTRL_SIZE);
+          if(msg.ttl == 0 || msg.ttl > MIP_TTL)
+            msg.ttl = MIP_TTL;
+
+          // echo request to this host?
+          if(get_interface(my_interfaces, mip_addr) != NULL){
+            msg.type = CTRL_ECHO_REPLY;
+            msg.hop = mip_addr;
+            send_segment(i, mip_addr, (char *)&msg, CTRL_SIZE);
+            continue;
+          }
+
+          // the TTL is decremented when the datagram is sent
+          retv = queue_data(fwd_fd, &data_list, TRA_CTRL, mip_addr, 0, \
+                                          msg.ttl + 1, (char *)&msg, CTRL_SIZE);
+          if(retv == -1){
+            clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+            exit(EXIT_FAILURE);
           }
 
-          free(data_buf);
         }
         else if(i == fwd_fd){
           uint8_t mip_end, mip_next;
@@ -246,44 +514,25 @@ int main (int argc, char *argv[]){
             struct interface *temp = get_interface(arp_cache, mip_next);
 
             if(temp != NULL){
-              struct data *dgram = get_data(mip_end, data_list);
+              struct data *dgram = codel_get(&data_list, mip_end, get_time());
+              // the rest of a super-segment was queued under this request
+              int burst = dgram != NULL ? dgram->follow + 1 : 0;
 
-              // message still in data_list?
-              if(dgram != NULL){
-                char *mip_hdr, *packet;
-                uint16_t packet_size;
-
-                // missing source address?
-                if(dgram->src == 0){
-                  dgram->src = temp->mip_src;
-                }
+              // pushed route without waiting datagram?
+              if(dgram == NULL)
+                DLOG("no datagram waiting for route");
 
-                mip_hdr = create_miphdr(4, dgram->dst, dgram->src, \
-                                              dgram->data_size, dgram->ttl - 1);
-                packet = add_miphdr(mip_hdr, MIP_HDR_SIZE, dgram->datagram, \
-                                                            dgram->data_size);
-                packet_size = MIP_HDR_SIZE + dgram->data_size;
-
-                remove_data(dgram->dst, &data_list);
-
-                DLOG("forwarding datagram");
-                if(debug)
-                  print_status(temp->mac_dst, temp->mac_src, dgram->dst, \
-                                                                  dgram->src);
-
-                retv = send_frame(temp, packet, packet_size);
+              while(dgram != NULL){
+                retv = forward_data(temp, dgram, &data_list);
                 if(retv == -1){
-                  free(mip_hdr);
-                  free(packet);
                   clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
                   exit(EXIT_FAILURE);
                 }
 
-                free(mip_hdr);
-                free(packet);
-              }
-              else{
-                fprintf(stderr, "Datagram not found!\n");
+                if(--burst == 0)
+                  break;
+
+                dgram = codel_get(&data_list, mip_end, get_time());
               }
 
             }
@@ -392,188 +641,322 @@ int main (int argc, char *argv[]){
           free(update);
         }
         else{ // message from neighbor mip
-          struct header *mip_hdr;
+          struct header rx_hdr, *mip_hdr = &rx_hdr;
           struct frame *eth_frame;
+          struct pkt *rx;
           struct interface *temp;
+          uint64_t rx_stamp;
+          int n;
+
+          read_tx_stamps(i);
+
+          // draining a batch of frames, so the segments in it to mip_tp can be
+          // coalesced, but no more than the budget of the interface
+          for(n=0; n<RX_BUDGET || unbundled != NULL; n++){
+            DLOG("receiving frame from neighbor daemon");
+            // packets split off a bundle come first, as frames of their own
+            rx = next_unbundled();
+            if(rx == NULL)
+              rx = recv_frame(i);
+            if(rx == NULL){
+              // batch drained, or only transmit timestamps were waiting?
+              if(errno == EAGAIN)
+                break;
 
-          DLOG("receiving frame from neighbor daemon");
-          eth_frame = recv_frame(i);
-          if(eth_frame == NULL){
-            clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
-            exit(EXIT_FAILURE); 
-          }
-
-          mip_hdr = get_header(eth_frame->data);
-
-          if(debug)
-            print_status(eth_frame->dst, eth_frame->src, mip_hdr->dst, \
-                                                                mip_hdr->src);
+              clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+              exit(EXIT_FAILURE); 
+            }
 
-          temp = get_interface(my_interfaces, mip_hdr->dst);
-          // frame arrived to its destination?
-          if(temp != NULL){
-            // message to application?
-            if(mip_hdr->tra == 4){
-              int data_size = (mip_hdr->payload - MIP_HDR_SIZE) * 4;
-              char *dgram = malloc(data_size);
+            rx_stamp = get_time();
 
-              // copying past MIP header of frame->data to only copy the 
-              // message
-              memcpy(dgram, &eth_frame->data[MIP_HDR_SIZE], data_size);
+            eth_frame = (struct frame *)pkt_data(rx);
+            read_header(eth_frame->data, mip_hdr);
 
-              DLOG("sending segment to MIP-TP daemon");
-              retv = send_segment(tp_fd, mip_hdr->src, dgram, data_size);
-              // MIP daemon does not shutdown, because it can still be useful as a
-              // router even if communication with TP daemon is down.
+            if(debug)
+              print_status(eth_frame->dst, eth_frame->src, mip_hdr->dst, \
+                                                                  mip_hdr->src);
+
+            // ARP and DVR frames tell us where their sender is, while the
+            // source of a datagram or control message can be further away
+            retv = 0;
+            if(mip_hdr->tra < TRA_CTRL)
+              retv = learn_neighbor(&arp_cache, get_local(my_interfaces, i), \
+                                                  mip_hdr->src, eth_frame->src);
+            if(retv == 1 && fwd_fd){
+              DLOG("new neighbor, requesting routes for waiting datagrams");
+              retv = request_pending(fwd_fd, data_list);
               if(retv == -1){
-                FD_CLR(tp_fd, &master);
-                close(tp_fd);
+                pkt_put(rx);
+                clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+                exit(EXIT_FAILURE);
               }
-
-              free(dgram);
             }
-            // broadcast message?
-            else if(mip_hdr->tra == 1){
-              char *arp_hdr;
-              struct interface *new = malloc(sizeof(struct interface));
 
-              init_interface(new, i, mip_hdr->src, mip_hdr->dst, \
-                                                eth_frame->src, temp->mac_src);
-              add_interface(new, &arp_cache);
+            temp = get_interface(my_interfaces, mip_hdr->dst);
+            // frame arrived to its destination?
+            if(temp != NULL){
+              // datagram or control message shorter than its header says?
+              if((mip_hdr->tra == 4 || mip_hdr->tra == TRA_CTRL) && \
+                                                  truncated(mip_hdr, rx->len)){
+                fprintf(stderr, "TRUNCATED DATAGRAM IS THROWN\n");
+              }
+              // message to application?
+              else if(mip_hdr->tra == 4 && tp_fd){
+                int data_size = (mip_hdr->payload - MIP_HDR_SIZE) * 4;
+
+                // copying past MIP header of frame->data to only copy the 
+                // message
+                DLOG("coalescing segment for MIP-TP daemon");
+                retv = coalesce_segment(tp_fd, mip_hdr->src, \
+                        &eth_frame->data[MIP_HDR_SIZE], data_size, rx_stamp);
+                // MIP daemon does not shutdown, because it can still be useful
+                // as a router even if communication with TP daemon is down.
+                if(retv == -1){
+                  FD_CLR(tp_fd, &master);
+                  close(tp_fd);
+                  tp_fd = 0;
+                }
 
-              arp_hdr = create_miphdr(0, new->mip_dst, new->mip_src, 0, 15);
+              }
+              // control message?
+              else if(mip_hdr->tra == TRA_CTRL && \
+                            (mip_hdr->payload - MIP_HDR_SIZE) * 4 == CTRL_SIZE){
+                struct ctrl_msg msg;
+
+                memcpy(&msg, &eth_frame->data[MIP_HDR_SIZE], CTRL_SIZE);
+
+                if(msg.type == CTRL_ECHO_REQUEST){
+                  DLOG("answering echo request");
+                  retv = ctrl_reply(fwd_fd, &data_list, mip_hdr, \
+                                   CTRL_ECHO_REPLY, mip_hdr->dst, (char *)&msg);
+                  if(retv == -1){
+                    pkt_put(rx);
+                    clean_up(master, fdmax, data_list, arp_cache, \
+                                                                my_interfaces);
+                    exit(EXIT_FAILURE);
+                  }
 
-              DLOG("sending arp-response");
-              if(debug)
-                print_status(new->mac_dst, new->mac_src, new->mip_dst, \
-                                                                new->mip_src);
+                }
+                else if(msg.type == CTRL_LINK_PROBE && \
+                                get_interface(arp_cache, mip_hdr->src) != NULL){
+                  DLOG("answering link probe");
+                  retv = link_reply(get_interface(arp_cache, mip_hdr->src), \
+                                                                  (char *)&msg);
+                  if(retv == -1){
+                    pkt_put(rx);
+                    clean_up(master, fdmax, data_list, arp_cache, \
+                                                                my_interfaces);
+                    exit(EXIT_FAILURE);
+                  }
 
-              retv = send_frame(new, arp_hdr, MIP_HDR_SIZE);
-              if(retv == -1){
-                free(arp_hdr);
-                free(mip_hdr);
-                free(eth_frame);
-                clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
-                exit(EXIT_FAILURE);
-              }
+                }
+                else if(msg.type == CTRL_CONGESTION){
+                  if(tp_fd){
+                    DLOG("sending congestion notice to MIP-TP daemon");
+                    retv = deliver_notice(tp_fd, msg.hop, msg.ident, msg.seq, \
+                                                                       msg.ttl);
+                    if(retv == -1){
+                      FD_CLR(tp_fd, &master);
+                      close(tp_fd);
+                      tp_fd = 0;
+                    }
+
+                  }
 
-              free(arp_hdr);
-            }
-            // arp-response?
-            else if(mip_hdr->tra == 0){
-              char *new_hdr, *packet;
-              int packet_size;
-              struct data *dgram;
-              struct interface *new = malloc(sizeof(struct interface));
-
-              init_interface(new, i, mip_hdr->src, mip_hdr->dst, \
-                                              eth_frame->src, temp->mac_src);
-              add_interface(new, &arp_cache);
-
-              dgram = get_data(mip_hdr->src, data_list);
-              while(dgram != NULL){
-                // missing MIP source address?
-                if(dgram->src == 0){
-                  dgram->src = new->mip_src;
                 }
-                
-                new_hdr = create_miphdr(4, dgram->dst, dgram->src, \
-                                              dgram->data_size, dgram->ttl-1);
+                else if(msg.type == CTRL_LINK_REPLY){
+                  retv = link_sample(rt_fd, mip_hdr->src, (char *)&msg);
+                  if(retv == -1){
+                    pkt_put(rx);
+                    clean_up(master, fdmax, data_list, arp_cache, \
+                                                                my_interfaces);
+                    exit(EXIT_FAILURE);
+                  }
 
-                packet = add_miphdr(new_hdr, MIP_HDR_SIZE, dgram->datagram, \
-                                                            dgram->data_size);
-                packet_size = MIP_HDR_SIZE + dgram->data_size;
+                }
+                else if(echo_fd != -1){
+                  DLOG("sending echo reply to mipping");
+                  retv = send_segment(echo_fd, mip_hdr->src, (char *)&msg, \
+                                                                     CTRL_SIZE);
+                  if(retv == -1){
+                    FD_CLR(echo_fd, &master);
+                    close(echo_fd);
+                    echo_fd = -1;
+                  }
+
+                }
 
-                DLOG("forwarding datagram");
-                retv = send_frame(new, packet, packet_size);
+              }
+              // hello from a neighbor?
+              else if(mip_hdr->tra == TRA_HELLO && \
+                          (mip_hdr->payload - MIP_HDR_SIZE) * 4 == HELLO_SIZE){
+                retv = link_hello(rt_fd, mip_hdr->src, \
+                                              &eth_frame->data[MIP_HDR_SIZE]);
                 if(retv == -1){
-                  free(new_hdr);
-                  free(packet);
-                  free(mip_hdr);
-                  free(eth_frame);
+                  pkt_put(rx);
                   clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
                   exit(EXIT_FAILURE);
                 }
 
-                free(new_hdr);
-                free(packet);
-                remove_data(mip_hdr->src, &data_list);
-
-                dgram = get_data(mip_hdr->src, data_list);
               }
+              // bundle from a neighbor?
+              else if(mip_hdr->tra == TRA_BUNDLE){
+                DLOG("unbundling");
+                unbundle(eth_frame, rx->len, mip_hdr);
+              }
+              // broadcast message from a known neighbor?
+              else if(mip_hdr->tra == 1 && \
+                                get_interface(arp_cache, mip_hdr->src) != NULL){
+                char *arp_hdr;
+                struct interface *new = get_interface(arp_cache, mip_hdr->src);
 
-            }
+                arp_hdr = create_miphdr(0, new->mip_dst, new->mip_src, 0, 15);
 
-          }
-          else{
-            // DVR table update?
-            if(mip_hdr->dst == 255){
-              // copying past MIP header of frame->data to only copy the 
-              // message
-              int update_size = (mip_hdr->payload - MIP_HDR_SIZE) * 4;
-              char *update = malloc(update_size);
+                DLOG("sending arp-response");
+                if(debug)
+                  print_status(new->mac_dst, new->mac_src, new->mip_dst, \
+                                                                  new->mip_src);
+
+                retv = send_frame(new, arp_hdr, MIP_HDR_SIZE);
+                if(retv == -1){
+                  free(arp_hdr);
+                  pkt_put(rx);
+                  clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+                  exit(EXIT_FAILURE);
+                }
 
-              memcpy(update, &eth_frame->data[MIP_HDR_SIZE], update_size);
+                free(arp_hdr);
+              }
+              // arp-response from a known neighbor?
+              else if(mip_hdr->tra == 0 && \
+                                get_interface(arp_cache, mip_hdr->src) != NULL){
+                struct data *dgram;
+                struct interface *new = get_interface(arp_cache, mip_hdr->src);
+
+                dgram = codel_get(&data_list, mip_hdr->src, get_time());
+                while(dgram != NULL){
+                  retv = forward_data(new, dgram, &data_list);
+                  if(retv == -1){
+                    pkt_put(rx);
+                    clean_up(master, fdmax, data_list, arp_cache, \
+                                                                my_interfaces);
+                    exit(EXIT_FAILURE);
+                  }
+
+                  dgram = codel_get(&data_list, mip_hdr->src, get_time());
+                }
 
-              DLOG("sending DVR-table update to router");
-              retv = send(rt_fd, update, update_size, 0);
-              if(retv == -1){
-                perror("main(): send()");
-                free(update);
               }
 
-              free(update);
             }
-            // datagram to be forwarded?
-            else if(mip_hdr->tra == 4){
-              char *dgram;
-              int data_size;
-              struct data *new;
-
-              DLOG("requesting route from router");
-              retv = request_route(fwd_fd, mip_hdr->dst);
-              if(retv == -1){
-                free(mip_hdr);
-                free(eth_frame);
-                clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
-                exit(EXIT_FAILURE);
+            else{
+              // gratuitous ARP-response?
+              if(mip_hdr->dst == 255 && mip_hdr->tra == 0){
+                DLOG("neighbor announced itself");
               }
+              // DVR table update?
+              else if(mip_hdr->dst == 255 && mip_hdr->tra == 2){
+                // copying past MIP header of frame->data to only copy the 
+                // message
+                int update_size = (mip_hdr->payload - MIP_HDR_SIZE) * 4;
+                char *update = malloc(update_size);
+
+                memcpy(update, &eth_frame->data[MIP_HDR_SIZE], update_size);
+
+                // router not connected yet, e.g. after a warm restart?
+                if(rt_fd){
+                  DLOG("sending DVR-table update to router");
+                  retv = send(rt_fd, update, update_size, 0);
+                  if(retv == -1)
+                    perror("main(): send()");
+                }
 
-              data_size = (mip_hdr->payload - MIP_HDR_SIZE) * 4;
-              dgram = malloc(data_size);
+                free(update);
+              }
+              // TTL running out on a datagram or control message in transit?
+              else if((mip_hdr->tra == 4 || mip_hdr->tra == TRA_CTRL) && \
+                                                             mip_hdr->ttl <= 1){
+                struct ctrl_msg msg;
 
-              memcpy(dgram, &eth_frame->data[MIP_HDR_SIZE], data_size);
+                msg.type = 0;
 
-              new = malloc(sizeof(struct data) + data_size + 1);
-              memset(new, 0, sizeof(struct data) + data_size + 1);
+                // probe to be answered from this hop?
+                if(mip_hdr->tra == TRA_CTRL && \
+                          (mip_hdr->payload - MIP_HDR_SIZE) * 4 == CTRL_SIZE)
+                  memcpy(&msg, &eth_frame->data[MIP_HDR_SIZE], CTRL_SIZE);
 
-              init_data(new, mip_hdr->dst, mip_hdr->src, mip_hdr->ttl, \
-                                                            data_size, dgram);
-              save_data(new, &data_list);
-              
-              if(storage_status(data_list) > 100)
-                // remove first node of the list
-                remove_data(data_list->dst, &data_list);
+                // a probe doing its job is not a lost datagram
+                if(msg.type != CTRL_ECHO_REQUEST){
+                  stats.ttl_drops++;
+                }
+                else{
+                  DLOG("TTL exceeded, answering probe");
+                  stats.ttl_replies++;
+
+                  retv = ctrl_reply(fwd_fd, &data_list, mip_hdr, \
+                                          CTRL_TIME_EXCEEDED, \
+                                         get_local(my_interfaces, i)->mip_src, \
+                                          (char *)&msg);
+                  if(retv == -1){
+                    pkt_put(rx);
+                    clean_up(master, fdmax, data_list, arp_cache, \
+                                                                 my_interfaces);
+                    exit(EXIT_FAILURE);
+                  }
 
-              if(debug)
-                print_data(data_list);
+                }
+
+              }
+              // datagram or control message shorter than its header says?
+              else if((mip_hdr->tra == 4 || mip_hdr->tra == TRA_CTRL) && \
+                                                  truncated(mip_hdr, rx->len)){
+                fprintf(stderr, "TRUNCATED DATAGRAM IS THROWN\n");
+              }
+              // datagram or control message to be forwarded?
+              else if(mip_hdr->tra == 4 || mip_hdr->tra == TRA_CTRL){
+                int data_size = (mip_hdr->payload - MIP_HDR_SIZE) * 4;
+
+                // queued in the buffer it arrived in, the headers are
+                // rewritten in place when it is sent
+                pkt_pull(rx, sizeof(struct frame) + MIP_HDR_SIZE);
+                rx->len = data_size;
+
+                retv = queue_pkt(fwd_fd, &data_list, mip_hdr->tra, \
+                                  mip_hdr->dst, mip_hdr->src, mip_hdr->ttl, rx);
+                if(retv == -1){
+                  pkt_put(rx);
+                  clean_up(master, fdmax, data_list, arp_cache, my_interfaces);
+                  exit(EXIT_FAILURE);
+                }
+
+              }
 
-              free(dgram);
             }
 
-          }
+            if(debug)
+              print_list(arp_cache);
 
-          if(debug)
-            print_list(arp_cache);
+            pkt_put(rx);
+          }
 
-          free(mip_hdr);
-          free(eth_frame);
+          if(n >= RX_BUDGET && get_ifstats(i) != NULL)
+            get_ifstats(i)->budget_out++;
         }
 
       }
 
     }
 
+    first_fd = (first_fd + 1) % nfds;
+
+    // segments coalesced from this batch handed to mip_tp
+    retv = flush_segments(tp_fd);
+    if(retv == -1){
+      FD_CLR(tp_fd, &master);
+      close(tp_fd);
+      tp_fd = 0;
+    }
+
   }
 
   return 0;
@@ -115,8 +115,8 @@ int main(int argc, char *argv[]){
 			}
 			else if(fd == mipfd){
 				int seg_size;
-				uint8_t mip_src, pl;
-				char *segment = malloc(FRAG_SIZE + TP_SIZE);
+				uint8_t mip_src;
+				char *segment = malloc(BATCH_SIZE);
 
 				DLOG("receiving segment from MIP daemon");
 				retv = recv_segment(fd, &mip_src, segment);
@@ -126,99 +126,16 @@ int main(int argc, char *argv[]){
 				}
 
 				if(retv > 0){
-					memcpy(&pl, segment, sizeof(pl));
-					pl = pl >> 6;
 					seg_size = retv - sizeof(mip_src);
 
-					// ack?
-					if(seg_size == TP_SIZE && pl == 1){
-						DLOG("ack received!");
-						int index;
-						header_t *hdr = malloc(sizeof(header_t));
-						init_header(segment, hdr);
-						
-						if(debug){
-							fprintf(stderr, "\n");
-							print_hdr(hdr);
-							fprintf(stderr, "\n");
-						}
-
-						index = find_port(hdr->port, fd_list, FDMAX);
-						if(index != -1){
-							if(in_window(hdr, fd_list[index]->s_win)){
-
-								DLOG("updating window");
-								retv = update_sender(mipfd, fd_list[index], timeout);
-								if(retv == -1){
-									running = 0;
-								}
-								else if(retv == 1){
-									// file completely sent
-									cleanup_fdctx(fd_list[index]);
-								}
-
-							}
-
-						}
-
-						free(hdr);
-					}
-					// fragment?
-					else if(seg_size > TP_SIZE){
-						header_t *hdr = malloc(sizeof(header_t));
-						init_header(segment, hdr);
-						
-						if(debug)
-							print_hdr(hdr);
-
-						retv = receiver_check(mip_src, hdr);
-						if(retv == -1){
-							fprintf(stderr, "No applications listening on port!\n");
-						}
-						else if(!retv){
-							char *ack;
-							int index = find_port(hdr->port, fd_list, FDMAX);
-							fdcontext_t *temp = fd_list[index];
-
-							// pl == 1
-							ack = create_tphdr(TP_SIZE+3, hdr->port, hdr->seqnum);
-
-							DLOG("resending ack");
-							retv = send_segment(mipfd, temp->mip_addr, ack, TP_SIZE);
-							if(retv == -1)
-								running = 0;
-
-							free(ack);
-						}
-						else{
-							char *ack;
-							int index = find_port(hdr->port, fd_list, FDMAX);
-							fdcontext_t *temp = fd_list[index];
-
-							DLOG("saving fragment");
-							save_fragment(temp->r_win, hdr, segment, seg_size);
-
-							DLOG("updating receiver");
-							retv = update_receiver(temp->r_win, hdr->seqnum);
-							if(retv){
-								fprintf(stderr, "Received all fragments!\n");
-								// send fragments to server
-							}
-
-							// pl == 1
-							ack = create_tphdr(TP_SIZE+3, hdr->port, hdr->seqnum);
-
-							DLOG("sending ack");
-							retv = send_segment(mipfd, temp->mip_addr, ack, TP_SIZE);
-							if(retv == -1)
-								running = 0;
-
-							free(ack);
-						}
-
-						free(hdr);
-					}
+					// segments coalesced by the daemon?
+					if(!mip_src)
+						retv = handle_batch(mipfd, segment, seg_size, timeout);
+					else
+						retv = handle_segment(mipfd, mip_src, segment, seg_size, timeout);
 
+					if(retv == -1)
+						running = 0;
 				}
 
 				free(segment);
@@ -0,0 +1,110 @@
+#include "app.h"
+#include "debug.h"
+#include "sock.h"
+
+int debug;
+
+int main(int argc, char *argv[]){
+  int retv, sockfd, ttl, i, received, reached;
+  int count = 5;
+  int interval = 1000;
+  int trace = 0;
+  uint8_t mip_dst, hop;
+  uint16_t ident, seq;
+  char *sockpath;
+  double *rtts;
+  struct ctrl_msg reply;
+
+  retv = handle_ping_args(argc, argv, &count, &interval, &trace);
+  if(retv == -1)
+    exit(EXIT_SUCCESS);
+
+  sockpath = argv[optind];
+  mip_dst = strtol(argv[optind+1], NULL, 10);
+
+  sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if(sockfd == -1){
+    perror("main(): socket()");
+    exit(EXIT_FAILURE);
+  }
+
+  DLOG("connecting to MIP daemon");
+  retv = connect_socket(sockfd, sockpath);
+  if(retv == -1){
+    close(sockfd);
+    exit(EXIT_FAILURE);
+  }
+
+  rtts = malloc(count * sizeof(double));
+  ident = getpid();
+  seq = 0;
+
+  // without tracing, only the destination is probed with the full TTL
+  ttl = trace ? 1 : 15;
+
+  printf("MIPPING %d, %d echo request(s) per %s\n", mip_dst, count, \
+                                              trace ? "hop" : "destination");
+  printf("%-5s%-6s%8s%8s%10s%10s%10s%10s%10s\n", "hop", "addr", "sent", \
+                          "lost", "min", "p50", "p90", "p99", "max (ms)");
+
+  for(; ttl <= 15; ttl++){
+    received = 0;
+    reached = 0;
+    hop = 0;
+
+    for(i=0; i<count; i++){
+      DLOG("sending echo request");
+      retv = send_probe(sockfd, mip_dst, ttl, ident, seq);
+      if(retv == -1){
+        free(rtts);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+      }
+
+      retv = recv_probe(sockfd, ident, seq, &reply);
+      if(retv == -1){
+        free(rtts);
+        close(sockfd);
+        exit(EXIT_FAILURE);
+      }
+      else if(retv == 1){
+        rtts[received++] = (get_nsec() - reply.stamp) / 1000000.0;
+        hop = reply.hop;
+
+        if(reply.type == CTRL_ECHO_REPLY)
+          reached = 1;
+
+        if(debug)
+          fprintf(stderr, "reply from %d: seq=%d type=%d time=%.3f ms\n", \
+                          reply.hop, reply.seq, reply.type, rtts[received-1]);
+      }
+
+      seq++;
+      if(i < count - 1)
+        usleep(interval * 1000);
+    }
+
+    if(trace)
+      printf("%-5d", ttl);
+    else
+      printf("%-5s", "-");
+
+    if(received)
+      printf("%-6d%8d%8d", hop, count, count - received);
+    else
+      printf("%-6s%8d%8d", "*", count, count - received);
+
+    print_rtts(rtts, received);
+    printf("\n");
+    fflush(stdout);
+
+    // destination reached?
+    if(reached || !trace)
+      break;
+  }
+
+  free(rtts);
+  close(sockfd);
+
+  return EXIT_SUCCESS;
+}
@@ -6,47 +6,277 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/select.h>
-#include <signal.h>
-#include <sys/wait.h>
 #include <sys/time.h>
+#include <time.h>
 
 #define MIP_HDR_SIZE 4
 #define BUF_SIZE 1500
+#define RT_METRIC 1 // routing socket message with the cost of a link
+#define RT_NEIGH_DOWN 2 // routing socket message of a neighbor gone silent
+#define RT_NEIGH_UP 3 // routing socket message of a neighbor heard again
 
+#define RT_VALID 1 // the entry holds a route
+#define RT_CHANGED 2 // installed or changed since last pushed to the MIP daemon
+#define RT_DIRTY 4 // changed or removed since last advertised to the neighbors
+#define RT_HOLDDOWN 8 // removed, and only a route as cheap as before is taken
+#define RT_STALE 16 // loaded from the checkpoint and not yet confirmed
+
+#define LINK_COST_MAX 8 // highest link cost the MIP daemon publishes
+#define MAX_HOPS 15 // hops a route can have with every link at LINK_COST_MAX
+#define INFINITY_DEFAULT (LINK_COST_MAX * MAX_HOPS + 1) // see -i
+#define HOLDDOWN_TIME 1000000 // usec a removed route is held down
+
+#define CKPT_MAGIC 0x52545231 // "RTR1", start of a route checkpoint file
+#define STALE_TIME 3000000 // usec a stale route is used before it is removed
+
+#define LS_MAX 32 // addresses or links in a link-state advertisement
+#define LSA_SIZE_MAX (5 + 3 * LS_MAX) // bytes of the largest advertisement
+#define LS_MSG_MAX 1392 // bytes of a flooded message, fits a frame with the MIP header
+#define LSA_MAXAGE (3 * REFRESH_INTERVAL) // sec an advertisement lives
+
+#define TRIGGER_DELAY 50000 // usec changes are gathered before an update
+#define TRIGGER_JITTER 100000 // usec of random delay added to TRIGGER_DELAY
+#define TRIGGER_MIN 250000 // usec between triggered updates
+#define REFRESH_INTERVAL 30 // sec between full updates
+#define REFRESH_JITTER 5 // sec a full update can come early or late
+#define NEIGHBOR_TIMEOUT (3 * REFRESH_INTERVAL) // sec without an update
+
+#define LOG_SIZE 256 // route changes kept in the event log
+#define CONVERGE_QUIET 2000000 // usec without a route change that ends a burst
+
+#define CAUSE_UPDATE 0 // update or advertisements from the neighbor
+// 1 to 3 are RT_METRIC, RT_NEIGH_DOWN and RT_NEIGH_UP of the MIP daemon
+#define CAUSE_TIMEOUT 4 // dead timer of the neighbor expired
+#define CAUSE_HOLDDOWN 5 // hold-down of the route expired
+#define CAUSE_ORIGINATE 6 // own link-state advertisement reoriginated
+#define CAUSE_AGE 7 // advertisement of the router with the ID aged out
+#define CAUSE_STALE 8 // routes loaded from the checkpoint expired
+
+#define CHANGE_INSTALL 0 // route to an unreachable destination
+#define CHANGE_WITHDRAW 1 // route removed
+#define CHANGE_NEXT 2 // route moved to another next hop
+
+#define TIMER_REFRESH 0 // full update
+#define TIMER_TRIGGER 1 // triggered update
+#define TIMER_NEIGHBOR 2 // dead timer of the neighbor with the MIP address
+#define TIMER_HOLDDOWN 3 // hold-down of the route to the MIP address
+#define TIMER_LSA 4 // age of the advertisement of the router with the ID
+#define TIMER_STALE 5 // end of the routes loaded from the checkpoint
+#define TIMER_KINDS 6
+#define TIMER_IDS (TIMER_KINDS * 256)
+#define TIMER_ID(kind, mip_addr) ((kind) * 256 + (mip_addr))
+
+/*
+Route to the destination a route struct is indexed by. Local addresses have
+cost 0 and no next hop. 'mip_alt' is a loop-free alternate next hop the route
+moves to if 'mip_next' is lost, 0 if there is none. A removed route is held
+down with the cost it had in 'hold_cost'.
+*/
 struct route{
-	uint8_t mip_end;
 	uint8_t cost;
 	uint8_t mip_next;
-	struct route *next;
+	uint8_t mip_alt;
+	uint8_t flags;
+	uint8_t hold_cost;
+	time_t updated; // when the route was installed or last changed
 };
 
-int proper_usage(int arg_req, int argc, char *argv[]);
+struct timer{
+	uint64_t when; // usec on CLOCK_MONOTONIC, see get_time()
+	int id; // TIMER_ID() of its kind and MIP address
+};
 
-int handle_argv(int argc, char *argv[]);
+/*
+Timers of the router in a heap ordered by expiry, with the earliest one 
+armed in the timerfd 'fd'. 'pos' is the index of each timer in 'heap', -1 if
+it is not set, and 'armed' the expiry 'fd' is armed for, 0 if none.
+*/
+struct timers{
+	int fd;
+	int len;
+	uint64_t armed;
+	struct timer heap[TIMER_IDS];
+	int pos[TIMER_IDS];
+};
 
-void sighandler(int signum);
+/*
+DVR table, indexed by MIP destination address so a lookup is a single read 
+and an update is applied in one pass over its entries. 'count' is the number
+of valid routes. A triggered update of the dirty routes is sent when 
+TIMER_TRIGGER expires, and it carries every route if a new neighbor is 
+waiting for the table ('full_pending'). 'dist' holds the distance each 
+neighbor in 'nbrs' last advertised to each destination, 'infinity' if none,
+from which the loop-free alternates are picked together with 'locals'.
+*/
+struct router{
+	int count;
+	struct route routes[256];
+	int nbr_count;
+	uint8_t nbrs[256];
+	uint8_t heard[256]; // 1 if the neighbor has a row in 'dist'
+	uint8_t dist[256][256];
+	int local_count;
+	uint8_t locals[256]; // local addresses, the routes without a next hop
+	struct timers timers;
+	uint64_t last_trigger;
+	int full_pending;
+};
+
+/*
+Link-state advertisement of the router with ID 'origin', the lowest of its 
+MIP addresses. It lists the addresses of the router, and the cost of its link
+to each neighbor address. An advertisement with a newer 'seq' replaces it.
 
-void free_routes(struct route *list);
+Advertisement structure: | origin | seq | naddrs | addrs | nlinks | links |
+'seq' is two bytes, most significant first, and each link is | addr | cost |.
+*/
+struct lsa{
+	uint8_t origin;
+	uint16_t seq;
+	uint8_t naddrs, nlinks;
+	uint8_t addrs[LS_MAX];
+	uint8_t link_addr[LS_MAX];
+	uint8_t link_cost[LS_MAX];
+};
+
+/*
+Link-state database of the router with ID 'self', indexed by router ID. 
+'owner' maps each MIP address to the ID of the router that has it, 0 if it is
+unknown. 'dist', 'parent' and 'first' are the shortest path tree from 'self':
+the distance to each router, the router before it on the path, and the 
+neighbor address the path leaves this router through.
+*/
+struct lsdb{
+	uint8_t self;
+	uint16_t seq;
+	uint8_t valid[256];
+	struct lsa lsas[256];
+	uint8_t owner[256];
+	int dist[256];
+	uint8_t parent[256];
+	uint8_t first[256];
+	uint64_t spf_full, spf_incremental;
+};
+
+/*
+Routes encoded once for the updates to every neighbor, with the next hop of 
+each route for split horizon.
+*/
+struct advert{
+	int count;
+	uint8_t dst[256];
+	uint8_t cost[256];
+	uint8_t next[256];
+};
+
+/*
+Change of a route, logged with the event that caused it. 'seq' is the number
+of the update from 'neighbor' that caused it, counted from 1, or 0 if it was
+not an update.
+*/
+struct route_event{
+	uint64_t when; // usec on CLOCK_MONOTONIC, see get_time()
+	uint32_t seq;
+	uint8_t mip_end;
+	uint8_t change;
+	uint8_t cause;
+	uint8_t neighbor;
+	uint8_t old_next, old_cost;
+	uint8_t new_next, new_cost;
+};
+
+struct nbr_stats{
+	uint64_t rx_updates, rx_bytes;
+	uint64_t tx_updates, tx_bytes;
+	uint64_t last_rx;
+};
+
+/*
+Statistics of the router. 'valid', 'next' and 'cost' are the routes as last
+logged, that the DVR table is compared with to find the changes. A change 
+more than CONVERGE_QUIET after the one before starts a new burst, and the 
+last burst measures how long the last convergence took.
+*/
+struct rtstats{
+	uint64_t start;
+	uint8_t valid[256], next[256], cost[256];
+	uint32_t flaps[256]; // changes of the route after it was first installed
+	uint64_t changed[256]; // when the route last changed, 0 if never
+	struct nbr_stats nbrs[256]; // 255 for broadcasts
+	int log_len, log_next;
+	struct route_event log[LOG_SIZE];
+	uint64_t burst_start, burst_end;
+	uint32_t burst_changes;
+};
+
+/*
+Checkpoint of the routes through a neighbor, in a file mapped by 'router -k'.
+It is written after every event, so a restarted router can forward along 
+the routes it had right away. The checkpoint is thrown if its 'size' or 
+'infinity' do not match the router.
+*/
+struct rt_ckpt{
+	uint32_t magic;
+	uint32_t size;
+	uint8_t infinity;
+	uint8_t valid[256];
+	uint8_t cost[256];
+	uint8_t next[256];
+};
+
+extern int infinity;
+extern int link_state;
+extern char *stats_path;
+extern char *ckpt_path;
+extern struct rtstats rstats;
+extern struct rt_ckpt *ckpt;
+
+int proper_usage(int arg_req, int argc, char *argv[]);
+
+int handle_argv(int argc, char *argv[]);
 
 void close_all(fd_set *master, int fdmax);
 
 int new_socket(char *sockpath);
 
+int new_listen(char *sockpath);
+
 int new_fdmax(int sockfd, int fdmax);
 
-struct route *add_route(struct route *list, struct route *new);
+void add_route(struct router *rt, uint8_t mip_end, uint8_t cost, \
+																												uint8_t mip_next);
+
+void remove_route(struct router *rt, uint8_t mip_end);
+
+int dist_to_self(struct router *rt, uint8_t n);
+
+void find_alternate(struct router *rt, uint8_t *links, uint8_t mip_end);
+
+int find_best(struct router *rt, uint8_t *links, uint8_t mip_end);
+
+void lose_route(struct router *rt, uint8_t *links, uint8_t mip_end);
+
+int end_holddown(struct router *rt, uint8_t *links, uint8_t mip_end);
+
+void print_route(struct router *rt);
 
-struct route *remove_route(struct route *list, uint8_t mip_addr);
+uint64_t get_time(void);
 
-void print_route(struct route *list);
+void schedule_update(struct router *rt);
 
-int get_length(struct route *list, int mip_addr);
+void request_tables(struct router *rt);
 
-char *create_update(struct route *list, int mip_addr, int *update_size);
+void encode_routes(struct router *rt, struct advert *adv, int full);
+
+char *create_update(struct advert *adv, int mip_addr, int *update_size);
+
+int send_updates(int sockfd, struct router *rt, uint8_t *neighbors, int len, \
+																																int full);
 
 void print_update(char *update, int update_size);
 
@@ -54,16 +284,104 @@ int send_update(int sockfd, char *update, int update_size);
 
 char *recv_update(int sockfd, int *update_size);
 
-struct route *update_table(struct route *table, char *update, int update_size);
+int ls_message(char *update, int update_size);
+
+int update_table(struct router *rt, uint8_t *links, char *update, \
+																											int update_size);
+
+int set_link(struct router *rt, uint8_t *links, uint8_t neighbor, uint8_t cost);
+
+int add_neighbor(struct router *rt, uint8_t *neighbors, int len, \
+																							uint8_t mip_addr, int refresh);
+
+void forget_neighbor(struct router *rt, uint8_t *neighbors, int len, \
+																														uint8_t mip_addr);
+
+int drop_neighbor(struct router *rt, uint8_t *links, uint8_t *neighbors, \
+																										int len, uint8_t mip_addr);
 
 int recv_request(int sockfd, uint8_t *buf);
 
-uint16_t get_next(struct route *list, uint8_t mip_req);
+uint16_t get_next(struct router *rt, uint8_t mip_req);
 
 int send_next(int sockfd, uint16_t next);
 
-int timeout(time_t tv_sec);
+int push_routes(int sockfd, struct router *rt);
+
+/* TIMER FUNCTIONS */
+
+int init_timers(struct timers *t);
+
+void heap_swap(struct timers *t, int i, int j);
+
+void heap_fix(struct timers *t, int i);
+
+void timer_set(struct timers *t, int id, uint64_t when);
+
+void timer_cancel(struct timers *t, int id);
+
+int timer_pending(struct timers *t, int id);
+
+int timer_pop(struct timers *t, uint64_t now);
+
+int timer_arm(struct timers *t);
+
+/* STATISTICS FUNCTIONS */
+
+void init_stats(struct router *rt);
+
+void count_rx(uint8_t neighbor, int size);
+
+void count_tx(uint8_t neighbor, int size);
+
+int log_routes(struct router *rt, uint8_t cause, uint8_t neighbor);
+
+void write_stats(int sockfd, struct router *rt);
+
+/* CHECKPOINT FUNCTIONS */
+
+int init_ckpt(char *path);
+
+int load_routes(struct router *rt);
+
+void save_routes(struct router *rt);
+
+int expire_stale(struct router *rt, uint8_t *links);
+
+/* LINK-STATE FUNCTIONS */
+
+void ls_init(struct lsdb *db, char *local, int count);
+
+int edge_cost(struct lsdb *db, uint8_t from, uint8_t to);
+
+void relax(struct lsdb *db, uint8_t u, uint8_t *queue, int *len);
+
+void spf(struct lsdb *db);
+
+void spf_decrease(struct lsdb *db, uint8_t from);
+
+int ls_install(struct lsdb *db, struct lsa *lsa);
+
+int ls_routes(struct lsdb *db, struct router *rt);
+
+int encode_lsa(struct lsa *lsa, uint8_t *buf);
+
+int decode_lsa(uint8_t *buf, int size, struct lsa *lsa);
+
+int flood_lsas(int sockfd, struct lsdb *db, uint8_t *origins, int count, \
+																									uint8_t mip_addr);
+
+int ls_originate(int sockfd, struct lsdb *db, struct router *rt, \
+												uint8_t *links, uint8_t *neighbors, int len);
+
+int ls_recv(int sockfd, struct lsdb *db, struct router *rt, uint8_t *neighbors,\
+															int len, char *msg, int msg_size);
+
+int ls_sync(int sockfd, struct lsdb *db, uint8_t mip_addr);
+
+int ls_link(struct router *rt, uint8_t *links, uint8_t *neighbors, int len, \
+												uint8_t type, uint8_t neighbor, uint8_t cost);
 
-char *create_poison(struct route *table, uint8_t mip_addr, int *size);
+int ls_expire(struct lsdb *db, struct router *rt, uint8_t origin);
 
 #endif
\ No newline at end of file
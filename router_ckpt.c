@@ -0,0 +1,166 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "router.h"
+#include "debug.h"
+
+struct rt_ckpt *ckpt;
+
+/*
+INPUT PARAMETER
+	- path: path of the checkpoint file
+
+This function maps the checkpoint file at 'path', and creates it if it does
+not exist. A checkpoint of another size or infinity is cleared. -1 is
+returned if an error occur.
+*/
+int init_ckpt(char *path){
+	int fd;
+	void *map;
+	struct stat st;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if(fd == -1){
+		perror("init_ckpt(): open()");
+		return -1;
+	}
+
+	if(fstat(fd, &st) == -1 || (st.st_size != sizeof(struct rt_ckpt) && \
+													ftruncate(fd, sizeof(struct rt_ckpt)) == -1)){
+		perror("init_ckpt(): ftruncate()");
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, sizeof(struct rt_ckpt), PROT_READ | PROT_WRITE, MAP_SHARED, \
+																																fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		perror("init_ckpt(): mmap()");
+		return -1;
+	}
+
+	ckpt = map;
+
+	if(ckpt->magic != CKPT_MAGIC || ckpt->size != sizeof(struct rt_ckpt) || \
+																							ckpt->infinity != infinity){
+		memset(ckpt, 0, sizeof(struct rt_ckpt));
+		ckpt->magic = CKPT_MAGIC;
+		ckpt->size = sizeof(struct rt_ckpt);
+		ckpt->infinity = infinity;
+	}
+
+	return 0;
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table with the local routes
+
+This function installs the routes of the checkpoint in 'rt' as stale routes.
+They are used for forwarding right away, but are not advertised until their
+next hop confirms them, and the ones not confirmed are removed when
+TIMER_STALE expires. A destination that is now a local address is skipped.
+The number of routes installed is returned.
+*/
+int load_routes(struct router *rt){
+	int i;
+	int count = 0;
+
+	if(ckpt == NULL)
+		return 0;
+
+	for(i=1; i<255; i++){
+
+		if(!ckpt->valid[i] || !ckpt->next[i] || ckpt->cost[i] >= infinity || \
+																			(rt->routes[i].flags & RT_VALID))
+			continue;
+
+		add_route(rt, i, ckpt->cost[i], ckpt->next[i]);
+		rt->routes[i].flags = RT_VALID | RT_CHANGED | RT_STALE;
+		count++;
+	}
+
+	if(count)
+		timer_set(&rt->timers, TIMER_ID(TIMER_STALE, 0), get_time() + STALE_TIME);
+
+	return count;
+}
+
+/*
+INPUT PARAMETER
+	- rt: DVR table
+
+This function writes the routes through a neighbor in 'rt' to the checkpoint,
+if there is one.
+*/
+void save_routes(struct router *rt){
+	int i;
+	struct route *r;
+
+	if(ckpt == NULL)
+		return;
+
+	for(i=0; i<255; i++){
+		r = &rt->routes[i];
+
+		ckpt->valid[i] = (r->flags & RT_VALID) && r->mip_next;
+		ckpt->cost[i] = r->cost;
+		ckpt->next[i] = r->mip_next;
+	}
+
+}
+
+/*
+INPUT PARAMETER
+	- links: cost of the link to each neighbor, indexed by MIP address
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function removes the stale routes no neighbor confirmed since they were
+loaded. They were never advertised, so they are removed without telling the
+neighbors or holding them down, and the cheapest route another neighbor
+advertised since the restart is installed in their place. The number of
+routes removed is returned.
+*/
+int expire_stale(struct router *rt, uint8_t *links){
+	int i, j, cost, best;
+	int count = 0;
+	uint8_t n, next;
+	struct route *r;
+
+	for(i=0; i<255; i++){
+		r = &rt->routes[i];
+
+		if(!(r->flags & RT_STALE))
+			continue;
+
+		rt->count--;
+		r->cost = infinity;
+		r->mip_alt = 0;
+		r->flags = 0;
+		r->updated = time(NULL);
+		count++;
+
+		best = infinity;
+		next = 0;
+		for(j=0; j<rt->nbr_count; j++){
+			n = rt->nbrs[j];
+
+			cost = rt->dist[n][i] + links[n];
+			if(cost < best){
+				best = cost;
+				next = n;
+			}
+		}
+
+		if(next){
+			add_route(rt, i, best, next);
+			find_alternate(rt, links, i);
+		}
+	}
+
+	return count;
+}
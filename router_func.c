@@ -1,6 +1,11 @@
 #include "router.h"
 #include "debug.h"
 
+int infinity = INFINITY_DEFAULT;
+int link_state;
+char *stats_path;
+char *ckpt_path;
+
 /*
 INPUT PARAMETERS
   - arg_req: number of arguments requested to run the program
@@ -12,8 +17,8 @@ given is not equal to the number of arguments required and returns 0.
 */
 int proper_usage(int arg_req, int argc, char *argv[]){
   if(argc != arg_req){
-    fprintf(stderr, "USAGE: %s [-d] <Forwarding_socket> <Routing_socket> \n", \
-                              																				argv[0]);
+    fprintf(stderr, "USAGE: %s [-d] [-l] [-i <Infinity>] [-s <Stats_socket>]" \
+                    " [-k <Checkpoint>] <Forwarding_socket> <Routing_socket> \n", argv[0]);
     return 0;
   }
 
@@ -28,54 +33,61 @@ INPUT PARAMETERS
 OUTPUT PARAMETER
   - optind: index of the next argv argument for a subsequent call of getopt()
   - debug: debug-print boolean 0/1
+  - infinity: cost of an unreachable destination
+  - link_state: link-state routing boolean 0/1
+  - stats_path: path of the stats socket, NULL if none
+  - ckpt_path: path of the checkpoint file, NULL if none
 
 This function handles option flags in the cmd-line and makes sure that the user
 starts the program correctly.
+  -d: activates debug mode
+  -l: link-state routing instead of distance vector. Every router in the 
+      network must use the same.
+  -i: cost of an unreachable destination, INFINITY_DEFAULT if not given. 
+      Every router in the network must use the same.
+  -s: path of a stats socket. Every connection to it is sent the statistics 
+      and the route change log of the router, see write_stats().
+  -k: path of a checkpoint file the routes are kept in, and loaded from when
+      the router is restarted, see load_routes().
 */
 int handle_argv(int argc, char *argv[]){
-  opterr = 0; //to make getopt not print error message
-  int retv = getopt(argc, argv, "d");
-  if(retv == 'd'){
+  int retv;
 
-    if(!proper_usage(4, argc, argv))
-      return -1;
-    
-    debug = 1;
+  opterr = 0; //to make getopt not print error message
+  while((retv = getopt(argc, argv, "dli:s:k:")) != -1){
+    switch(retv){
+      case 'd':
+        debug = 1;
+        break;
+      case 'l':
+        link_state = 1;
+        break;
+      case 'i':
+        infinity = strtol(optarg, NULL, 10);
+        // costs of up to LINK_COST_MAX on top must fit in a byte
+        if(infinity < 2 || infinity > 240){
+          fprintf(stderr, "INVALID INFINITY: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 's':
+        stats_path = optarg;
+        break;
+      case 'k':
+        ckpt_path = optarg;
+        break;
+      default:
+        proper_usage(argc + 1, argc, argv);
+        return -1;
+    }
   }
-  else if(!proper_usage(3, argc, argv)){
+
+  if(!proper_usage(optind + 2, argc, argv))
     return -1;
-  }
 
   return 0;
 }
 
-/*
-INPUT PARAMETER
-	- signum: signal that were caught
-
-This fuction prints out 'signum' and exits.
-*/
-void sighandler(int signum){
-	fprintf(stderr, "Caught signal: %d\n", signum);
-	exit(EXIT_FAILURE);
-}
-
-/*
-OUTPUT PARAMETERS
-	- list: linked list of route structs
-
-This function frees every allocated node in 'list'.
-*/
-void free_routes(struct route *list){
-	struct route *temp = list;
-
-	while(list != NULL){
-		temp = list;
-		list = list->next;
-		free(temp);
-	}
-}
-
 /*
 INPUT PARAMETERS
   - master: file descriptor set
@@ -125,6 +137,46 @@ int new_socket(char *sockpath){
 	return sockfd;
 }
 
+/*
+INPUT PARAMETER
+	- sockpath: path of the socket to be made
+
+OUTPUT PARAMETER
+	- sockfd: new listening unix socket
+
+This function creates a new unix stream socket bound to sockpath and listening
+for connections before returning sockfd. -1 is returned if an error occur.
+*/
+int new_listen(char *sockpath){
+	int retv;
+	struct sockaddr_un my_addr = { 0 };
+
+	int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sockfd == -1){
+		perror("new_listen(): socket()");
+		return -1;
+	}
+
+	my_addr.sun_family = AF_UNIX;
+	memcpy(my_addr.sun_path, sockpath, strlen(sockpath));
+
+	retv = bind(sockfd, (struct sockaddr *)&my_addr, sizeof(my_addr));
+	if(retv == -1){
+		perror("new_listen(): bind()");
+		close(sockfd);
+		return -1;
+	}
+
+	retv = listen(sockfd, 5);
+	if(retv == -1){
+		perror("new_listen(): listen()");
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
 /*
 INPUT PARAMETER
   - sockfd: file descriptor number
@@ -143,83 +195,261 @@ int new_fdmax(int sockfd, int fdmax){
 
 /*
 INPUT PARAMETERS
-	- list: linkes list of route structs
-	- new: new route struct to be added to list
+	- mip_end: MIP destination address of the route
+	- cost: cost of the route
+	- mip_next: next hop of the route, 0 for a local address
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
 
-This function adds the route struct 'new' to 'list' and returns the new list.
+This function installs a route to 'mip_end' in 'rt', replacing any route it
+had. The route is marked to be pushed to the MIP daemon and advertised.
 */
-struct route *add_route(struct route *list, struct route *new){
-	struct route *temp = list;
+void add_route(struct router *rt, uint8_t mip_end, uint8_t cost, \
+																												uint8_t mip_next){
+	struct route *r = &rt->routes[mip_end];
 
-	if(temp != NULL){
-		while(temp->next != NULL){
-			temp = temp->next;
-		}
-		temp->next = new;
+	// new local address?
+	if(!mip_next && !((r->flags & RT_VALID) && !r->mip_next))
+		rt->locals[rt->local_count++] = mip_end;
+
+	if(!(r->flags & RT_VALID))
+		rt->count++;
+
+	r->cost = cost;
+	r->mip_next = mip_next;
+	r->flags = RT_VALID | RT_CHANGED | RT_DIRTY;
+	r->updated = time(NULL);
+}
+
+/*
+INPUT PARAMETER
+	- mip_end: MIP destination address of the route that will be removed
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function removes the route to 'mip_end' from 'rt', if there is one. The
+entry keeps its next hop and is advertised with cost 'infinity' in the next 
+update. A route through a neighbor is held down for HOLDDOWN_TIME, so the 
+stale routes still going around the loops in the network are not taken up.
+*/
+void remove_route(struct router *rt, uint8_t mip_end){
+	struct route *r = &rt->routes[mip_end];
+
+	if(!(r->flags & RT_VALID))
+		return;
+
+	rt->count--;
+
+	r->hold_cost = r->cost;
+	r->cost = infinity;
+	r->mip_alt = 0;
+	r->flags = RT_DIRTY;
+	r->updated = time(NULL);
+
+	if(r->mip_next){
+		r->flags |= RT_HOLDDOWN;
+		timer_set(&rt->timers, TIMER_ID(TIMER_HOLDDOWN, mip_end), \
+																								get_time() + HOLDDOWN_TIME);
+	}
+
+}
+
+/*
+INPUT PARAMETERS
+	- rt: DVR table
+	- n: MIP address of a neighbor
+
+This function returns the distance from 'n' to this router, Distance_opt(N, S)
+of RFC 5286, as the cheapest route 'n' advertised to a local address. A local
+address 'n' reaches over its link to this router is advertised with cost 
+'infinity' (poison reverse), and the cost of that link as 'n' sees it is not
+known here. 1, the least a link costs, is taken for it instead, so the 
+distance is never more than the real one.
+*/
+int dist_to_self(struct router *rt, uint8_t n){
+	int i, cost;
+	int best = infinity;
+
+	for(i=0; i<rt->local_count; i++){
+		cost = rt->dist[n][rt->locals[i]];
+		if(cost >= infinity)
+			cost = 1;
 
-		return list;
+		if(cost < best)
+			best = cost;
 	}
 
-	return new;
+	return best;
 }
 
 /*
 INPUT PARAMETERS
-	- list: linked list of route structs
-	- mip_addr: MIP address of the route that will be removed from list
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- mip_end: MIP destination address of the route
 
-This function removes a node from 'list' with the same 'mip_next' address as 
-'mip_addr'. 'list' is returned after removing a node or iteration of 'list' is
-complete.
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function picks the loop-free alternate of the route to 'mip_end': the 
+cheapest neighbor N other than the next hop that meets the loop-free 
+condition of RFC 5286, with this router as S and 'mip_end' as D:
+
+	Distance_opt(N, D) < Distance_opt(N, S) + Distance_opt(S, D)
+
+Distance_opt(N, D) is what N advertised, and Distance_opt(S, D) is the cost 
+of the route. Distance_opt(N, S) is the cheapest route N advertised to a 
+local address, see dist_to_self(). Such a neighbor does not route through 
+this router, so the route can move to it without waiting for the other 
+routers to converge.
 */
-struct route *remove_route(struct route *list, uint8_t mip_addr){
-	struct route *temp = list;
-	struct route *prev = NULL;
-
-	if(temp != NULL){
-		while(temp->next != NULL){
-			if(temp->mip_end == mip_addr){
-				// first node of the list?
-				if(temp->mip_end == list->mip_end){
-					list = list->next;
-					free(temp);
-
-					return list;
-				}
-				prev->next = temp->next;
-				free(temp);
+void find_alternate(struct router *rt, uint8_t *links, uint8_t mip_end){
+	int i, cost;
+	int best = infinity;
+	uint8_t n;
+	struct route *r = &rt->routes[mip_end];
 
-				return list;
-			}
-			prev = temp;
-			temp = temp->next; 
+	r->mip_alt = 0;
+
+	if(!(r->flags & RT_VALID) || !r->mip_next)
+		return;
+
+	for(i=0; i<rt->nbr_count; i++){
+		n = rt->nbrs[i];
+
+		// next hop, or could its path loop back through this router?
+		if(n == r->mip_next || \
+						rt->dist[n][mip_end] >= dist_to_self(rt, n) + r->cost)
+			continue;
+
+		cost = rt->dist[n][mip_end] + links[n];
+		if(cost < best){
+			best = cost;
+			r->mip_alt = n;
 		}
+	}
 
-		// last node of the list
-		if(temp->mip_end == mip_addr){
-			// last and only node of the list?
-			if(temp->mip_end == list->mip_end){
-				free(list);
-				return NULL;
-			}
-			prev->next = NULL;
-			free(temp);
+}
+
+/*
+INPUT PARAMETERS
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- mip_end: MIP destination address of a route that got dearer
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function moves the route to 'mip_end' to the neighbor with the cheapest
+route the neighbors advertised, if it is cheaper than the route through the 
+next hop. Without it a dearer route is kept until the next full update of 
+the cheaper neighbor. 1 is returned if the route moved, else 0.
+*/
+int find_best(struct router *rt, uint8_t *links, uint8_t mip_end){
+	int i, cost;
+	struct route *r = &rt->routes[mip_end];
+	int best = r->cost;
+	uint8_t n, next = 0;
+
+	if(!(r->flags & RT_VALID) || !r->mip_next)
+		return 0;
+
+	for(i=0; i<rt->nbr_count; i++){
+		n = rt->nbrs[i];
+
+		cost = rt->dist[n][mip_end] + links[n];
+		if(n != r->mip_next && cost < best){
+			best = cost;
+			next = n;
+		}
+	}
+
+	if(!next)
+		return 0;
+
+	add_route(rt, mip_end, best, next);
+
+	return 1;
+}
+
+/*
+INPUT PARAMETERS
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- mip_end: MIP destination address of the route that lost its next hop
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function moves the route to 'mip_end' to its loop-free alternate, marked
+to be pushed to the MIP daemon, or removes it if it has none.
+*/
+void lose_route(struct router *rt, uint8_t *links, uint8_t mip_end){
+	struct route *r = &rt->routes[mip_end];
+	uint8_t alt = r->mip_alt;
+
+	if(!alt || rt->dist[alt][mip_end] + links[alt] >= infinity){
+		remove_route(rt, mip_end);
+		return;
+	}
 
-			return list;
+	r->cost = rt->dist[alt][mip_end] + links[alt];
+	r->mip_next = alt;
+	r->flags |= RT_CHANGED | RT_DIRTY;
+	r->updated = time(NULL);
+
+	find_alternate(rt, links, mip_end);
+}
+
+/*
+INPUT PARAMETERS
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- mip_end: MIP destination address of a route whose hold-down expired
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function ends the hold-down of the route to 'mip_end', and installs the
+cheapest route the neighbors advertised to it since. 1 is returned if a route
+is installed, else 0.
+*/
+int end_holddown(struct router *rt, uint8_t *links, uint8_t mip_end){
+	int i, cost;
+	int best = infinity;
+	uint8_t n, next = 0;
+	struct route *r = &rt->routes[mip_end];
+
+	if(!(r->flags & RT_HOLDDOWN))
+		return 0;
+
+	r->flags &= ~RT_HOLDDOWN;
+
+	for(i=0; i<rt->nbr_count; i++){
+		n = rt->nbrs[i];
+
+		cost = rt->dist[n][mip_end] + links[n];
+		if(cost < best){
+			best = cost;
+			next = n;
 		}
 	}
 
-	return list;
+	if(!next)
+		return 0;
+
+	add_route(rt, mip_end, best, next);
+	find_alternate(rt, links, mip_end);
+
+	return 1;
 }
 
 /*
 INPUT PARAMETER
-	- list: a linked list of rute structs
+	- rt: DVR table
 
-This function prints out every route in 'list' to the terminal.
+This function prints out every route in 'rt' to the terminal.
 */
-void print_route(struct route *list){
-	struct route *temp = list;
+void print_route(struct router *rt){
+	int i;
 
 	char s[15] = { 0 };
 	memset(s, '-', 14);
@@ -228,48 +458,116 @@ void print_route(struct route *list){
 	memset(s2, '-', 59);
 
 	fprintf(stderr, "%-15s%s%-15s\n", s, "DISTANCE VECTOR ROUTING TABLE", s);
-	fprintf(stderr, "%-20s%-20s%-20s\n", "Destination", "Cost", "Next Jump");
+	fprintf(stderr, "%-20s%-20s%-20s%-20s\n", "Destination", "Cost", \
+																								"Next Jump", "Alternate");
 
-	while(temp != NULL){
-		fprintf(stderr, "%-20d%-20d%-20d\n", temp->mip_end, temp->cost, \
-																															temp->mip_next);
+	for(i=0; i<255; i++){
+
+		if(rt->routes[i].flags & RT_VALID){
+			fprintf(stderr, "%-20d%-20d%-20d%-20d\n", i, rt->routes[i].cost, \
+												rt->routes[i].mip_next, rt->routes[i].mip_alt);
+		}
 
-		temp = temp->next;
 	}
 
 	fprintf(stderr, "%s\n", s2);
 }
 
 /*
-INPUT PARAMETER
-	- table: linked list of route structs
-	- mip_addr: MIP address
+This function returns the current time on CLOCK_MONOTONIC in microseconds, the
+clock of the router timers.
+*/
+uint64_t get_time(void){
+	struct timespec now;
 
-OUTPUT PARAMETER
-	- count: length of 'list'
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
 
-This function finds the length of 'list' if 'list' didn't have any structs with
-'mip_next' equal to 'mip_addr'.
+/*
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function schedules a triggered update of the routes changed in 'rt'.
+Changes are gathered for TRIGGER_DELAY plus a random jitter, so neighbors 
+that heard of the same change do not answer in lockstep, and triggered 
+updates are at least TRIGGER_MIN apart. An update already scheduled is kept.
 */
-int get_length(struct route *list, int mip_addr){
-	int count = 0;
-	struct route *temp = list;
+void schedule_update(struct router *rt){
+	uint64_t when;
 
-	while(temp != NULL){
+	if(timer_pending(&rt->timers, TIMER_ID(TIMER_TRIGGER, 0)))
+		return;
 
-		if(temp->mip_next != mip_addr){
-			count++;
+	when = get_time() + TRIGGER_DELAY + rand() % TRIGGER_JITTER;
+
+	if(when < rt->last_trigger + TRIGGER_MIN)
+		when = rt->last_trigger + TRIGGER_MIN;
+
+	timer_set(&rt->timers, TIMER_ID(TIMER_TRIGGER, 0), when);
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function marks the route to MIP address 0, which no host has, to be 
+advertised as unreachable in the next update. A neighbor takes it as a 
+request for its whole table, so a restarted router confirms or replaces its
+routes at once instead of at the next full updates of its neighbors. Older 
+routers see an unreachable destination they have no route to, and ignore it.
+encode_routes() puts the entry last, after the local routes, so the update 
+does not start with 0 like a link-state message, see ls_message().
+*/
+void request_tables(struct router *rt){
+	rt->routes[0].cost = infinity;
+	rt->routes[0].flags = RT_DIRTY;
+}
+
+/*
+INPUT PARAMETERS
+	- full: 1 to encode every route, 0 for the routes changed since the last 
+	        update
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+OUTPUT PARAMETER
+	- adv: encoded routes
+
+This function encodes the routes to be advertised in a single pass over 'rt',
+shared by the updates to every neighbor. A route removed since the last 
+update is encoded with cost 'infinity'. The encoded routes are no longer dirty.
+Stale routes are not encoded, since their next hop has not confirmed them.
+The route to MIP address 0 is encoded last, see request_tables().
+*/
+void encode_routes(struct router *rt, struct advert *adv, int full){
+	int i, dst;
+	struct route *r;
+
+	adv->count = 0;
+
+	for(i=1; i<=255; i++){
+		dst = i % 255;
+		r = &rt->routes[dst];
+
+		if((full && (r->flags & RT_VALID) && !(r->flags & RT_STALE)) || \
+																							(r->flags & RT_DIRTY)){
+			adv->dst[adv->count] = dst;
+			adv->cost[adv->count] = r->cost;
+			adv->next[adv->count] = r->mip_next;
+			adv->count++;
 		}
 
-		temp = temp->next;
+		r->flags &= ~RT_DIRTY;
 	}
 
-	return count;
 }
 
 /*
 INPUT PARAMETER
-	- list: linked list of route structs
+	- adv: encoded routes
 	- mip_addr: MIP source address of update
 
 INPUT-OUTPUT PARAMETER
@@ -278,52 +576,107 @@ INPUT-OUTPUT PARAMETER
 OUTPUT PARAMETER
 	- update_ptr: update to be sent
 
-This function creates an update returns it.
+This function creates the update to 'mip_addr' from 'adv' and returns it.
+Routes through 'mip_addr' are advertised to it with cost 'infinity' (split 
+horizon with poison reverse), so a loop of two routers breaks on the first 
+update instead of counting to infinity.
 
 Update structure: | src |dst|cost|dst|cost|...| 255 |
 src is the head, and 255 is the tale of the update.
 
 update[count++]: count is returned before incrementing
 */
-char *create_update(struct route *list, int mip_addr, int *update_size){
-	int update_len = get_length(list, mip_addr);
-	update_len = (update_len * 2) + 2; 
-
-	unsigned char update[update_len]; 
-	memset(update, 0, sizeof(update));
-
-	struct route *temp = list;
+char *create_update(struct advert *adv, int mip_addr, int *update_size){
+	int i;
 	int count = 0;
+	unsigned char update[2 * adv->count + 2];
 
 	// destination MIP address of update
 	update[count++] = mip_addr;
 
-	while(temp != NULL){
-		// Split horizon test
-		if(temp->mip_next != mip_addr){
-			// in array and not last index?
-			if(count < (update_len-1)){
-				update[count++] = temp->mip_end;
-				update[count++] = temp->cost;
-			}
+	for(i=0; i<adv->count; i++){
+		update[count++] = adv->dst[i];
+
+		// Poison reverse
+		if(adv->next[i] == mip_addr)
+			update[count++] = infinity;
+		else
+			update[count++] = adv->cost[i];
+	}
+
+	update[count++] = 255;
+
+	*update_size = count;
 
-			// last index?
-			if(count == (update_len-1)){
-				update[count] = 255;
-				break;
+	char *update_ptr = malloc(count);
+	memcpy(update_ptr, update, count);
+
+	return update_ptr;
+}
+
+/*
+INPUT PARAMETERS
+	- sockfd: socket for routing communication
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+	- len: length of 'neighbors'
+	- full: 1 for a periodic full update, 0 for a triggered update
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function sends an update to every neighbor in 'neighbors', or to every 
+local interface if no neighbor is known. A triggered update only carries the
+routes changed since the last update, and is not sent to a neighbor it has 
+nothing for, while a full update is always sent since it keeps the neighbors
+from timing out this router. -1 is returned if an error occur.
+*/
+int send_updates(int sockfd, struct router *rt, uint8_t *neighbors, int len, \
+																																int full){
+	int j, retv, update_size;
+	int known = 0;
+	char *update;
+	struct advert adv;
+
+	full = full || rt->full_pending;
+	rt->full_pending = 0;
+
+	encode_routes(rt, &adv, full);
+
+	if(!full && !adv.count)
+		return 0;
+
+	for(j=0; j<len; j++){
+
+		if(neighbors[j] != 0){
+			known = 1;
+			update = create_update(&adv, neighbors[j], &update_size);
+
+			if(full || update_size > 2){
+				DLOG("sending routing update to MIP daemon");
+				retv = send_update(sockfd, update, update_size);
+				if(retv == -1){
+					free(update);
+					return -1;
+				}
 			}
 
+			free(update);
 		}
 
-		temp = temp->next;			
 	}
 
-	*update_size = sizeof(update);
+	// no neighbors yet, so the update is broadcasted
+	if(!known){
+		update = create_update(&adv, 255, &update_size);
 
-	char *update_ptr = malloc(sizeof(update));
-	memcpy(update_ptr, update, sizeof(update));
+		DLOG("sending routing update to MIP daemon");
+		retv = send_update(sockfd, update, update_size);
+		free(update);
+		if(retv == -1)
+			return -1;
+	}
 
-	return update_ptr;
+	return 0;
 }
 
 /*
@@ -363,7 +716,8 @@ INPUT PARAMETERS
 
 This function send a DVR table update to MIP daemon on the same host through 
 'sockfd'. If the size of the update is not a multiple of 4, padding is added to
-the update. If an error occur, -1 is returned.
+the update, and it is counted for the neighbor it goes to. If an error occur,
+-1 is returned.
 */
 int send_update(int sockfd, char *update, int update_size){
 	ssize_t retv;
@@ -386,6 +740,8 @@ int send_update(int sockfd, char *update, int update_size){
 		return -1;
 	}
 
+	count_tx(update[0], update_size);
+
 	return 0;
 }
 
@@ -427,83 +783,302 @@ char *recv_update(int sockfd, int *update_size){
 
 /*
 INPUT PARAMETERS
+	- update: message from a neighbor, with its MIP address at the head
+	- update_size: size of 'update'
+
+This function returns 1 if 'update' is a link-state message from a router 
+started with -l, which has 0 after the head, and 0 if it is a DVR-table 
+update. A DVR-table update only has 0 there if it has no entry but the 
+request of request_tables(), which encode_routes() puts last.
+*/
+int ls_message(char *update, int update_size){
+	return update_size > 2 && update[1] == 0;
+}
+
+/*
+INPUT PARAMETERS
+	- links: cost of the link to each neighbor, indexed by MIP address
 	- update: DVR table update
 	- update_size: size of DVR table
 
 INPUT-OUTPUT PARAMETER
-	- table: linked list of route structs
+	- rt: DVR table
 
-This function updates the DVR table 'table' with following scenarious in mind:
+This function updates the DVR table 'rt' with following scenarious in mind:
  - dead link in next hop?
+ - new cost from the current next hop?
  - cheaper route?
  - new destination?
+
+The cost of a route is the advertised cost plus the cost of the link to the
+neighbor that advertised it. A route whose cost reaches 'infinity' is 
+unreachable. Costs advertised by the current next hop are always accepted, 
+also when they grow, since the route goes through it, and a neighbor that
+advertised a cheaper route then takes it over. A route the next hop 
+withdraws is removed, not moved to its alternate, since the path of the 
+alternate can run through the same failure. While a route is held down, only
+a route as cheap as the one lost is taken. Each entry of the update is a 
+single lookup in 'rt'. A neighbor that lost a destination we still reach 
+some other way is told our route in the next triggered update, instead of 
+waiting for the next full update. A stale route is confirmed when its next hop
+advertises it, and an entry for address 0 asks for the whole table, see 
+request_tables().
  
-'table' is returned.
+1 is returned if 'rt' changed or has routes to advertise, else 0.
 */
-struct route *update_table(struct route *table, char *update, int update_size){
-	uint8_t dst, src, cost, buf[update_size];
-	int in_table;
+int update_table(struct router *rt, uint8_t *links, char *update, \
+																											int update_size){
+	uint8_t dst, src, heard;
+	uint8_t *buf = (uint8_t *)update;
+	int cost, old;
 	int update_occur = 0;
-
-	memcpy(buf, update, update_size);
+	struct route *r;
 
 	int count = 0;
-	struct route *temp;
 
 	src = buf[count++];
 
-	while(count < update_size){
+	// first update from src?
+	if(!rt->heard[src]){
+		rt->heard[src] = 1;
+		rt->nbrs[rt->nbr_count++] = src;
+		memset(rt->dist[src], infinity, sizeof(rt->dist[src]));
+	}
+
+	while(count + 1 < update_size){
 		// end of update?
 		if(buf[count] == 255){
 			break;
 		}
 
 		dst = buf[count++];
-		cost = buf[count++];
 
-		in_table = 0;
+		// neighbor restarted and asks for the whole table?
+		if(dst == 0){
+			count++;
+			rt->full_pending = 1;
+			update_occur = 1;
+			continue;
+		}
 
-		temp = table;
+		cost = buf[count++] + links[src];
+		r = &rt->routes[dst];
 
-		while(temp != NULL){
-			if(temp->mip_end == dst){
-				in_table = 1;
-			}
+		heard = rt->dist[src][dst];
+		rt->dist[src][dst] = buf[count - 1] < infinity ? buf[count - 1] : infinity;
 
+		// unreachable through src?
+		if(cost >= infinity){
 			// is mip_next a dead link?
-			if(cost == 16 && temp->mip_next == src && temp->mip_end == dst){
-				table = remove_route(table, dst);
+			if((r->flags & RT_VALID) && r->mip_next == src){
+				remove_route(rt, dst);
 				update_occur = 1;
 			}
-			// cheaper route?
-			else if((cost+1) < temp->cost && temp->mip_end == dst){
-				temp->cost = cost + 1;
-				temp->mip_next = src;
+			// alternative for a neighbor that just lost its route?
+			else if((r->flags & RT_VALID) && buf[count - 1] >= infinity && \
+																										heard < infinity){
+				r->flags |= RT_DIRTY;
 				update_occur = 1;
 			}
-
-			temp = temp->next;
 		}
-
+		// held down, and dearer than the route that was lost?
+		else if((r->flags & RT_HOLDDOWN) && cost > r->hold_cost){
+			continue;
+		}
+		// stale route confirmed by its next hop?
+		else if((r->flags & RT_STALE) && r->mip_next == src){
+			r->cost = cost;
+			r->flags = (r->flags & ~RT_STALE) | RT_DIRTY;
+			r->updated = time(NULL);
+			update_occur = 1;
+		}
 		// new route with a living link?
-		if(cost != 16 && !in_table){
-			struct route *new = malloc(sizeof(struct route));
-			new->mip_end = dst;
-			new->cost = cost + 1;
-			new->mip_next = src;
-			new->next = NULL;
-
-			table = add_route(table, new);
+		else if(!(r->flags & RT_VALID)){
+			add_route(rt, dst, cost, src);
 			update_occur = 1;
 		}
+		// new cost from the current next hop?
+		else if(r->mip_next == src && r->cost != cost){
+			old = r->cost;
+			r->cost = cost;
+			r->flags |= RT_DIRTY;
+			r->updated = time(NULL);
+			update_occur = 1;
 
+			if(cost > old)
+				find_best(rt, links, dst);
+		}
+		// cheaper route?
+		else if(cost < r->cost){
+			add_route(rt, dst, cost, src);
+			update_occur = 1;
+		}
+
+		find_alternate(rt, links, dst);
 	}
 
-	if(update_occur){
-		print_route(table);
+	return update_occur;
+}
+
+/*
+INPUT PARAMETERS
+	- neighbor: MIP address of the neighbor
+	- cost: new cost of the link to 'neighbor'
+
+INPUT-OUTPUT PARAMETERS
+	- rt: DVR table
+	- links: cost of the link to each neighbor, indexed by MIP address
+
+This function changes the cost of the link to 'neighbor', and moves the cost
+of every route through 'neighbor' by the same amount. Routes that become 
+unreachable move to their alternates or are removed, and routes that got 
+dearer move to a neighbor that advertised a cheaper route. 1 is returned
+if 'rt' changed, else 0.
+*/
+int set_link(struct router *rt, uint8_t *links, uint8_t neighbor, uint8_t cost){
+	int i;
+	int diff = cost - links[neighbor];
+	struct route *r;
+
+	links[neighbor] = cost;
+
+	if(!diff)
+		return 0;
+
+	for(i=0; i<255; i++){
+		r = &rt->routes[i];
+
+		if((r->flags & RT_VALID) && r->mip_next == neighbor){
+
+			if(r->cost + diff >= infinity){
+				lose_route(rt, links, i);
+			}
+			else{
+				r->cost += diff;
+				r->flags |= RT_DIRTY;
+				r->updated = time(NULL);
+
+				if(diff > 0)
+					find_best(rt, links, i);
+			}
+
+		}
+
+	}
+
+	// the alternates through 'neighbor' got cheaper or dearer
+	for(i=0; i<255; i++)
+		find_alternate(rt, links, i);
+
+	return 1;
+}
+
+/*
+INPUT PARAMETERS
+	- len: length of 'neighbors'
+	- mip_addr: MIP address of the neighbor
+	- refresh: 1 if the neighbor was heard from
+
+INPUT-OUTPUT PARAMETERS
+	- rt: DVR table
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+
+This function adds neighbor 'mip_addr' to 'neighbors' if it is new, and 
+restarts its dead timer if it is new or 'refresh' is set. Routing updates are
+sent to every neighbor in 'neighbors'. 1 is returned if the neighbor is new,
+else 0.
+*/
+int add_neighbor(struct router *rt, uint8_t *neighbors, int len, \
+																							uint8_t mip_addr, int refresh){
+	int j;
+	int seat = -1;
+	uint64_t dead = get_time() + (uint64_t)NEIGHBOR_TIMEOUT * 1000000;
+
+	for(j=0; j<len; j++){
+		// known neighbor?
+		if(neighbors[j] == mip_addr){
+			if(refresh)
+				timer_set(&rt->timers, TIMER_ID(TIMER_NEIGHBOR, mip_addr), dead);
+			return 0;
+		}
+		// first free seat?
+		else if(neighbors[j] == 0 && seat == -1){
+			seat = j;
+		}
+	}
+
+	// new neighbor?
+	if(seat != -1){
+		neighbors[seat] = mip_addr;
+		timer_set(&rt->timers, TIMER_ID(TIMER_NEIGHBOR, mip_addr), dead);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+INPUT PARAMETERS
+	- len: length of 'neighbors'
+	- mip_addr: MIP address of a neighbor that is gone
+
+INPUT-OUTPUT PARAMETERS
+	- rt: DVR table
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+
+This function frees the seat of 'mip_addr' in 'neighbors' and stops its dead
+timer.
+*/
+void forget_neighbor(struct router *rt, uint8_t *neighbors, int len, \
+																														uint8_t mip_addr){
+	int i;
+
+	for(i=0; i<len; i++){
+		if(neighbors[i] == mip_addr)
+			neighbors[i] = 0;
+	}
+
+	timer_cancel(&rt->timers, TIMER_ID(TIMER_NEIGHBOR, mip_addr));
+}
+
+/*
+INPUT PARAMETERS
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- len: length of 'neighbors'
+	- mip_addr: MIP address of a neighbor that timed out
+
+INPUT-OUTPUT PARAMETERS
+	- rt: DVR table
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+
+This function forgets neighbor 'mip_addr' and what it advertised. Every route
+through it moves to its alternate, or is removed so the next update tells the
+other neighbors that it is unreachable. 1 is returned if 'rt' changed, else 0.
+*/
+int drop_neighbor(struct router *rt, uint8_t *links, uint8_t *neighbors, \
+																										int len, uint8_t mip_addr){
+	int i;
+	int changed = 0;
+
+	forget_neighbor(rt, neighbors, len, mip_addr);
+
+	if(rt->heard[mip_addr])
+		memset(rt->dist[mip_addr], infinity, sizeof(rt->dist[mip_addr]));
+
+	for(i=0; i<255; i++){
+
+		if((rt->routes[i].flags & RT_VALID) && \
+																				rt->routes[i].mip_next == mip_addr){
+			lose_route(rt, links, i);
+			changed = 1;
+		}
+		else if(rt->routes[i].mip_alt == mip_addr){
+			find_alternate(rt, links, i);
+		}
+
 	}
 
-	return table;
+	return changed;
 }
 
 int recv_request(int sockfd, uint8_t *mip_req){
@@ -518,18 +1093,12 @@ int recv_request(int sockfd, uint8_t *mip_req){
 	return 0;
 }
 
-uint16_t get_next(struct route *list, uint8_t mip_req){
+uint16_t get_next(struct router *rt, uint8_t mip_req){
 	uint16_t next = 0;
 
-	struct route *temp = list;
-	while(temp != NULL){
-
-		if(temp->mip_end == mip_req){
-			next = temp->mip_end;
-			next = (next << 8) | temp->mip_next;
-		}
-
-		temp = temp->next;
+	if(rt->routes[mip_req].flags & RT_VALID){
+		next = mip_req;
+		next = (next << 8) | rt->routes[mip_req].mip_next;
 	}
 
 	return next;
@@ -548,46 +1117,35 @@ int send_next(int sockfd, uint16_t next){
 	return 0;
 }
 
-int timeout(time_t tv_sec){
-	long time_spent;
-	struct timeval end = { 0 };
-
-	gettimeofday(&end, NULL);
-
-  time_spent = end.tv_sec - tv_sec;
-
-  if(time_spent > 30){
-  	return -1;
-  }
-
-  return 0;
-}
+/*
+INPUT PARAMETERS
+	- sockfd: forwarding socket
+	- rt: DVR table
+
+This function pushes every route installed or changed since the last call to
+the MIP daemon through 'sockfd', in the same format as a reply to a route 
+request. This lets the daemon resolve a new next hop as soon as the route is
+installed instead of when the first datagram arrives. -1 is returned if an 
+error occur.
+*/
+int push_routes(int sockfd, struct router *rt){
+	int i, retv;
+	uint16_t next;
 
-char *create_poison(struct route *table, uint8_t mip_addr, int *size){
-	int dead_len = get_length(table, 255);
-	dead_len = (dead_len - get_length(table, mip_addr));
-	dead_len = (dead_len * 2) + 2;
+	for(i=0; i<255; i++){
 
-	uint8_t dead[dead_len];
-	dead[0] = 255;
-	dead[dead_len-1] = 255;
+		if(rt->routes[i].flags & RT_CHANGED){
+			next = i;
+			next = (next << 8) | rt->routes[i].mip_next;
 
-	int count = 1;
-	struct route *temp = table;
-	while(temp != NULL){
+			retv = send_next(sockfd, next);
+			if(retv == -1)
+				return -1;
 
-		if(temp->mip_next == mip_addr){
-			dead[count++] = temp->mip_end;
-			dead[count++] = 16;
+			rt->routes[i].flags &= ~RT_CHANGED;
 		}
 
-		temp = temp->next;
 	}
 
-	*size = sizeof(dead);
-
-	char *dead_ptr = malloc(sizeof(dead));
-	memcpy(dead_ptr, dead, sizeof(dead));
-
-	return dead_ptr;
-}
\ No newline at end of file
+	return 0;
+}
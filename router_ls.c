@@ -0,0 +1,704 @@
+#include "router.h"
+#include "debug.h"
+
+/*
+INPUT PARAMETERS
+	- local: local MIP addresses of the router
+	- count: number of addresses in 'local'
+
+OUTPUT PARAMETER
+	- db: link-state database
+
+This function starts an empty link-state database for this router, whose ID
+is the lowest of its addresses. The own advertisement is added and flooded
+by ls_originate().
+*/
+void ls_init(struct lsdb *db, char *local, int count){
+	int i;
+	struct lsa *own;
+
+	memset(db, 0, sizeof(*db));
+
+	db->self = 255;
+	for(i=0; i<count; i++){
+		if((uint8_t)local[i] < db->self)
+			db->self = local[i];
+	}
+
+	own = &db->lsas[db->self];
+	own->origin = db->self;
+
+	for(i=0; i<count && i<LS_MAX; i++){
+		own->addrs[own->naddrs++] = local[i];
+	}
+
+	for(i=0; i<256; i++){
+		db->dist[i] = infinity;
+	}
+
+}
+
+/*
+INPUT PARAMETERS
+	- db: link-state database
+	- from: ID of a router
+	- to: ID of a router
+
+This function returns the cost of the cheapest link from router 'from' to
+router 'to', or 'infinity' if there is none. A link is only used if 'to'
+advertises a link back to 'from', so a router that died is left out as soon
+as its neighbors stop advertising it, not when its advertisement ages out.
+*/
+int edge_cost(struct lsdb *db, uint8_t from, uint8_t to){
+	int i;
+	int back = 0;
+	int cost = infinity;
+	struct lsa *lsa;
+
+	if(!db->valid[from] || !db->valid[to])
+		return infinity;
+
+	lsa = &db->lsas[to];
+	for(i=0; i<lsa->nlinks; i++){
+		if(db->owner[lsa->link_addr[i]] == from && lsa->link_cost[i] < infinity)
+			back = 1;
+	}
+
+	if(!back)
+		return infinity;
+
+	lsa = &db->lsas[from];
+	for(i=0; i<lsa->nlinks; i++){
+		if(db->owner[lsa->link_addr[i]] == to && lsa->link_cost[i] < cost)
+			cost = lsa->link_cost[i];
+	}
+
+	return cost;
+}
+
+/*
+INPUT PARAMETERS
+	- u: ID of a router on the shortest path tree
+
+INPUT-OUTPUT PARAMETERS
+	- db: link-state database
+	- queue: routers whose distance got shorter, NULL if they are not needed
+	- len: number of routers in 'queue'
+
+This function relaxes the links of router 'u': a router that is closer
+through 'u' than it was gets 'u' as its parent, and is appended to 'queue'.
+Of several links to the same router, the cheapest is taken.
+*/
+void relax(struct lsdb *db, uint8_t u, uint8_t *queue, int *len){
+	int i, cost;
+	uint8_t v;
+	struct lsa *lsa = &db->lsas[u];
+
+	for(i=0; i<lsa->nlinks; i++){
+		v = db->owner[lsa->link_addr[i]];
+		if(!v || !db->valid[v])
+			continue;
+
+		cost = edge_cost(db, u, v);
+		if(cost >= infinity || lsa->link_cost[i] != cost || \
+																			db->dist[u] + cost >= db->dist[v])
+			continue;
+
+		db->dist[v] = db->dist[u] + cost;
+		db->parent[v] = u;
+		// the path leaves this router through the neighbor address
+		db->first[v] = u == db->self ? lsa->link_addr[i] : db->first[u];
+
+		if(queue != NULL)
+			queue[(*len)++] = v;
+	}
+
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+	- db: link-state database
+
+This function computes the shortest path tree from this router over every
+advertisement in 'db' with Dijkstra's algorithm.
+*/
+void spf(struct lsdb *db){
+	int i, u, best;
+	uint8_t done[256] = { 0 };
+
+	for(i=0; i<256; i++){
+		db->dist[i] = infinity;
+		db->parent[i] = 0;
+		db->first[i] = 0;
+	}
+
+	db->dist[db->self] = 0;
+
+	for(;;){
+		u = -1;
+		best = infinity;
+
+		for(i=1; i<255; i++){
+			if(db->valid[i] && !done[i] && db->dist[i] < best){
+				best = db->dist[i];
+				u = i;
+			}
+		}
+
+		if(u == -1)
+			break;
+
+		done[u] = 1;
+		relax(db, u, NULL, NULL);
+	}
+
+	db->spf_full++;
+}
+
+/*
+INPUT PARAMETER
+	- from: ID of the router whose link to a neighbor got cheaper
+
+INPUT-OUTPUT PARAMETER
+	- db: link-state database
+
+This function updates the shortest path tree after a link from router 'from'
+got cheaper or came up. Only the routers that got closer are visited, from
+'from' outwards, instead of computing the whole tree again.
+*/
+void spf_decrease(struct lsdb *db, uint8_t from){
+	int i, head, tail, count;
+	uint8_t u;
+	uint8_t queue[256], queued[256] = { 0 };
+	uint8_t closer[LS_MAX];
+
+	if(db->dist[from] >= infinity)
+		return;
+
+	// ring of the routers whose links are still to be relaxed
+	head = 0;
+	tail = 1;
+	queue[0] = from;
+	queued[from] = 1;
+
+	while(head != tail){
+		u = queue[head];
+		head = (head + 1) % 256;
+		queued[u] = 0;
+
+		count = 0;
+		relax(db, u, closer, &count);
+
+		for(i=0; i<count; i++){
+			if(!queued[closer[i]]){
+				queued[closer[i]] = 1;
+				queue[tail] = closer[i];
+				tail = (tail + 1) % 256;
+			}
+		}
+
+	}
+
+	db->spf_incremental++;
+}
+
+/*
+INPUT PARAMETER
+	- lsa: advertisement newer than the one in 'db'
+
+INPUT-OUTPUT PARAMETER
+	- db: link-state database
+
+This function installs 'lsa' in 'db' and updates the shortest path tree. If
+only one link changed, the tree is left as it is when the link is dearer but
+not on it, and updated incrementally when the link is cheaper. Otherwise the
+tree is computed again. 1 is returned if the tree may have changed, else 0.
+*/
+int ls_install(struct lsdb *db, struct lsa *lsa){
+	int i, j;
+	int full = 0;
+	int changes = 0;
+	int before[2], after[2];
+	uint8_t addr = 0, peer = 0;
+	struct lsa *old = &db->lsas[lsa->origin];
+
+	// new router, or addresses moved?
+	if(!db->valid[lsa->origin] || old->naddrs != lsa->naddrs || \
+												memcmp(old->addrs, lsa->addrs, lsa->naddrs)){
+		full = 1;
+	}
+	else{
+		// links added or with a new cost
+		for(i=0; i<lsa->nlinks; i++){
+			for(j=0; j<old->nlinks && old->link_addr[j] != lsa->link_addr[i]; j++);
+
+			if(j == old->nlinks || old->link_cost[j] != lsa->link_cost[i]){
+				changes++;
+				addr = lsa->link_addr[i];
+			}
+		}
+
+		// links removed
+		for(j=0; j<old->nlinks; j++){
+			for(i=0; i<lsa->nlinks && lsa->link_addr[i] != old->link_addr[j]; i++);
+
+			if(i == lsa->nlinks){
+				changes++;
+				addr = old->link_addr[j];
+			}
+		}
+
+		full = changes > 1;
+		peer = db->owner[addr];
+	}
+
+	// only a refresh, or a link to a router not known yet?
+	if(!full && (!changes || !peer || !db->valid[peer])){
+		*old = *lsa;
+		return 0;
+	}
+
+	if(!full){
+		before[0] = edge_cost(db, lsa->origin, peer);
+		before[1] = edge_cost(db, peer, lsa->origin);
+	}
+
+	if(db->valid[lsa->origin]){
+		for(i=0; i<old->naddrs; i++){
+			if(db->owner[old->addrs[i]] == lsa->origin)
+				db->owner[old->addrs[i]] = 0;
+		}
+	}
+
+	*old = *lsa;
+	db->valid[lsa->origin] = 1;
+
+	for(i=0; i<lsa->naddrs; i++){
+		db->owner[lsa->addrs[i]] = lsa->origin;
+	}
+
+	if(full){
+		spf(db);
+		return 1;
+	}
+
+	after[0] = edge_cost(db, lsa->origin, peer);
+	after[1] = edge_cost(db, peer, lsa->origin);
+
+	// a dearer link on the tree can move any path behind it
+	if((after[0] > before[0] && db->parent[peer] == lsa->origin) || \
+					(after[1] > before[1] && db->parent[lsa->origin] == peer)){
+		spf(db);
+		return 1;
+	}
+
+	if(after[0] < before[0])
+		spf_decrease(db, lsa->origin);
+	if(after[1] < before[1])
+		spf_decrease(db, peer);
+
+	return after[0] != before[0] || after[1] != before[1];
+}
+
+/*
+INPUT PARAMETER
+	- db: link-state database
+
+INPUT-OUTPUT PARAMETER
+	- rt: DVR table
+
+This function installs the route to every address of a router on the
+shortest path tree in 'rt', through the neighbor address the path leaves
+through. Routes to routers that fell off the tree are removed, except stale
+routes from the checkpoint, which wait for the tree to reach them until they
+expire. Routes with a new next hop are marked to be pushed to the MIP daemon.
+1 is returned if 'rt' changed, else 0.
+*/
+int ls_routes(struct lsdb *db, struct router *rt){
+	int i;
+	int changed = 0;
+	uint8_t origin, cost, next;
+	struct route *r;
+
+	for(i=1; i<255; i++){
+		origin = db->owner[i];
+		r = &rt->routes[i];
+
+		if(origin && db->valid[origin] && db->dist[origin] < infinity){
+			cost = db->dist[origin];
+			next = origin == db->self ? 0 : db->first[origin];
+
+			if((r->flags & RT_VALID) && !(r->flags & RT_STALE) && \
+															r->cost == cost && r->mip_next == next)
+				continue;
+
+			if(!(r->flags & RT_VALID)){
+				rt->count++;
+				r->flags = RT_VALID | RT_CHANGED;
+			}
+			else if(r->mip_next != next){
+				r->flags |= RT_CHANGED;
+			}
+
+			r->cost = cost;
+			r->mip_next = next;
+			r->flags &= ~RT_STALE;
+			r->updated = time(NULL);
+			changed = 1;
+		}
+		// stale routes are kept until the tree reaches them, or they expire
+		else if((r->flags & RT_VALID) && !(r->flags & RT_STALE)){
+			rt->count--;
+
+			r->cost = infinity;
+			r->flags = 0;
+			r->updated = time(NULL);
+			changed = 1;
+		}
+
+	}
+
+	return changed;
+}
+
+/*
+INPUT PARAMETER
+	- lsa: link-state advertisement
+
+OUTPUT PARAMETER
+	- buf: where 'lsa' is encoded
+
+This function encodes 'lsa' in 'buf', and returns its size.
+*/
+int encode_lsa(struct lsa *lsa, uint8_t *buf){
+	int i;
+	int count = 0;
+
+	buf[count++] = lsa->origin;
+	buf[count++] = lsa->seq >> 8;
+	buf[count++] = lsa->seq;
+	buf[count++] = lsa->naddrs;
+
+	for(i=0; i<lsa->naddrs; i++){
+		buf[count++] = lsa->addrs[i];
+	}
+
+	buf[count++] = lsa->nlinks;
+
+	for(i=0; i<lsa->nlinks; i++){
+		buf[count++] = lsa->link_addr[i];
+		buf[count++] = lsa->link_cost[i];
+	}
+
+	return count;
+}
+
+/*
+INPUT PARAMETERS
+	- buf: encoded link-state advertisement
+	- size: bytes left in 'buf'
+
+OUTPUT PARAMETER
+	- lsa: decoded advertisement
+
+This function decodes the advertisement at the start of 'buf', and returns
+its size. -1 is returned if it is cut short or too large.
+*/
+int decode_lsa(uint8_t *buf, int size, struct lsa *lsa){
+	int i;
+	int count = 0;
+
+	if(size < 5 || buf[3] > LS_MAX || size < 5 + buf[3])
+		return -1;
+
+	lsa->origin = buf[count++];
+	lsa->seq = buf[count++] << 8;
+	lsa->seq |= buf[count++];
+	lsa->naddrs = buf[count++];
+
+	for(i=0; i<lsa->naddrs; i++){
+		lsa->addrs[i] = buf[count++];
+	}
+
+	lsa->nlinks = buf[count++];
+	if(lsa->nlinks > LS_MAX || count + 2 * lsa->nlinks > size)
+		return -1;
+
+	for(i=0; i<lsa->nlinks; i++){
+		lsa->link_addr[i] = buf[count++];
+		lsa->link_cost[i] = buf[count++];
+	}
+
+	return count;
+}
+
+/*
+INPUT PARAMETERS
+	- sockfd: routing socket
+	- db: link-state database
+	- origins: IDs of the routers whose advertisements are flooded
+	- count: number of IDs in 'origins'
+	- mip_addr: neighbor the advertisements are sent to, 255 for every
+	            local interface
+
+This function sends the advertisements of 'origins' to 'mip_addr', packed in
+as few messages of at most LS_MSG_MAX bytes as fit. The daemon carries them
+like a DVR-table update.
+
+Message structure: | mip_addr | 0 | advertisement | advertisement |...|
+The 0 tells it apart from a DVR-table update, and it is padded with 0 to a
+whole number of 4 bytes, the unit of the MIP payload length. -1 is returned
+if an error occur.
+*/
+int flood_lsas(int sockfd, struct lsdb *db, uint8_t *origins, int count, \
+																									uint8_t mip_addr){
+	int i, retv;
+	int size = 2;
+	uint8_t msg[LS_MSG_MAX];
+
+	msg[0] = mip_addr;
+	msg[1] = 0;
+
+	for(i=0; i<=count; i++){
+
+		// no room for another advertisement, or no more of them?
+		if(size > 2 && (i == count || size + LSA_SIZE_MAX > LS_MSG_MAX)){
+			while(size % 4)
+				msg[size++] = 0;
+
+			DLOG("sending link-state advertisements to MIP daemon");
+			retv = send_update(sockfd, (char *)msg, size);
+			if(retv == -1)
+				return -1;
+
+			size = 2;
+		}
+
+		if(i < count)
+			size += encode_lsa(&db->lsas[origins[i]], &msg[size]);
+	}
+
+	return 0;
+}
+
+/*
+INPUT PARAMETERS
+	- sockfd: routing socket
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+	- len: length of 'neighbors'
+
+INPUT-OUTPUT PARAMETERS
+	- db: link-state database
+	- rt: DVR table
+
+This function makes a new advertisement of this router with its links to
+'neighbors', installs it and floods it to every neighbor, or broadcasts it
+if no neighbor is known yet. -1 is returned if an error occur, else 1 if 'rt'
+changed and 0 if not.
+*/
+int ls_originate(int sockfd, struct lsdb *db, struct router *rt, \
+												uint8_t *links, uint8_t *neighbors, int len){
+	int j, retv;
+	int known = 0;
+	int changed = 0;
+	uint8_t n;
+	struct lsa lsa = db->lsas[db->self];
+
+	lsa.seq = ++db->seq;
+	lsa.nlinks = 0;
+
+	for(j=0; j<len; j++){
+		n = neighbors[j];
+
+		if(n && links[n] < infinity && lsa.nlinks < LS_MAX){
+			lsa.link_addr[lsa.nlinks] = n;
+			lsa.link_cost[lsa.nlinks] = links[n];
+			lsa.nlinks++;
+		}
+
+	}
+
+	if(ls_install(db, &lsa))
+		changed = ls_routes(db, rt);
+
+	for(j=0; j<len; j++){
+
+		if(neighbors[j]){
+			known = 1;
+			retv = flood_lsas(sockfd, db, &db->self, 1, neighbors[j]);
+			if(retv == -1)
+				return -1;
+		}
+
+	}
+
+	// no neighbors yet, so the advertisement is broadcasted
+	if(!known && flood_lsas(sockfd, db, &db->self, 1, 255) == -1)
+		return -1;
+
+	return changed;
+}
+
+/*
+INPUT PARAMETERS
+	- sockfd: routing socket
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+	- len: length of 'neighbors'
+	- msg: link-state message, first byte is the neighbor it came from
+	- msg_size: size of 'msg'
+
+INPUT-OUTPUT PARAMETERS
+	- db: link-state database
+	- rt: DVR table
+
+This function installs the advertisements in 'msg' that are newer than the
+ones in 'db', and floods them on to every neighbor but the one they came
+from. An older advertisement of this router, from before it restarted, makes
+it originate one with a newer sequence number, and a neighbor that sends an
+older advertisement of its own restarted and is sent the whole database. -1
+is returned if an error occur, else 1 if 'rt' changed and 0 if not.
+*/
+int ls_recv(int sockfd, struct lsdb *db, struct router *rt, uint8_t *neighbors,\
+															int len, char *msg, int msg_size){
+	int j, size, retv;
+	int count = 0;
+	int offset = 2;
+	int changed = 0;
+	uint8_t *buf = (uint8_t *)msg;
+	uint8_t src = buf[0];
+	uint8_t fresh[256];
+	struct lsa lsa;
+
+	while(offset < msg_size && buf[offset] != 0){
+		size = decode_lsa(&buf[offset], msg_size - offset, &lsa);
+		if(size == -1){
+			fprintf(stderr, "TRUNCATED LINK-STATE ADVERTISEMENT IS THROWN\n");
+			break;
+		}
+
+		offset += size;
+
+		// an older advertisement of the neighbor itself, which restarted?
+		if(lsa.origin == src && db->valid[src] && \
+											(int16_t)(lsa.seq - db->lsas[src].seq) < 0 && \
+											ls_sync(sockfd, db, src) == -1)
+			return -1;
+
+		// not newer than the one we have?
+		if(db->valid[lsa.origin] && \
+											(int16_t)(lsa.seq - db->lsas[lsa.origin].seq) <= 0)
+			continue;
+
+		if(lsa.origin == db->self){
+			db->seq = lsa.seq;
+			schedule_update(rt);
+			continue;
+		}
+
+		changed |= ls_install(db, &lsa);
+
+		timer_set(&rt->timers, TIMER_ID(TIMER_LSA, lsa.origin), get_time() + \
+																(uint64_t)LSA_MAXAGE * 1000000);
+
+		fresh[count++] = lsa.origin;
+	}
+
+	for(j=0; j<len && count; j++){
+
+		if(neighbors[j] && neighbors[j] != src){
+			retv = flood_lsas(sockfd, db, fresh, count, neighbors[j]);
+			if(retv == -1)
+				return -1;
+		}
+
+	}
+
+	return changed ? ls_routes(db, rt) : 0;
+}
+
+/*
+INPUT PARAMETERS
+	- sockfd: routing socket
+	- db: link-state database
+	- mip_addr: MIP address of a new neighbor
+
+This function sends every advertisement in 'db' to 'mip_addr', so a new
+neighbor does not wait for the routers to refresh them. -1 is returned if an
+error occur.
+*/
+int ls_sync(int sockfd, struct lsdb *db, uint8_t mip_addr){
+	int i;
+	int count = 0;
+	uint8_t origins[256];
+
+	for(i=1; i<255; i++){
+		if(db->valid[i])
+			origins[count++] = i;
+	}
+
+	return flood_lsas(sockfd, db, origins, count, mip_addr);
+}
+
+/*
+INPUT PARAMETERS
+	- len: length of 'neighbors'
+	- type: RT_METRIC, RT_NEIGH_DOWN or RT_NEIGH_UP
+	- neighbor: MIP address of the neighbor
+	- cost: cost of the link to 'neighbor'
+
+INPUT-OUTPUT PARAMETERS
+	- rt: DVR table
+	- links: cost of the link to each neighbor, indexed by MIP address
+	- neighbors: MIP addresses of the known neighbors, 0 for a free seat
+
+This function applies a message about a link from the MIP daemon. The link
+goes out in the next advertisement of this router, so 'rt' is not changed
+until it is installed. 1 is returned if 'neighbor' is a new neighbor, else 0.
+*/
+int ls_link(struct router *rt, uint8_t *links, uint8_t *neighbors, int len, \
+												uint8_t type, uint8_t neighbor, uint8_t cost){
+	switch(type){
+		case RT_METRIC:
+			links[neighbor] = cost;
+			return add_neighbor(rt, neighbors, len, neighbor, 0);
+		case RT_NEIGH_DOWN:
+			links[neighbor] = infinity;
+			forget_neighbor(rt, neighbors, len, neighbor);
+			return 0;
+		case RT_NEIGH_UP:
+			links[neighbor] = cost;
+			return add_neighbor(rt, neighbors, len, neighbor, 1);
+	}
+
+	return 0;
+}
+
+/*
+INPUT PARAMETER
+	- origin: ID of a router whose advertisement was not refreshed in time
+
+INPUT-OUTPUT PARAMETERS
+	- db: link-state database
+	- rt: DVR table
+
+This function removes the advertisement of 'origin' from 'db' and computes
+the shortest path tree again. 1 is returned if 'rt' changed, else 0.
+*/
+int ls_expire(struct lsdb *db, struct router *rt, uint8_t origin){
+	int i;
+	struct lsa *lsa = &db->lsas[origin];
+
+	if(!db->valid[origin] || origin == db->self)
+		return 0;
+
+	for(i=0; i<lsa->naddrs; i++){
+		if(db->owner[lsa->addrs[i]] == origin)
+			db->owner[lsa->addrs[i]] = 0;
+	}
+
+	db->valid[origin] = 0;
+	spf(db);
+
+	return ls_routes(db, rt);
+}
@@ -36,6 +36,20 @@ int main(int argc, char *argv[]){
 	fdmax = new_fdmax(routing, fdmax);
 	FD_SET(routing, &master);
 
+/* ------------------------------ STATS SOCKET ----------------------------- */
+
+	int stats_listen = -1;
+	if(stats_path != NULL){
+		stats_listen = new_listen(stats_path);
+		if(stats_listen == -1){
+			close_all(&master, fdmax);
+			exit(EXIT_FAILURE);
+		}
+
+		fdmax = new_fdmax(stats_listen, fdmax);
+		FD_SET(stats_listen, &master);
+	}
+
 /* ------------------- STORING LOCAL INTERFACES IN DVR TABLE --------------- */
 
 	int update_size = 0;
@@ -48,225 +62,392 @@ int main(int argc, char *argv[]){
 		exit(EXIT_FAILURE);
 	}
 
-	struct route *dvr_table = NULL;
+	struct router dvr_table;
+	memset(&dvr_table, 0, sizeof(dvr_table));
+
+/* ------------------------------ TIMERS FD -------------------------------- */
+
+	retv = init_timers(&dvr_table.timers);
+	if(retv == -1){
+		free(first_update);
+		close_all(&master, fdmax);
+		exit(EXIT_FAILURE);
+	}
+
+	fdmax = new_fdmax(dvr_table.timers.fd, fdmax);
+	FD_SET(dvr_table.timers.fd, &master);
 
 	int count = 0;
 	while(count < update_size){
-		struct route *new = malloc(sizeof(struct route));
-		memset(new, 0, sizeof(struct route));
-		new->mip_end = first_update[count++];
-
-		dvr_table = add_route(dvr_table, new);
+		// local addresses cost nothing and have no next hop
+		add_route(&dvr_table, first_update[count++], 0, 0);
 	}
 
+	// in link-state mode the routes come from the shortest path tree
+	struct lsdb lsdb;
+	if(link_state)
+		ls_init(&lsdb, first_update, update_size);
+
 	free(first_update);
 
-	print_route(dvr_table);
+	// routes of the last run are used until the neighbors confirm them
+	if(ckpt_path != NULL){
+		retv = init_ckpt(ckpt_path);
+		if(retv == -1){
+			close_all(&master, fdmax);
+			exit(EXIT_FAILURE);
+		}
 
-	int start_len = update_size;
-	// the number of neighbors you have is equal to the number of local MIP 
-	// addresses available
-	uint8_t neighbors[start_len];
-	memset(neighbors, 0, sizeof(neighbors));
+		fprintf(stderr, "STALE ROUTES LOADED: %d\n", load_routes(&dvr_table));
+	}
 
-	struct timeval timers[start_len];
+	// the local and stale routes are not logged as changes
+	init_stats(&dvr_table);
 
-	count = 0;
-	while(count < start_len){
-		gettimeofday(&timers[count], NULL);
-		count++;
-	}
+	print_route(&dvr_table);
 
-/* -------------------------------- PIPES FD ------------------------------- */
-	
-	int pipe_fd[2];
+	// local addresses are advertised right away, and the neighbors asked for 
+	// their tables
+	srand(time(NULL) ^ getpid());
+	if(!link_state)
+		request_tables(&dvr_table);
+	schedule_update(&dvr_table);
 
-	retv = pipe(pipe_fd);
+	// stale routes are handed to the MIP daemon before it asks
+	retv = push_routes(forward, &dvr_table);
 	if(retv == -1){
-		perror("main(): pipe()");
-		free_routes(dvr_table);
 		close_all(&master, fdmax);
-		exit(EXIT_FAILURE);		
+		exit(EXIT_FAILURE);
 	}
 
-	fdmax = new_fdmax(pipe_fd[0], fdmax);
-	FD_SET(pipe_fd[0], &master);
+	int start_len = update_size;
+	// the number of neighbors you have is equal to the number of local MIP 
+	// addresses available
+	uint8_t neighbors[start_len];
+	memset(neighbors, 0, sizeof(neighbors));
+
+	// cost of the link to each neighbor, published by the MIP daemon
+	uint8_t links[256];
+	memset(links, 1, sizeof(links));
+
+	// full updates of neighbors that started together drift apart
+	timer_set(&dvr_table.timers, TIMER_ID(TIMER_REFRESH, 0), get_time() + \
+					(uint64_t)(REFRESH_INTERVAL - REFRESH_JITTER + \
+					rand() % (2 * REFRESH_JITTER)) * 1000000);
  
 /* ------------------------------ MAIN LOOP -------------------------------- */
-	int child_pid = 0;
 
-	if((child_pid = fork())){
-		// parent process
-		close(pipe_fd[1]); // write-end of pipe
+	for(;;){
 
-		for(;;){
+		// the table as it is after the last event survives a restart
+		save_routes(&dvr_table);
 
-			count = 0;
-			while(count < start_len){
+		// the timerfd wakes the loop up for the earliest timer
+		retv = timer_arm(&dvr_table.timers);
+		if(retv == -1){
+			close_all(&master, fdmax);
+			exit(EXIT_FAILURE);
+		}
+
+		readfds = master;
 
-				if(neighbors[count] != 0){
+		DLOG("looking for activity in socket set...");
+		retv = select(fdmax+1, &readfds, NULL, NULL, NULL);
+		if(retv == -1){
+			perror("main(): select()");
+			close_all(&master, fdmax);
+			exit(EXIT_FAILURE);
+		}
+		DLOG("found activity\n");
 
-					retv = timeout(timers[count].tv_sec);
+		int i;
+		for(i=0; i<=fdmax; i++){
+
+			if(FD_ISSET(i, &readfds)){
+
+				if(i == forward){
+
+					uint8_t mip_req = 0;
+					
+					DLOG("receiving route request from MIP daemon");
+					retv = recv_request(i, &mip_req);
 					if(retv == -1){
+						close_all(&master, fdmax);
+						exit(EXIT_FAILURE);
+					}
 
-						int poison_size = 0;
-						char *poison = create_poison(dvr_table, neighbors[count], \
-																																&poison_size);
-						
-						DLOG("sending dead-link update");
-						retv = send_update(routing, poison, poison_size);
-						if(retv == -1){
-							free(poison);
-							free_routes(dvr_table);
-							close_all(&master, fdmax);
-							kill(child_pid, SIGTERM);
-							wait(NULL);
-							exit(EXIT_FAILURE);
-						}
+					uint16_t next = get_next(&dvr_table, mip_req);
 
-						free(poison);
+					DLOG("sending route to MIP daemon");
+					retv = send_next(i, next);
+					if(retv == -1){
+						close_all(&master, fdmax);
+						exit(EXIT_FAILURE);	
 					}
 
 				}
+				else if(i == routing){
 
-				count++;
-			}
+					update_size = 0;
 
-			readfds = master;
-
-			DLOG("looking for activity in socket set...");
-			retv = select(fdmax+1, &readfds, NULL, NULL, NULL);
-			if(retv == -1){
-				perror("main(): select()");
-				free_routes(dvr_table);
-				close_all(&master, fdmax);
-				kill(child_pid, SIGTERM);
-				wait(NULL);
-				exit(EXIT_FAILURE);
-			}
-			DLOG("found activity\n");
+					DLOG("receiving routing update from MIP daemon");
+					char *update = recv_update(i, &update_size);
+					if(update == NULL){
+						close_all(&master, fdmax);
+						exit(EXIT_FAILURE);
+					}
 
-			int i;
-			for(i=0; i<=fdmax; i++){
+					if(update[0] != 0)
+						count_rx(update[0], update_size);
 
-				if(FD_ISSET(i, &readfds)){
+					// link-state mode, the DVR table is filled from the LSDB
+					if(link_state){
+						retv = 0;
 
-					if(i == forward){
+						// link from the MIP daemon?
+						if(update[0] == 0 && update_size >= 4){
+							DLOG("updating link");
+							// a new neighbor is sent every advertisement
+							if(ls_link(&dvr_table, links, neighbors, start_len, update[1], \
+																								update[2], update[3]))
+								retv = ls_sync(routing, &lsdb, update[2]);
 
-						uint8_t mip_req = 0;
-						
-						DLOG("receiving route request from MIP daemon");
-						retv = recv_request(i, &mip_req);
-						if(retv == -1){
-							free_routes(dvr_table);
-							close_all(&master, fdmax);
-							kill(child_pid, SIGTERM);
-							wait(NULL); // waiting for any child process to terminate
-							exit(EXIT_FAILURE);
+							// the link goes out in a new advertisement of this router
+							schedule_update(&dvr_table);
+						}
+						// advertisements from a neighbor?
+						else if(update[0] != 0 && ls_message(update, update_size)){
+							if(add_neighbor(&dvr_table, neighbors, start_len, update[0], 1)){
+								retv = ls_sync(routing, &lsdb, update[0]);
+								schedule_update(&dvr_table);
+							}
+
+							DLOG("updating LSDB");
+							if(retv != -1)
+								retv = ls_recv(routing, &lsdb, &dvr_table, neighbors, \
+																					start_len, update, update_size);
+							if(retv == 1)
+								print_route(&dvr_table);
 						}
 
-						uint16_t next = get_next(dvr_table, mip_req);
+						if(update[0] == 0 && update_size >= 4 && update[1] <= RT_NEIGH_UP)
+							log_routes(&dvr_table, update[1], update[2]);
+						else
+							log_routes(&dvr_table, CAUSE_UPDATE, update[0]);
 
-						DLOG("sending route to MIP daemon");
-						retv = send_next(i, next);
+						free(update);
+
+						DLOG("pushing new routes to MIP daemon");
+						if(retv != -1)
+							retv = push_routes(forward, &dvr_table);
 						if(retv == -1){
-							free_routes(dvr_table);
 							close_all(&master, fdmax);
-							kill(child_pid, SIGTERM);
-							wait(NULL); // waiting for any child process to terminate
-							exit(EXIT_FAILURE);	
+							exit(EXIT_FAILURE);
 						}
 
+						continue;
 					}
-					else if(i == routing){
 
-						update_size = 0;
+					// link cost from the MIP daemon?
+					if(update[0] == 0){
 
-						DLOG("receiving routing update from MIP daemon");
-						char *update = recv_update(i, &update_size);
-						if(update == NULL){
-							free_routes(dvr_table);
-							close_all(&master, fdmax);
-							kill(child_pid, SIGTERM);
-							wait(NULL); // waiting for any child process to terminate
-							exit(EXIT_FAILURE);
-						}
+						if(update_size >= 4 && update[1] == RT_METRIC){
+							DLOG("updating link cost");
+							if(set_link(&dvr_table, links, update[2], update[3])){
+								print_route(&dvr_table);
+								schedule_update(&dvr_table);
+							}
 
-						int j;
-						// new neighbor?
-						for(j=0; j<start_len; j++){
-							if(neighbors[j] == (uint8_t)update[0]){
-								gettimeofday(&timers[j], NULL);
-								break;
+							// a measured link is a neighbor, also before its first update
+							if(add_neighbor(&dvr_table, neighbors, start_len, update[2], 0)){
+								dvr_table.full_pending = 1;
+								schedule_update(&dvr_table);
 							}
-							else if(neighbors[j] == 0){
-								neighbors[j] = (uint8_t)update[0];
-								gettimeofday(&timers[j], NULL);
-								break;
+						}
+						// neighbor gone silent, routes through it fail over now
+						else if(update_size >= 4 && update[1] == RT_NEIGH_DOWN){
+							DLOG("neighbor down");
+							retv = set_link(&dvr_table, links, update[2], infinity);
+							retv |= drop_neighbor(&dvr_table, links, neighbors, start_len, \
+																														update[2]);
+							if(retv){
+								print_route(&dvr_table);
+								schedule_update(&dvr_table);
+							}
+						}
+						// neighbor back, and sent the whole table
+						else if(update_size >= 4 && update[1] == RT_NEIGH_UP){
+							DLOG("neighbor up");
+							if(set_link(&dvr_table, links, update[2], update[3]))
+								print_route(&dvr_table);
+
+							if(add_neighbor(&dvr_table, neighbors, start_len, update[2], 1)){
+								dvr_table.full_pending = 1;
+								schedule_update(&dvr_table);
 							}
 						}
 
-						DLOG("updating DVR table");
-						dvr_table = update_table(dvr_table, update, update_size);
+						if(update_size >= 4 && update[1] <= RT_NEIGH_UP)
+							log_routes(&dvr_table, update[1], update[2]);
 
 						free(update);
-					}
-					else{ //read-end pipe
-
-						char *update;
-						int update_size = 0;
 
-						uint8_t byte = 0;
-						// flushing write buffer of pipe_fd
-						retv = read(i, &byte, sizeof(uint8_t));
+						// routes moved to their alternates are pushed right away
+						DLOG("pushing new routes to MIP daemon");
+						retv = push_routes(forward, &dvr_table);
 						if(retv == -1){
-							perror("main(): read()");
-							free_routes(dvr_table);
 							close_all(&master, fdmax);
-							kill(child_pid, SIGTERM);
-							wait(NULL); // waiting for any child process to terminate
-							exit(EXIT_FAILURE);	
+							exit(EXIT_FAILURE);
 						}
 
-						// neighbors in dvr_table?
-						if(start_len < get_length(dvr_table, 255)){
+						continue;
+					}
 
-							int j;
-							for(j=0; j<start_len; j++){
+					// link-state advertisements from a router started with -l?
+					if(ls_message(update, update_size)){
+						fprintf(stderr, "LINK-STATE MESSAGE IS THROWN\n");
+						free(update);
+						continue;
+					}
 
-								if(neighbors[j] != 0){
+					// a new neighbor is sent the whole table
+					if(add_neighbor(&dvr_table, neighbors, start_len, update[0], 1)){
+						dvr_table.full_pending = 1;
+						schedule_update(&dvr_table);
+					}
 
-									update = create_update(dvr_table, neighbors[j], &update_size);
+					DLOG("updating DVR table");
+					if(update_table(&dvr_table, links, update, update_size)){
+						print_route(&dvr_table);
+						schedule_update(&dvr_table);
+					}
 
-									DLOG("sending routing update to MIP daemon");
-									retv = send_update(routing, update, update_size);
-									if(retv == -1){
-										free(update);
-										free_routes(dvr_table);
-										close_all(&master, fdmax);
-										exit(EXIT_FAILURE);
-									}
+					log_routes(&dvr_table, CAUSE_UPDATE, update[0]);
 
-									free(update);
-								}
+					free(update);
 
-							}
+					DLOG("pushing new routes to MIP daemon");
+					retv = push_routes(forward, &dvr_table);
+					if(retv == -1){
+						close_all(&master, fdmax);
+						exit(EXIT_FAILURE);
+					}
+				}
+				else if(i == stats_listen){
+
+					DLOG("sending statistics");
+					int stats_fd = accept(i, NULL, NULL);
+					if(stats_fd == -1){
+						perror("main(): accept()");
+					}
+					else{
+						write_stats(stats_fd, &dvr_table);
+						close(stats_fd);
+					}
 
+				}
+				else{ // timerfd
+
+					uint64_t expirations = 0;
+					// flushing the expiration count of the timerfd
+					retv = read(i, &expirations, sizeof(uint64_t));
+					if(retv == -1 && errno != EAGAIN){
+						perror("main(): read()");
+						close_all(&master, fdmax);
+						exit(EXIT_FAILURE);	
+					}
+
+					// the timerfd is disarmed by expiring
+					dvr_table.timers.armed = 0;
+
+					int id;
+					uint64_t now = get_time();
+					while((id = timer_pop(&dvr_table.timers, now)) != -1){
+
+						if(link_state && (id == TIMER_ID(TIMER_REFRESH, 0) || \
+																			id == TIMER_ID(TIMER_TRIGGER, 0))){
+							DLOG("flooding own link-state advertisement");
+							retv = ls_originate(routing, &lsdb, &dvr_table, links, \
+																								neighbors, start_len);
+							if(retv == 1)
+								print_route(&dvr_table);
+
+							log_routes(&dvr_table, CAUSE_ORIGINATE, 0);
+							if(retv != -1)
+								retv = push_routes(forward, &dvr_table);
+
+							if(id == TIMER_ID(TIMER_TRIGGER, 0))
+								dvr_table.last_trigger = now;
+							else
+								timer_set(&dvr_table.timers, id, now + \
+												(uint64_t)(REFRESH_INTERVAL - REFRESH_JITTER + \
+												rand() % (2 * REFRESH_JITTER)) * 1000000);
 						}
-						else{
+						else if(id / 256 == TIMER_LSA){
+							DLOG("link-state advertisement aged out");
+							if(ls_expire(&lsdb, &dvr_table, id % 256))
+								print_route(&dvr_table);
 
-							update = create_update(dvr_table, 255, &update_size);
+							log_routes(&dvr_table, CAUSE_AGE, id % 256);
+							retv = push_routes(forward, &dvr_table);
+						}
+						else if(link_state && id / 256 == TIMER_NEIGHBOR){
+							// the link goes out of the next advertisement of this router
+							DLOG("neighbor timed out");
+							forget_neighbor(&dvr_table, neighbors, start_len, id % 256);
+							schedule_update(&dvr_table);
+							retv = 0;
+						}
+						else if(id == TIMER_ID(TIMER_REFRESH, 0)){
+							DLOG("sending full routing update");
+							retv = send_updates(routing, &dvr_table, neighbors, start_len, 1);
 
-							DLOG("sending routing update to MIP daemon");
-							retv = send_update(routing, update, update_size);
-							if(retv == -1){
-								free(update);
-								free_routes(dvr_table);
-								close_all(&master, fdmax);
-								exit(EXIT_FAILURE);
+							timer_set(&dvr_table.timers, id, now + \
+											(uint64_t)(REFRESH_INTERVAL - REFRESH_JITTER + \
+											rand() % (2 * REFRESH_JITTER)) * 1000000);
+						}
+						else if(id == TIMER_ID(TIMER_TRIGGER, 0)){
+							DLOG("sending triggered update");
+							retv = send_updates(routing, &dvr_table, neighbors, start_len, 0);
+
+							dvr_table.last_trigger = now;
+						}
+						else if(id == TIMER_ID(TIMER_STALE, 0)){
+							DLOG("stale routes expired");
+							if(expire_stale(&dvr_table, links)){
+								print_route(&dvr_table);
+								schedule_update(&dvr_table);
 							}
 
-							free(update);
+							log_routes(&dvr_table, CAUSE_STALE, 0);
+							retv = push_routes(forward, &dvr_table);
+						}
+						else if(id / 256 == TIMER_HOLDDOWN){
+							DLOG("hold-down expired");
+							if(end_holddown(&dvr_table, links, id % 256)){
+								print_route(&dvr_table);
+								schedule_update(&dvr_table);
+							}
+
+							log_routes(&dvr_table, CAUSE_HOLDDOWN, 0);
+							retv = push_routes(forward, &dvr_table);
+						}
+						else{
+							// routes through it go out as unreachable in a triggered update
+							DLOG("neighbor timed out");
+							if(drop_neighbor(&dvr_table, links, neighbors, start_len, \
+																														id % 256)){
+								print_route(&dvr_table);
+								schedule_update(&dvr_table);
+							}
+
+							log_routes(&dvr_table, CAUSE_TIMEOUT, id % 256);
+							retv = push_routes(forward, &dvr_table);
+						}
+
+						if(retv == -1){
+							close_all(&master, fdmax);
+							exit(EXIT_FAILURE);
 						}
 
 					}
@@ -278,27 +459,6 @@ int main(int argc, char *argv[]){
 		}
 
 	}
-	else{
-		// child process
-		signal(SIGTERM, sighandler);
-		int write_fd = pipe_fd[1];
-		close(pipe_fd[0]); //read_end of pipe
-
-		uint8_t n = 1;
-
-		for(;;){
-			sleep(10);
-			
-			retv = write(write_fd, &n, sizeof(uint8_t));
-			if(retv == -1){
-				perror("child: main(): send()");
-				close(write_fd);
-				exit(EXIT_FAILURE);
-			}
-
-			n++;
-		}
-	}
 
 	return 0;
 }
\ No newline at end of file
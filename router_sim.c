@@ -0,0 +1,664 @@
+#include "router.h"
+
+/*
+Convergence simulator of the DVR table. N virtual routers run the table logic
+of the router (update_table, encode_routes, create_update, set_link,
+drop_neighbor, end_holddown) over an in-memory message bus with a virtual
+clock, so no root, MIP daemon or network namespace is needed.
+
+Router i has MIP address i + 1 and links of cost 1. The routers start
+together, then links fail and come back one at a time, and then routers 
+restart one at a time with an empty table. Updates are received as in 
+router_main(), so one taken for a link-state message is thrown and fails the
+phase. Each phase runs until
+no message or timer is left, and is checked against the shortest paths of
+the topology. The triggered update and hold-down timers of each router are
+moved from its timer heap to the virtual clock. Dead timers and full updates
+are not simulated, so a link failure is detected at once, as with hellos.
+
+USAGE: router_sim [-t line|ring|grid|random] [-n nodes] [-k degree]
+                  [-f failures] [-r restarts] [-d delay] [-i infinity]
+                  [-s seed]
+*/
+
+int debug;
+
+#define SIM_MAX 254 // routers, one MIP address each
+
+#define EV_UPDATE 0 // update arrives at the router
+#define EV_TRIGGER 1 // triggered update timer of the router expires
+#define EV_HOLDDOWN 2 // hold-down timer of a route of the router expires
+
+struct event{
+	uint64_t when; // usec on the virtual clock
+	uint64_t seq; // events at the same time run in the order they were queued
+	int type;
+	int node;
+	int arg; // sender of an update, destination of a hold-down
+	int size;
+	char *update;
+};
+
+struct node{
+	struct router rt;
+	uint8_t links[256];
+	uint8_t neighbors[SIM_MAX];
+	uint64_t trigger; // virtual time of the pending triggered update, 0 if none
+	uint64_t last_trigger;
+	uint64_t hold[256]; // virtual time each hold-down ends, 0 if none
+};
+
+struct sim{
+	int n;
+	uint64_t delay; // usec an update spends on a link
+	uint64_t now;
+	uint64_t seq;
+	int len, cap;
+	struct event *queue;
+	struct node *nodes;
+	uint8_t adj[SIM_MAX][SIM_MAX];
+	// counters of the phase
+	uint64_t last_change;
+	long messages, bytes, dropped, changes, thrown;
+};
+
+static void push_event(struct sim *s, struct event *e){
+	int i = s->len++;
+	struct event temp;
+
+	if(s->len > s->cap){
+		s->cap = s->cap ? 2 * s->cap : 1024;
+		s->queue = realloc(s->queue, s->cap * sizeof(struct event));
+		if(s->queue == NULL){
+			perror("push_event(): realloc()");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	e->seq = s->seq++;
+	s->queue[i] = *e;
+
+	while(i > 0){
+		struct event *a = &s->queue[i], *b = &s->queue[(i - 1) / 2];
+		if(a->when > b->when || (a->when == b->when && a->seq > b->seq))
+			break;
+		temp = *a; *a = *b; *b = temp;
+		i = (i - 1) / 2;
+	}
+
+}
+
+static int before(struct event *a, struct event *b){
+	return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+}
+
+static void pop_event(struct sim *s, struct event *e){
+	int i = 0, child;
+	struct event temp;
+
+	*e = s->queue[0];
+	s->queue[0] = s->queue[--s->len];
+
+	for(;;){
+		child = 2 * i + 1;
+		if(child >= s->len)
+			break;
+
+		if(child + 1 < s->len && before(&s->queue[child + 1], &s->queue[child]))
+			child++;
+
+		if(!before(&s->queue[child], &s->queue[i]))
+			break;
+
+		temp = s->queue[i]; s->queue[i] = s->queue[child]; s->queue[child] = temp;
+		i = child;
+	}
+
+}
+
+/*
+Moves the timers the table logic set on router 'i' since 'start', the real
+time before it was called, to the virtual clock. A triggered update already
+pending is kept, and triggered updates are at least TRIGGER_MIN apart, as in
+schedule_update().
+*/
+static void take_timers(struct sim *s, int i, uint64_t start){
+	int id;
+	uint64_t when;
+	struct node *nd = &s->nodes[i];
+	struct timers *t = &nd->rt.timers;
+	struct event e;
+
+	while(t->len){
+		id = t->heap[0].id;
+		when = s->now + (t->heap[0].when > start ? t->heap[0].when - start : 0);
+		timer_cancel(t, id);
+
+		memset(&e, 0, sizeof(e));
+		e.node = i;
+		e.when = when;
+
+		if(id == TIMER_ID(TIMER_TRIGGER, 0)){
+			if(nd->trigger)
+				continue;
+			if(nd->last_trigger && e.when < nd->last_trigger + TRIGGER_MIN)
+				e.when = nd->last_trigger + TRIGGER_MIN;
+
+			nd->trigger = e.when;
+			e.type = EV_TRIGGER;
+			push_event(s, &e);
+		}
+		else if(id / 256 == TIMER_HOLDDOWN){
+			nd->hold[id % 256] = e.when;
+			e.type = EV_HOLDDOWN;
+			e.arg = id % 256;
+			push_event(s, &e);
+		}
+		// no dead timers, failures are announced by fail_link()
+	}
+
+}
+
+/*
+Puts an update of router 'i' to router 'to' on the bus. 'mip_addr' is the
+address it is created for, 255 for a broadcast. The receiving MIP daemon sets
+the head of an update to the address of the sender.
+*/
+static void post_update(struct sim *s, int i, int to, int mip_addr, \
+																					struct advert *adv, int full){
+	int size;
+	char *update;
+	struct event e;
+
+	update = create_update(adv, mip_addr, &size);
+
+	if(!full && size <= 2){
+		free(update);
+		return;
+	}
+
+	update[0] = i + 1;
+
+	memset(&e, 0, sizeof(e));
+	e.type = EV_UPDATE;
+	e.when = s->now + s->delay;
+	e.node = to;
+	e.arg = i;
+	e.size = size;
+	e.update = update;
+	push_event(s, &e);
+
+	s->messages++;
+	s->bytes += size;
+}
+
+/*
+Sends the updates of router 'i' to its neighbors over the bus, like
+send_updates(). An update of a router that knows no neighbor yet is 
+broadcasted on each of its links.
+*/
+static void send_sim(struct sim *s, int i, int full){
+	int j;
+	int known = 0;
+	struct node *nd = &s->nodes[i];
+	struct advert adv;
+
+	full = full || nd->rt.full_pending;
+	nd->rt.full_pending = 0;
+
+	encode_routes(&nd->rt, &adv, full);
+
+	if(!full && !adv.count)
+		return;
+
+	for(j=0; j<SIM_MAX; j++){
+
+		if(nd->neighbors[j] == 0)
+			continue;
+
+		known = 1;
+		post_update(s, i, nd->neighbors[j] - 1, nd->neighbors[j], &adv, full);
+	}
+
+	// no neighbors yet, so the update is broadcasted
+	for(j=0; !known && j<s->n; j++){
+		if(s->adj[i][j])
+			post_update(s, i, j, 255, &adv, full);
+	}
+
+}
+
+/*
+Runs the events until none is left. 'last_change' is set to the virtual time
+of the last event that changed a table.
+*/
+static void run(struct sim *s){
+	int changed;
+	uint64_t start;
+	struct event e;
+	struct node *nd;
+
+	while(s->len){
+		pop_event(s, &e);
+		s->now = e.when;
+		nd = &s->nodes[e.node];
+		changed = 0;
+		start = get_time();
+
+		if(e.type == EV_UPDATE){
+			// lost with the link it was on?
+			if(!s->adj[e.arg][e.node]){
+				s->dropped++;
+				free(e.update);
+				continue;
+			}
+
+			// thrown by router_main() of a DVR router
+			if(ls_message(e.update, e.size)){
+				fprintf(stderr, "UPDATE FROM %d IS THROWN AS LINK-STATE\n", e.arg + 1);
+				s->thrown++;
+				free(e.update);
+				continue;
+			}
+
+			if(add_neighbor(&nd->rt, nd->neighbors, SIM_MAX, e.arg + 1, 1)){
+				nd->rt.full_pending = 1;
+				schedule_update(&nd->rt);
+			}
+
+			if(update_table(&nd->rt, nd->links, e.update, e.size)){
+				schedule_update(&nd->rt);
+				changed = 1;
+			}
+
+			free(e.update);
+		}
+		else if(e.type == EV_TRIGGER){
+			nd->trigger = 0;
+			nd->last_trigger = s->now;
+			send_sim(s, e.node, 0);
+		}
+		else if(nd->hold[e.arg] == e.when){
+			nd->hold[e.arg] = 0;
+			if(end_holddown(&nd->rt, nd->links, e.arg)){
+				schedule_update(&nd->rt);
+				changed = 1;
+			}
+		}
+
+		take_timers(s, e.node, start);
+
+		if(changed)
+			s->last_change = s->now;
+	}
+
+}
+
+/*
+Counts the routes pushed to the MIP daemon since the last call, like
+push_routes().
+*/
+static void push_sim(struct sim *s){
+	int i, j;
+
+	for(i=0; i<s->n; i++){
+		for(j=0; j<255; j++){
+			if(s->nodes[i].rt.routes[j].flags & RT_CHANGED){
+				s->nodes[i].rt.routes[j].flags &= ~RT_CHANGED;
+				s->changes++;
+			}
+		}
+	}
+
+}
+
+/*
+Link between routers 'a' and 'b' comes up, as an RT_NEIGH_UP from the MIP
+daemon of each end.
+*/
+static void join_link(struct sim *s, int a, int b){
+	int k, from, to;
+	uint64_t start;
+	struct node *nd;
+
+	s->adj[a][b] = s->adj[b][a] = 1;
+
+	for(k=0; k<2; k++){
+		from = k ? b : a;
+		to = k ? a : b;
+		nd = &s->nodes[from];
+		start = get_time();
+
+		if(set_link(&nd->rt, nd->links, to + 1, 1))
+			s->last_change = s->now;
+
+		if(add_neighbor(&nd->rt, nd->neighbors, SIM_MAX, to + 1, 1)){
+			nd->rt.full_pending = 1;
+			schedule_update(&nd->rt);
+		}
+
+		take_timers(s, from, start);
+	}
+
+}
+
+/*
+Link between routers 'a' and 'b' fails, as an RT_NEIGH_DOWN from the MIP
+daemon of each end.
+*/
+static void fail_link(struct sim *s, int a, int b){
+	int k, from, to, retv;
+	uint64_t start;
+	struct node *nd;
+
+	s->adj[a][b] = s->adj[b][a] = 0;
+
+	for(k=0; k<2; k++){
+		from = k ? b : a;
+		to = k ? a : b;
+		nd = &s->nodes[from];
+		start = get_time();
+
+		retv = set_link(&nd->rt, nd->links, to + 1, infinity);
+		retv |= drop_neighbor(&nd->rt, nd->links, nd->neighbors, SIM_MAX, to + 1);
+		if(retv){
+			schedule_update(&nd->rt);
+			s->last_change = s->now;
+		}
+
+		take_timers(s, from, start);
+	}
+
+}
+
+/*
+Router 'a' restarts with an empty table, as router_main() starts: it asks 
+for the tables of its neighbors with request_tables(), and broadcasts its 
+first update since it knows no neighbor yet.
+*/
+static void restart_node(struct sim *s, int a){
+	uint64_t start = get_time();
+	struct node *nd = &s->nodes[a];
+
+	memset(&nd->rt, 0, sizeof(nd->rt));
+	memset(nd->neighbors, 0, sizeof(nd->neighbors));
+	memset(nd->hold, 0, sizeof(nd->hold));
+	nd->trigger = 0;
+	nd->last_trigger = 0;
+
+	if(init_timers(&nd->rt.timers) == -1)
+		exit(EXIT_FAILURE);
+	close(nd->rt.timers.fd);
+
+	add_route(&nd->rt, a + 1, 0, 0);
+	request_tables(&nd->rt);
+	schedule_update(&nd->rt);
+
+	take_timers(s, a, start);
+	s->last_change = s->now;
+}
+
+/*
+Compares every table with the shortest paths of the links that are up, and
+returns the number of wrong routes. A route must have the shortest cost and a
+next hop on a shortest path, and a destination 'infinity' or more away must
+have no route.
+*/
+static int check(struct sim *s){
+	int i, j, k, head, tail, wrong = 0;
+	int dist[SIM_MAX][SIM_MAX];
+	uint8_t queue[SIM_MAX];
+	struct route *r;
+
+	for(i=0; i<s->n; i++){
+		for(j=0; j<s->n; j++)
+			dist[i][j] = -1;
+
+		dist[i][i] = 0;
+		head = tail = 0;
+		queue[tail++] = i;
+		while(head < tail){
+			j = queue[head++];
+			for(k=0; k<s->n; k++){
+				if(s->adj[j][k] && dist[i][k] == -1){
+					dist[i][k] = dist[i][j] + 1;
+					queue[tail++] = k;
+				}
+			}
+		}
+	}
+
+	for(i=0; i<s->n; i++){
+		for(j=0; j<s->n; j++){
+			r = &s->nodes[i].rt.routes[j + 1];
+
+			if(dist[i][j] == -1 || dist[i][j] >= infinity){
+				if(r->flags & RT_VALID)
+					wrong++;
+			}
+			else if(!(r->flags & RT_VALID) || r->cost != dist[i][j]){
+				wrong++;
+			}
+			else if(i != j && (r->mip_next < 1 || r->mip_next > s->n || \
+							!s->adj[i][r->mip_next - 1] || \
+							dist[r->mip_next - 1][j] != dist[i][j] - 1)){
+				wrong++;
+			}
+		}
+	}
+
+	return wrong;
+}
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+Runs the phase started at virtual time 'start' to its end, and prints its
+convergence time, the updates sent and the routes pushed to the MIP daemons.
+1 is returned if a table is wrong or an update was thrown, else 0.
+*/
+static int report(struct sim *s, char *phase, uint64_t start){
+	int wrong;
+	uint64_t cpu = now_ns();
+
+	run(s);
+	push_sim(s);
+
+	cpu = now_ns() - cpu;
+	wrong = check(s);
+
+	printf("%-16s%10.1f%10.1f%10ld%10ld%10ld%10ld%10.1f%8d\n", phase, \
+				(s->last_change - start) / 1000.0, (s->now - start) / 1000.0, \
+				s->messages, s->bytes, s->dropped, s->changes, cpu / 1e6, wrong);
+
+	wrong += s->thrown;
+	s->messages = s->bytes = s->dropped = s->changes = s->thrown = 0;
+
+	return wrong != 0;
+}
+
+static void build(struct sim *s, char *topo, int degree){
+	int i, j, cols, edges;
+
+	if(!strcmp(topo, "line") || !strcmp(topo, "ring")){
+		for(i=0; i+1<s->n; i++)
+			s->adj[i][i + 1] = 1;
+		if(!strcmp(topo, "ring") && s->n > 2)
+			s->adj[s->n - 1][0] = 1;
+	}
+	else if(!strcmp(topo, "grid")){
+		for(cols=1; cols*cols<s->n; cols++);
+		for(i=0; i<s->n; i++){
+			if((i + 1) % cols && i + 1 < s->n)
+				s->adj[i][i + 1] = 1;
+			if(i + cols < s->n)
+				s->adj[i][i + cols] = 1;
+		}
+	}
+	else{
+		// a random tree keeps the graph connected
+		edges = 0;
+		for(i=1; i<s->n; i++){
+			s->adj[i][rand() % i] = 1;
+			edges++;
+		}
+		while(edges < s->n * degree / 2 && edges < s->n * (s->n - 1) / 2){
+			i = rand() % s->n;
+			j = rand() % s->n;
+			if(i != j && !s->adj[i][j] && !s->adj[j][i]){
+				s->adj[i][j] = 1;
+				edges++;
+			}
+		}
+	}
+
+}
+
+int main(int argc, char *argv[]){
+	int opt, i, j, f, a, b, links;
+	int n = 16, degree = 3, failures = 1, restarts = 1, wrong = 0;
+	unsigned seed = 1;
+	uint64_t delay = 1000;
+	char *topo = "ring";
+	char phase[32];
+	uint64_t start;
+	uint8_t (*edges)[2];
+	struct sim *s;
+
+	while((opt = getopt(argc, argv, "t:n:k:f:r:d:i:s:")) != -1){
+		switch(opt){
+			case 't':
+				topo = optarg;
+				break;
+			case 'n':
+				n = strtol(optarg, NULL, 10);
+				break;
+			case 'k':
+				degree = strtol(optarg, NULL, 10);
+				break;
+			case 'f':
+				failures = strtol(optarg, NULL, 10);
+				break;
+			case 'r':
+				restarts = strtol(optarg, NULL, 10);
+				break;
+			case 'd':
+				delay = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				infinity = strtol(optarg, NULL, 10);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "USAGE: %s [-t line|ring|grid|random] [-n nodes] " \
+								"[-k degree] [-f failures] [-r restarts] [-d delay] " \
+								"[-i infinity] [-s seed]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if(n < 2 || n > SIM_MAX || infinity < 2 || infinity > 240 || \
+			(strcmp(topo, "line") && strcmp(topo, "ring") && strcmp(topo, "grid") \
+			&& strcmp(topo, "random"))){
+		fprintf(stderr, "%s: 2 to %d nodes, infinity 2 to 240, and a topology " \
+										"of line, ring, grid or random\n", argv[0], SIM_MAX);
+		return EXIT_FAILURE;
+	}
+
+	s = calloc(1, sizeof(struct sim));
+	if(s == NULL){
+		perror("main(): calloc()");
+		return EXIT_FAILURE;
+	}
+	s->n = n;
+	s->delay = delay;
+
+	s->nodes = calloc(n, sizeof(struct node));
+	if(s->nodes == NULL){
+		perror("main(): calloc()");
+		return EXIT_FAILURE;
+	}
+
+	srand(seed);
+	build(s, topo, degree);
+
+	// the builders fill one half of the adjacency matrix
+	edges = malloc(sizeof(*edges) * n * n / 2 + sizeof(*edges));
+	links = 0;
+	for(i=0; i<n; i++){
+		for(j=0; j<n; j++){
+			if(s->adj[i][j]){
+				s->adj[i][j] = 0;
+				edges[links][0] = i < j ? i : j;
+				edges[links][1] = i < j ? j : i;
+				links++;
+			}
+		}
+	}
+
+	for(i=0; i<n; i++){
+		if(init_timers(&s->nodes[i].rt.timers) == -1)
+			return EXIT_FAILURE;
+		close(s->nodes[i].rt.timers.fd);
+
+		memset(s->nodes[i].links, 1, sizeof(s->nodes[i].links));
+		add_route(&s->nodes[i].rt, i + 1, 0, 0);
+	}
+
+	printf("%s of %d routers, %d links, infinity %d, link delay %" PRIu64 \
+						" usec\n", topo, n, links, infinity, s->delay);
+	printf("%-16s%10s%10s%10s%10s%10s%10s%10s%8s\n", "phase", "conv_ms", \
+				"quiet_ms", "updates", "bytes", "dropped", "pushed", "cpu_ms", "wrong");
+
+	for(i=0; i<links; i++)
+		join_link(s, edges[i][0], edges[i][1]);
+	wrong += report(s, "start", 0);
+
+	for(f=0; f<failures && links; f++){
+		i = rand() % links;
+		a = edges[i][0];
+		b = edges[i][1];
+
+		start = s->last_change = s->now;
+		fail_link(s, a, b);
+		snprintf(phase, sizeof(phase), "fail %d-%d", a + 1, b + 1);
+		wrong += report(s, phase, start);
+
+		start = s->last_change = s->now;
+		join_link(s, a, b);
+		snprintf(phase, sizeof(phase), "restore %d-%d", a + 1, b + 1);
+		wrong += report(s, phase, start);
+	}
+
+	for(f=0; f<restarts; f++){
+		a = rand() % n;
+
+		start = s->last_change = s->now;
+		restart_node(s, a);
+		snprintf(phase, sizeof(phase), "restart %d", a + 1);
+		wrong += report(s, phase, start);
+	}
+
+	links = 0;
+	for(i=0; i<n; i++)
+		links += s->nodes[i].rt.count;
+
+	printf("tables %zu bytes per router, %.1f KiB in all, %.1f routes each\n", \
+					sizeof(struct router), n * sizeof(struct router) / 1024.0, \
+					(double)links / n);
+
+	free(edges);
+	free(s->queue);
+	free(s->nodes);
+	free(s);
+
+	return wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
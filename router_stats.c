@@ -0,0 +1,220 @@
+#include "router.h"
+#include "debug.h"
+
+struct rtstats rstats;
+
+static char *causes[] = { "update", "metric", "down", "up", "timeout", \
+																	"holddown", "originate", "lsa-age", "stale" };
+
+static char *changes[] = { "install", "withdraw", "next-hop" };
+
+/*
+INPUT PARAMETER
+	- rt: DVR table with the local routes
+
+This function starts the statistics of the router, with the routes already in
+'rt' as the routes last logged.
+*/
+void init_stats(struct router *rt){
+	int i;
+
+	memset(&rstats, 0, sizeof(rstats));
+	rstats.start = get_time();
+
+	for(i=0; i<256; i++){
+		rstats.valid[i] = rt->routes[i].flags & RT_VALID;
+		rstats.next[i] = rt->routes[i].mip_next;
+		rstats.cost[i] = rt->routes[i].cost;
+	}
+
+}
+
+/*
+INPUT PARAMETERS
+	- neighbor: MIP address of the neighbor the update came from
+	- size: size of the update
+
+This function counts an update or link-state message received from
+'neighbor'.
+*/
+void count_rx(uint8_t neighbor, int size){
+	struct nbr_stats *n = &rstats.nbrs[neighbor];
+
+	n->rx_updates++;
+	n->rx_bytes += size;
+	n->last_rx = get_time();
+}
+
+/*
+INPUT PARAMETERS
+	- neighbor: MIP address of the neighbor the update is sent to, 255 for
+	            every local interface
+	- size: size of the update
+
+This function counts an update or link-state message sent to 'neighbor'.
+*/
+void count_tx(uint8_t neighbor, int size){
+	rstats.nbrs[neighbor].tx_updates++;
+	rstats.nbrs[neighbor].tx_bytes += size;
+}
+
+/*
+INPUT PARAMETERS
+	- rt: DVR table
+	- cause: CAUSE_UPDATE, RT_METRIC, RT_NEIGH_DOWN, RT_NEIGH_UP or a CAUSE_ of
+	         the timers, of the changes in 'rt' since the last call
+	- neighbor: MIP address of the neighbor of 'cause', 0 if none
+
+This function finds the routes installed, withdrawn or moved to another next
+hop since the last call, and logs each with the time and its cause. The
+event log keeps the last LOG_SIZE changes, and each is also printed to the
+terminal. A change of cost alone is not logged, and an unknown 'cause' is
+logged as CAUSE_UPDATE. The number of changes is returned.
+*/
+int log_routes(struct router *rt, uint8_t cause, uint8_t neighbor){
+	int i, valid;
+	int count = 0;
+	uint64_t now = get_time();
+	struct route *r;
+	struct route_event *e;
+
+	// message type the MIP daemon does not send, logged as an update
+	if(cause >= sizeof(causes) / sizeof(causes[0]))
+		cause = CAUSE_UPDATE;
+
+	for(i=0; i<255; i++){
+		r = &rt->routes[i];
+		valid = r->flags & RT_VALID;
+
+		if(!valid && !rstats.valid[i])
+			continue;
+
+		// cost alone changed?
+		if(valid && rstats.valid[i] && r->mip_next == rstats.next[i]){
+			rstats.cost[i] = r->cost;
+			continue;
+		}
+
+		e = &rstats.log[rstats.log_next];
+		rstats.log_next = (rstats.log_next + 1) % LOG_SIZE;
+		if(rstats.log_len < LOG_SIZE)
+			rstats.log_len++;
+
+		e->when = now;
+		e->mip_end = i;
+		e->change = !valid ? CHANGE_WITHDRAW : !rstats.valid[i] ? CHANGE_INSTALL \
+																													: CHANGE_NEXT;
+		e->cause = cause;
+		e->neighbor = neighbor;
+		e->seq = cause == CAUSE_UPDATE ? rstats.nbrs[neighbor].rx_updates : 0;
+		e->old_next = rstats.next[i];
+		e->old_cost = rstats.valid[i] ? rstats.cost[i] : infinity;
+		e->new_next = valid ? r->mip_next : 0;
+		e->new_cost = valid ? r->cost : infinity;
+
+		fprintf(stderr, "[%12.6f] %-4d%-10s%4d/%-4d-> %4d/%-4d%s %d #%" PRIu32 \
+						"\n", (now - rstats.start) / 1e6, e->mip_end, changes[e->change], \
+						e->old_next, e->old_cost, e->new_next, e->new_cost, \
+						causes[e->cause], e->neighbor, e->seq);
+
+		if(rstats.changed[i])
+			rstats.flaps[i]++;
+		rstats.changed[i] = now;
+
+		rstats.valid[i] = valid;
+		rstats.next[i] = r->mip_next;
+		rstats.cost[i] = r->cost;
+		count++;
+	}
+
+	if(!count)
+		return 0;
+
+	// quiet long enough for the last burst to be over?
+	if(!rstats.burst_changes || now - rstats.burst_end > CONVERGE_QUIET){
+		rstats.burst_start = now;
+		rstats.burst_changes = 0;
+	}
+	rstats.burst_end = now;
+	rstats.burst_changes += count;
+
+	return count;
+}
+
+/*
+INPUT PARAMETERS
+	- sockfd: connected stats socket
+	- rt: DVR table
+
+This function writes the statistics of the router to 'sockfd': how long the
+last convergence took, the updates received from and sent to each neighbor,
+the flaps of each route and how long ago it last changed, and the event log.
+*/
+void write_stats(int sockfd, struct router *rt){
+	int i;
+	uint64_t now = get_time();
+	struct nbr_stats *n;
+	struct route_event *e;
+
+	dprintf(sockfd, "router: %s, infinity %d, up %.1f s, %d routes\n", \
+					link_state ? "link-state" : "distance vector", infinity, \
+					(now - rstats.start) / 1e6, rt->count);
+
+	if(rstats.burst_changes)
+		dprintf(sockfd, "convergence: %" PRIu32 " route changes in %.1f ms, " \
+						"last %.1f s ago (%s)\n", rstats.burst_changes, \
+						(rstats.burst_end - rstats.burst_start) / 1e3, \
+						(now - rstats.burst_end) / 1e6, \
+						now - rstats.burst_end > CONVERGE_QUIET ? "converged" : "converging");
+	else
+		dprintf(sockfd, "convergence: no route changes\n");
+
+	dprintf(sockfd, "\n%-10s%12s%12s%12s%12s%12s\n", "neighbor", "rx_updates", \
+					"rx_bytes", "tx_updates", "tx_bytes", "last_rx_s");
+
+	for(i=1; i<256; i++){
+		n = &rstats.nbrs[i];
+
+		if(!n->rx_updates && !n->tx_updates)
+			continue;
+
+		if(n->last_rx)
+			dprintf(sockfd, "%-10d%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" \
+							PRIu64 "%12.1f\n", i, n->rx_updates, n->rx_bytes, n->tx_updates, \
+							n->tx_bytes, (now - n->last_rx) / 1e6);
+		else
+			dprintf(sockfd, "%-10d%12" PRIu64 "%12" PRIu64 "%12" PRIu64 "%12" \
+							PRIu64 "%12s\n", i, n->rx_updates, n->rx_bytes, n->tx_updates, \
+							n->tx_bytes, "-");
+	}
+
+	dprintf(sockfd, "\n%-12s%8s%8s%8s%12s\n", "destination", "next", "cost", \
+																								"flaps", "changed_s");
+
+	for(i=0; i<255; i++){
+
+		if(!(rt->routes[i].flags & RT_VALID) && !rstats.changed[i])
+			continue;
+
+		dprintf(sockfd, "%-12d%8d%8d%8" PRIu32, i, rt->routes[i].mip_next, \
+											rt->routes[i].cost, rstats.flaps[i]);
+		if(rstats.changed[i])
+			dprintf(sockfd, "%12.1f\n", (now - rstats.changed[i]) / 1e6);
+		else
+			dprintf(sockfd, "%12s\n", "-");
+	}
+
+	dprintf(sockfd, "\n%-14s%-6s%-10s%-10s%-10s%s\n", "time_s", "dst", \
+											"change", "old", "new", "cause neighbor #update");
+
+	for(i=0; i<rstats.log_len; i++){
+		e = &rstats.log[(rstats.log_next - rstats.log_len + i + LOG_SIZE) % \
+																																LOG_SIZE];
+
+		dprintf(sockfd, "%-14.6f%-6d%-10s%4d/%-5d%4d/%-5d%s %d #%" PRIu32 "\n", \
+						(e->when - rstats.start) / 1e6, e->mip_end, changes[e->change], \
+						e->old_next, e->old_cost, e->new_next, e->new_cost, \
+						causes[e->cause], e->neighbor, e->seq);
+	}
+
+}
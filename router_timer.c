@@ -0,0 +1,197 @@
+#include <sys/timerfd.h>
+
+#include "router.h"
+#include "debug.h"
+
+/*
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function creates the timerfd of 't', with no timers set. -1 is returned
+if an error occur.
+*/
+int init_timers(struct timers *t){
+	int i;
+
+	t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if(t->fd == -1){
+		perror("init_timers(): timerfd_create()");
+		return -1;
+	}
+
+	t->len = 0;
+	t->armed = 0;
+
+	for(i=0; i<TIMER_IDS; i++){
+		t->pos[i] = -1;
+	}
+
+	return 0;
+}
+
+/*
+INPUT PARAMETERS
+	- i: index in the heap of 't'
+	- j: index in the heap of 't'
+
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function swaps two timers in the heap of 't'.
+*/
+void heap_swap(struct timers *t, int i, int j){
+	struct timer temp = t->heap[i];
+
+	t->heap[i] = t->heap[j];
+	t->heap[j] = temp;
+
+	t->pos[t->heap[i].id] = i;
+	t->pos[t->heap[j].id] = j;
+}
+
+/*
+INPUT PARAMETER
+	- i: index in the heap of 't'
+
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function moves the timer at 'i' up or down the heap of 't' until the
+timers above it expire earlier and the timers below it later.
+*/
+void heap_fix(struct timers *t, int i){
+	int child;
+
+	while(i > 0 && t->heap[i].when < t->heap[(i - 1) / 2].when){
+		heap_swap(t, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	for(;;){
+		child = 2 * i + 1;
+		if(child >= t->len)
+			break;
+
+		if(child + 1 < t->len && t->heap[child + 1].when < t->heap[child].when)
+			child++;
+
+		if(t->heap[i].when <= t->heap[child].when)
+			break;
+
+		heap_swap(t, i, child);
+		i = child;
+	}
+
+}
+
+/*
+INPUT PARAMETERS
+	- id: timer, see TIMER_ID()
+	- when: time the timer expires, see get_time()
+
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function sets timer 'id' to expire at 'when', moving it if it is
+already set.
+*/
+void timer_set(struct timers *t, int id, uint64_t when){
+	int i = t->pos[id];
+
+	if(i == -1){
+		i = t->len++;
+		t->heap[i].id = id;
+		t->pos[id] = i;
+	}
+
+	t->heap[i].when = when;
+	heap_fix(t, i);
+}
+
+/*
+INPUT PARAMETER
+	- id: timer, see TIMER_ID()
+
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function stops timer 'id' if it is set.
+*/
+void timer_cancel(struct timers *t, int id){
+	int i = t->pos[id];
+
+	if(i == -1)
+		return;
+
+	t->len--;
+	if(i != t->len){
+		heap_swap(t, i, t->len);
+		heap_fix(t, i);
+	}
+
+	t->pos[id] = -1;
+}
+
+/*
+INPUT PARAMETERS
+	- t: timers of the router
+	- id: timer, see TIMER_ID()
+
+This function returns 1 if timer 'id' is set, else 0.
+*/
+int timer_pending(struct timers *t, int id){
+	return t->pos[id] != -1;
+}
+
+/*
+INPUT PARAMETERS
+	- now: current time, see get_time()
+
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function takes the earliest timer of 't' off the heap if it has
+expired, and returns its id. -1 is returned if no timer has expired.
+*/
+int timer_pop(struct timers *t, uint64_t now){
+	int id;
+
+	if(!t->len || t->heap[0].when > now)
+		return -1;
+
+	id = t->heap[0].id;
+	timer_cancel(t, id);
+
+	return id;
+}
+
+/*
+INPUT-OUTPUT PARAMETER
+	- t: timers of the router
+
+This function arms the timerfd of 't' for the earliest timer, or disarms it
+if no timer is set. The timerfd is only changed when the earliest timer has.
+-1 is returned if an error occur.
+*/
+int timer_arm(struct timers *t){
+	int retv;
+	uint64_t when = t->len ? t->heap[0].when : 0;
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	if(when == t->armed)
+		return 0;
+
+	// 0 disarms the timerfd
+	its.it_value.tv_sec = when / 1000000;
+	its.it_value.tv_nsec = (when % 1000000) * 1000;
+
+	retv = timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL);
+	if(retv == -1){
+		perror("timer_arm(): timerfd_settime()");
+		return -1;
+	}
+
+	t->armed = when;
+
+	return 0;
+}
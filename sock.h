@@ -2,16 +2,92 @@
 #define SOCK_H
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <sys/select.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <net/ethernet.h>
 #include <arpa/inet.h>
 #include <net/if.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #define ETH_P_MIP 0x88B5
+#define ETH_HDR_SIZE 14
+#define MIP_HDR_SIZE 4
+
+/*
+MIP control messages (TRA 3) are handled by the daemons themselves. An echo 
+request is answered with an echo reply by its destination, and with a time
+exceeded by the node where its TTL runs out, so a request sent with a small
+TTL traces the path hop by hop. 'ttl' is the TTL the request was sent with, 
+'hop' is the address of the node that replied, the other fields are echoed
+back unchanged. Link probes measure the round-trip time to a neighbor, and
+are answered by the neighbor with a link reply.
+
+A congestion notice is sent by a node that drops or delays a MIP-TP segment,
+to the source of the segment. 'ttl' is CONG_DROP or CONG_DELAY, 'ident' and 
+'seq' are the port and sequence number of the segment and 'hop' is the node 
+that sent the notice. The source daemon hands it to mip_tp as a segment of 
+only a MIP-TP header, with padding 3 and the reason in the unused byte.
+
+A bundle (TRA 5) carries small datagrams and control messages headed for the
+same next hop, addressed to that neighbor. Its data is the bundled packets 
+back to back, each with its own MIP header giving its length.
+
+A hello (TRA 6) is sent to every neighbor at a fixed interval by a daemon 
+started with -H. Its data is a uint32_t detection time in microseconds, and
+the neighbor is declared down by the receiver if no hello arrives within it.
+*/
+#define TRA_CTRL 3
+#define TRA_BUNDLE 5
+#define TRA_HELLO 6
+#define CTRL_ECHO_REQUEST 1
+#define CTRL_ECHO_REPLY 2
+#define CTRL_TIME_EXCEEDED 3
+#define CTRL_LINK_PROBE 4
+#define CTRL_LINK_REPLY 5
+#define CTRL_CONGESTION 6
+#define CTRL_SIZE 16
+#define HELLO_SIZE 4
+
+#define TP_HDR_SIZE 4
+
+/*
+Segments from the same source that arrive in one receive batch are handed to
+mip_tp in one message. It has 0 where the source address would be, followed 
+by | source | count | and then count times | length (uint16_t) | segment |.
+*/
+#define TP_BATCH 16
+
+/*
+A run of segments can be handed from mip_tp to the daemon as one 
+super-segment. It has 0 where the destination address would be, followed by
+| destination | MIP-TP header of the first segment | data in a segment 
+(uint16_t) | data (uint16_t) | data |. The daemon slices the data into 
+segments numbered on from the first, and routes them with one request.
+*/
+#define TP_DATA_MAX 1492
+#define TP_SUPER_SIZE (9 + TP_BATCH * TP_DATA_MAX + 3)
+#define CONG_DROP 1
+#define CONG_DELAY 2
+
+struct ctrl_msg{
+  uint8_t type;
+  uint8_t ttl;
+  uint16_t ident;
+  uint16_t seq;
+  uint8_t hop;
+  uint8_t pad;
+  uint64_t stamp;
+};
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
 
 void close_all(fd_set master, int fdmax);
 
@@ -19,10 +95,24 @@ void update_fdmax(int sockfd, int *fdmax);
 
 int create_listenfd(char *sockpath);
 
+int create_statsfd(char *sockpath);
+
+int listen_unix(char *sockpath, int type);
+
 int connect_socket(int sockfd, char *sockpath);
 
 int init_connection(int sockfd, char *path);
 
 int init_rawfd(char *interface);
 
+int attach_filter(int sockfd, uint8_t *mip_addrs, int count);
+
+int tune_rawfd(int sockfd, int rcvbuf, int sndbuf);
+
+int get_bufsize(int sockfd, int optname);
+
+int get_packet_stats(int sockfd, struct tpacket_stats *st);
+
+int busy_poll_rawfd(int sockfd, int usec);
+
 #endif
\ No newline at end of file
@@ -46,10 +46,40 @@ This function creates a listening socket with and returns it. -1 is return if
 an error occur.
 */
 int create_listenfd(char *sockpath){
+  return listen_unix(sockpath, SOCK_SEQPACKET);
+}
+
+/*
+INPUT PARAMETERS
+  - sockpath: socket path
+
+OUTPUT PARAMETER
+  - sockfd: socket file descriptor
+
+This function creates a listening stream socket and returns it. Statistics are
+written to it as plain text, so any unix socket client can read them. -1 is 
+returned if an error occur.
+*/
+int create_statsfd(char *sockpath){
+  return listen_unix(sockpath, SOCK_STREAM);
+}
+
+/*
+INPUT PARAMETERS
+  - sockpath: socket path
+  - type: socket type
+
+OUTPUT PARAMETER
+  - sockfd: socket file descriptor
+
+This function creates a listening unix socket of type 'type' bound to 
+'sockpath' and returns it. -1 is returned if an error occur.
+*/
+int listen_unix(char *sockpath, int type){
   int retv, sockfd;
   struct sockaddr_un sockaddr = { 0 };
 
-  sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  sockfd = socket(AF_UNIX, type, 0);
   if(sockfd == -1){
     perror("create_listenfd(): socket()");
     return -1;
@@ -135,7 +165,11 @@ Input parameter:
   - interface: name of interface
 
 This function initializes a raw socket with the interface passed as a parameter.
-The raw socket is also configured to receive frames with a broadcast address.
+The raw socket is also configured to receive frames with a broadcast address,
+and to timestamp every frame in software when it is received and when it is 
+sent (SO_TIMESTAMPING). Software timestamps work on any device, veth included.
+Transmit timestamps are returned on the error queue of the socket, numbered 
+in send order (SOF_TIMESTAMPING_OPT_ID).
 
 Return value is the initialized socket
 */
@@ -143,6 +177,9 @@ int init_rawfd(char *interface){
   int sockfd;
   int protocol = htons(ETH_P_MIP);
   int broadcast = 1;
+  int tsflags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | \
+                SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | \
+                SOF_TIMESTAMPING_OPT_TSONLY;
 
   sockfd = socket(AF_PACKET, SOCK_RAW, protocol);
   if(sockfd == -1){
@@ -161,6 +198,12 @@ int init_rawfd(char *interface){
     return -1;
   }
 
+  // latency measurements only, the daemon works without them
+  retv = setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &tsflags, \
+                                                              sizeof(tsflags));
+  if(retv == -1)
+    perror("init_rawfd(): SO_TIMESTAMPING");
+
   //valgrind points to unitialized bytes
   retv = bind(sockfd, (struct sockaddr *) &sockaddr, \
                                                   sizeof(struct sockaddr_ll)); 
@@ -171,4 +214,215 @@ int init_rawfd(char *interface){
   }
 
   return sockfd;
-}
\ No newline at end of file
+}
+/*
+INPUT PARAMETERS
+  - sockfd: raw socket the filter is attached to
+  - mip_addrs: local MIP addresses of the host
+  - count: number of addresses in 'mip_addrs'
+
+This function builds a classic BPF program and attaches it to 'sockfd' with 
+SO_ATTACH_FILTER, so the kernel discards MIP frames the daemon has no use for
+before they are copied to user space. A frame is accepted if its MIP 
+destination is one of 'mip_addrs' or 255, or if it is a datagram or a control
+message (TRA 4 or 3) in transit with a TTL left. ARP requests and responses (TRA 0 and 1) carry no 
+payload, and are truncated to the Ethernet and MIP header. Attaching a new 
+program replaces the old one, so the function is called again whenever the 
+local addresses change. -1 is returned if an error occur.
+
+MIP destination is the 8 bits following the 3 TRA bits in the first two bytes
+of the MIP header: (hdr[0] << 8 | hdr[1]) >> 5 & 0xff.
+*/
+int attach_filter(int sockfd, uint8_t *mip_addrs, int count){
+  int retv, i, pc;
+  int prog_len = count + 17;
+  struct sock_filter prog[prog_len];
+  struct sock_fprog fprog = { 0 };
+
+  // jump targets, relative to the end of the program
+  int accept = prog_len - 2;
+  int accept_hdr = prog_len - 3;
+  int drop = prog_len - 1;
+  int local = prog_len - 6;
+
+  pc = 0;
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, \
+                                                                ETH_HDR_SIZE);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 5);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xff);
+
+  // broadcast or local destination?
+  prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 255, \
+                                                            local - pc - 1, 0);
+  pc++;
+  for(i=0; i<count; i++){
+    prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, \
+                                              mip_addrs[i], local - pc - 1, 0);
+    pc++;
+  }
+
+  // datagram or control message in transit with TTL left?
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, \
+                                                                ETH_HDR_SIZE);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 5);
+  prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 1, 0);
+  pc++;
+  prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 3, 0, \
+                                                              drop - pc - 1);
+  pc++;
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, \
+                                                            ETH_HDR_SIZE + 3);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0f);
+  prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, \
+                                              drop - pc - 1, accept - pc - 1);
+  pc++;
+
+  // frame to this host, header only for ARP?
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, \
+                                                                ETH_HDR_SIZE);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 5);
+  prog[pc] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 1, \
+                                          accept - pc - 1, accept_hdr - pc - 1);
+  pc++;
+
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, \
+                                                ETH_HDR_SIZE + MIP_HDR_SIZE);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffff);
+  prog[pc++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+  fprog.len = pc;
+  fprog.filter = prog;
+
+  retv = setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, \
+                                                                sizeof(fprog));
+  if(retv == -1){
+    perror("attach_filter(): setsockopt()");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: raw socket file descriptor
+  - rcvbuf: receive buffer size in bytes, 0 keeps the current size
+  - sndbuf: send buffer size in bytes, 0 keeps the current size
+
+This function sets the buffer sizes of 'sockfd'. SO_RCVBUFFORCE and 
+SO_SNDBUFFORCE are tried first so the sizes are not capped by rmem_max and 
+wmem_max, with a fallback to the unprivileged options. The socket is also set 
+to report its drop counter (SO_RXQ_OVFL) with every received frame. -1 is 
+returned if an error occur.
+*/
+int tune_rawfd(int sockfd, int rcvbuf, int sndbuf){
+  int retv;
+  int on = 1;
+
+  if(rcvbuf > 0){
+    retv = setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, \
+                                                              sizeof(rcvbuf));
+    if(retv == -1){
+      retv = setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, \
+                                                              sizeof(rcvbuf));
+      if(retv == -1){
+        perror("tune_rawfd(): setsockopt()");
+        return -1;
+      }
+    }
+  }
+
+  if(sndbuf > 0){
+    retv = setsockopt(sockfd, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, \
+                                                              sizeof(sndbuf));
+    if(retv == -1){
+      retv = setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, \
+                                                              sizeof(sndbuf));
+      if(retv == -1){
+        perror("tune_rawfd(): setsockopt()");
+        return -1;
+      }
+    }
+  }
+
+  retv = setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+  if(retv == -1){
+    perror("tune_rawfd(): setsockopt()");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: socket file descriptor
+  - optname: SO_RCVBUF or SO_SNDBUF
+
+This function returns the buffer size the kernel actually uses for 'sockfd'.
+-1 is returned if an error occur.
+*/
+int get_bufsize(int sockfd, int optname){
+  int retv, size;
+  socklen_t len = sizeof(size);
+
+  retv = getsockopt(sockfd, SOL_SOCKET, optname, &size, &len);
+  if(retv == -1){
+    perror("get_bufsize(): getsockopt()");
+    return -1;
+  }
+
+  return size;
+}
+
+/*
+INPUT PARAMETER
+  - sockfd: raw socket file descriptor
+
+INPUT-OUTPUT PARAMETER
+  - st: where the statistics are stored
+
+This function reads the PACKET_STATISTICS of 'sockfd': frames received and
+frames dropped by the kernel since the last call. The kernel resets the 
+counters on every read. -1 is returned if an error occur.
+*/
+int get_packet_stats(int sockfd, struct tpacket_stats *st){
+  int retv;
+  socklen_t len = sizeof(struct tpacket_stats);
+
+  retv = getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, st, &len);
+  if(retv == -1){
+    perror("get_packet_stats(): getsockopt()");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+INPUT PARAMETERS
+  - sockfd: raw socket file descriptor
+  - usec: time in microseconds the kernel may busy poll the device queue
+
+This function enables busy polling on 'sockfd' with SO_BUSY_POLL, and asks 
+the kernel to prefer busy polling over interrupt driven receive with 
+SO_PREFER_BUSY_POLL where the kernel supports it. -1 is returned if busy 
+polling could not be enabled.
+*/
+int busy_poll_rawfd(int sockfd, int usec){
+  int retv;
+  int on = 1;
+
+  retv = setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+  if(retv == -1){
+    perror("busy_poll_rawfd(): setsockopt()");
+    return -1;
+  }
+
+  // older kernels only have SO_BUSY_POLL
+  retv = setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+  if(retv == -1)
+    perror("busy_poll_rawfd(): SO_PREFER_BUSY_POLL");
+
+  return 0;
+}
@@ -247,7 +247,7 @@ int recv_segment(int sockfd, uint8_t *mip_addr, char *buf){
   iov[0].iov_base = mip_addr;
   iov[0].iov_len = sizeof(uint8_t);
   iov[1].iov_base = buf;
-  iov[1].iov_len = FRAG_SIZE + TP_SIZE;
+  iov[1].iov_len = BATCH_SIZE;
 
   struct msghdr msg = { 0 };
   msg.msg_iov = iov;
@@ -450,6 +450,8 @@ sender_t *create_sender(char *file, uint16_t filesize){
 	memset(win, 0, sendsize);
 
 	win->nof = nof;
+	win->cwnd = WIN_SIZE;
+	win->recover = -1;
 	fragment_file(win, nof, file, filesize);
 
 	return win;
@@ -506,88 +508,134 @@ int start_timer(int timerfd, int timeout){
 
 
 int send_window(int sockfd, fdcontext_t *fdctx, int timeout){
-	int retv, i;
+	int retv;
+	sender_t *win = fdctx->s_win;
+
+	win->lar = -1;
+	win->lfs = -1;
+
+	retv = move_window(sockfd, fdctx, timeout);
+
+	fprintf(stderr, "nof after sending window: %d\n", win->nof);
+	fprintf(stderr, "lar after sending window: %d\n", win->lar);
+	fprintf(stderr, "lsf after sending window: %d\n", win->lfs);
+
+	return retv;
+}
+
+int send_fragment(int sockfd, fdcontext_t *fdctx, int seqnum){
+	int retv;
 	char *hdr, *segment;
-	uint16_t seg_size;
+	fragment_t *temp = fdctx->s_win->fragments[seqnum];
+
+	hdr = create_tphdr(temp->data_size, fdctx->port, seqnum);
+	segment = add_hdr(hdr, TP_SIZE, temp->data, temp->data_size);
+
+	retv = send_segment(sockfd, fdctx->mip_addr, segment, \
+																								temp->data_size + TP_SIZE);
+	free(hdr);
+	free(segment);
+
+	return retv;
+}
+
+int send_super(int sockfd, fdcontext_t *fdctx, int first, int last){
+	int retv, i;
+	char *hdr;
+	uint16_t seg_size = FRAG_SIZE;
+	uint16_t data_size = 0;
 	sender_t *win = fdctx->s_win;
 	fragment_t *temp;
-	fdcontext_t *timer;
+	char buf[SUPER_HDR_SIZE + (last - first + 1) * FRAG_SIZE];
 
-	for(i=0; i<WIN_SIZE; i++){
-		// reading within array (less fragments than WIN_SIZE)
-		if(i < win->nof){
-			temp = win->fragments[i];
+	// | destination | header of first | segment data size | data size | data |
+	buf[0] = fdctx->mip_addr;
+	hdr = create_tphdr(FRAG_SIZE, fdctx->port, first);
+	memcpy(&buf[1], hdr, TP_SIZE);
+	memcpy(&buf[1 + TP_SIZE], &seg_size, sizeof(seg_size));
+	free(hdr);
 
-			hdr = create_tphdr(temp->data_size, fdctx->port, i);
-			segment = add_hdr(hdr, TP_SIZE, temp->data, temp->data_size);
-			seg_size = temp->data_size + TP_SIZE;
+	for(i=first; i<=last; i++){
+		temp = win->fragments[i];
+		memcpy(&buf[SUPER_HDR_SIZE + data_size], temp->data, temp->data_size);
+		data_size += temp->data_size;
+	}
 
-			timer = malloc(sizeof(fdcontext_t));
-			init_fdctx(timer, 0, fdctx->port, fdctx->mip_addr, win, NULL, 1);
+	memcpy(&buf[1 + TP_SIZE + sizeof(seg_size)], &data_size, sizeof(data_size));
 
-			retv = add_timer(timer);
-			if(retv == -1){
-				free(hdr);
-				free(segment);
-				return -1;
-			}
+	retv = send_segment(sockfd, 0, buf, SUPER_HDR_SIZE + data_size);
 
-			// adding to fragment
-			temp->timerfd = timer->fd;
-			temp->resent = 0;
+	if(debug)
+		fprintf(stderr, "Super-segment of %d fragments sent\n", last - first + 1);
 
-			retv = start_timer(timer->fd, timeout);
-			if(retv == -1){
-				free(hdr);
-				free(segment);
-				return -1;
-			}
+	return retv;
+}
 
-			retv = send_segment(sockfd, fdctx->mip_addr, segment, seg_size);
-			if(retv == -1){
-				free(hdr);
-				free(segment);
-				return retv;	
-			}
+int send_fragments(int sockfd, fdcontext_t *fdctx, int first, int last){
+	int retv;
 
-			free(hdr);
-			free(segment);
-			win->lfs = i;
-		}
+	// first fragment only holds the filesize, and is sent on its own
+	if(first == 0){
+		retv = send_fragment(sockfd, fdctx, 0);
+		if(retv == -1)
+			return -1;
 
+		first++;
 	}
 
-	win->lar = -1;
+	if(first > last)
+		return 0;
 
-	fprintf(stderr, "nof after sending window: %d\n", win->nof);
-	fprintf(stderr, "lar after sending window: %d\n", win->lar);
-	fprintf(stderr, "lsf after sending window: %d\n", win->lfs);
+	if(first == last)
+		return send_fragment(sockfd, fdctx, first);
 
-	return 0;
+	// the daemon slices the run into segments
+	return send_super(sockfd, fdctx, first, last);
+}
+
+int resend_fragment(int sockfd, fdcontext_t *fdctx, int seqnum, int timeout){
+	int retv;
+	fragment_t *temp = fdctx->s_win->fragments[seqnum];
+
+	retv = start_timer(temp->timerfd, timeout);
+	if(retv == -1)
+		return -1;
+
+	return send_fragment(sockfd, fdctx, seqnum);
 }
 
 int timeout_event(int sockfd, fdcontext_t *fdctx, int timeout){
 	int retv, i;
+	uint64_t expirations;
 	sender_t *win = fdctx->s_win;
 	fragment_t *temp;
 
+	// the timer stays readable until it is read
+	retv = read(fdctx->fd, &expirations, sizeof(expirations));
+	if(retv == -1)
+		return 1;
+
 	for(i=0; i<win->nof; i++){
 		temp = win->fragments[i];
 
-		fprintf(stderr, "resent: %d\n", temp->resent);
-		
+		// acked and freed when the window moved?
+		if(temp == NULL)
+			continue;
+
 		if(temp->timerfd == fdctx->fd){
 
+			// acked, waiting for the window to move
+			if(temp->ack)
+				break;
+
+			fprintf(stderr, "resent: %d\n", temp->resent);
+
 			if(temp->resent >= 3){
 				fprintf(stderr, "Segment %d failed to reach destination 3 times!\n", i);
 				return 0;
 			}
 
-			retv = start_timer(temp->timerfd, timeout);
-			if(retv == -1)
-				return -1;
-
-			retv = send_segment(sockfd, fdctx->mip_addr, temp->data, temp->data_size);
+			retv = resend_fragment(sockfd, fdctx, i, timeout);
 			if(retv == -1)
 				return -1;
 
@@ -600,6 +648,187 @@ int timeout_event(int sockfd, fdcontext_t *fdctx, int timeout){
 	return 1;
 }
 
+int congestion_event(int sockfd, fdcontext_t *fdctx, header_t *hdr, \
+																									uint8_t reason, int timeout){
+	sender_t *win = fdctx->s_win;
+	fragment_t *temp;
+
+	// not sending on this port
+	if(win == NULL)
+		return 0;
+
+	// halving once for every window sent
+	if(hdr->seqnum > win->recover){
+		win->cwnd = win->cwnd > 1 ? win->cwnd / 2 : 1;
+		win->acked = 0;
+		win->recover = win->lfs;
+		if(debug)
+			fprintf(stderr, "congestion, cwnd: %d\n", win->cwnd);
+	}
+
+	if(reason != CONG_DROP)
+		return 0;
+
+	if(hdr->seqnum <= win->lar || hdr->seqnum > win->lfs)
+		return 0;
+
+	temp = win->fragments[hdr->seqnum];
+	if(temp == NULL || temp->ack)
+		return 0;
+
+	// dropped on the way, no point in waiting for the timer
+	DLOG("resending dropped fragment");
+	return resend_fragment(sockfd, fdctx, hdr->seqnum, timeout);
+}
+
+int handle_segment(int mipfd, uint8_t mip_src, char *segment, int seg_size, \
+																																int timeout){
+	int retv;
+	int status = 0;
+	uint8_t pl;
+
+	memcpy(&pl, segment, sizeof(pl));
+	pl = pl >> 6;
+
+	// ack?
+	if(seg_size == TP_SIZE && pl == 1){
+		DLOG("ack received!");
+		int index;
+		header_t *hdr = malloc(sizeof(header_t));
+		init_header(segment, hdr);
+		
+		if(debug){
+			fprintf(stderr, "\n");
+			print_hdr(hdr);
+			fprintf(stderr, "\n");
+		}
+
+		index = find_port(hdr->port, fd_list, FDMAX);
+		if(index != -1){
+			if(in_window(hdr, fd_list[index]->s_win)){
+
+				DLOG("updating window");
+				retv = update_sender(mipfd, fd_list[index], timeout);
+				if(retv == -1){
+					status = -1;
+				}
+				else if(retv == 1){
+					// file completely sent
+					cleanup_fdctx(fd_list[index]);
+				}
+
+			}
+
+		}
+
+		free(hdr);
+	}
+	// congestion notice from a daemon on the path?
+	else if(seg_size == TP_SIZE && pl == 3){
+		DLOG("congestion notice received!");
+		int index;
+		header_t *hdr = malloc(sizeof(header_t));
+		init_header(segment, hdr);
+
+		index = find_port(hdr->port, fd_list, FDMAX);
+		if(index != -1){
+			retv = congestion_event(mipfd, fd_list[index], hdr, segment[2], \
+																																	timeout);
+			if(retv == -1)
+				status = -1;
+		}
+
+		free(hdr);
+	}
+	// fragment?
+	else if(seg_size > TP_SIZE){
+		header_t *hdr = malloc(sizeof(header_t));
+		init_header(segment, hdr);
+		
+		if(debug)
+			print_hdr(hdr);
+
+		retv = receiver_check(mip_src, hdr);
+		if(retv == -1){
+			fprintf(stderr, "No applications listening on port!\n");
+		}
+		else if(!retv){
+			char *ack;
+			int index = find_port(hdr->port, fd_list, FDMAX);
+			fdcontext_t *temp = fd_list[index];
+
+			// pl == 1
+			ack = create_tphdr(TP_SIZE+3, hdr->port, hdr->seqnum);
+
+			DLOG("resending ack");
+			retv = send_segment(mipfd, temp->mip_addr, ack, TP_SIZE);
+			if(retv == -1)
+				status = -1;
+
+			free(ack);
+		}
+		else{
+			char *ack;
+			int index = find_port(hdr->port, fd_list, FDMAX);
+			fdcontext_t *temp = fd_list[index];
+
+			DLOG("saving fragment");
+			save_fragment(temp->r_win, hdr, segment, seg_size);
+
+			DLOG("updating receiver");
+			retv = update_receiver(temp->r_win, hdr->seqnum);
+			if(retv){
+				fprintf(stderr, "Received all fragments!\n");
+				// send fragments to server
+			}
+
+			// pl == 1
+			ack = create_tphdr(TP_SIZE+3, hdr->port, hdr->seqnum);
+
+			DLOG("sending ack");
+			retv = send_segment(mipfd, temp->mip_addr, ack, TP_SIZE);
+			if(retv == -1)
+				status = -1;
+
+			free(ack);
+		}
+
+		free(hdr);
+	}
+
+	return status;
+}
+
+int handle_batch(int mipfd, char *batch, int batch_size, int timeout){
+	int i, retv, count, offset;
+	uint8_t mip_src;
+	uint16_t seg_size;
+
+	mip_src = batch[0];
+	count = (uint8_t)batch[1];
+	offset = 2;
+
+	for(i=0; i<count; i++){
+		// truncated batch?
+		if(offset + (int)sizeof(seg_size) > batch_size)
+			break;
+
+		memcpy(&seg_size, &batch[offset], sizeof(seg_size));
+		offset += sizeof(seg_size);
+
+		if(offset + seg_size > batch_size)
+			break;
+
+		retv = handle_segment(mipfd, mip_src, &batch[offset], seg_size, timeout);
+		if(retv == -1)
+			return -1;
+
+		offset += seg_size;
+	}
+
+	return 0;
+}
+
 int find_port(uint16_t port, fdcontext_t *array[], int arrlen){
 	int i;
 	fdcontext_t *temp;
@@ -637,8 +866,8 @@ int receiver_check(uint16_t mip_addr, header_t *hdr){
 	  	return 0;
 	  }
 
-	 	// fragment in window?
-		if(win->lfr < hdr->seqnum && hdr->seqnum < win->laf){
+	 	// fragment in window? the sender can be a whole window ahead of lfr
+		if(win->lfr < hdr->seqnum && hdr->seqnum <= win->laf){
 			return 1;
 		}
 
@@ -682,11 +911,16 @@ int update_receiver(receiver_t *win, uint16_t seqnum){
 
 	// first frame in window?
 	if(seqnum == win->lfr+1){
-		win->laf = win->lfr + WIN_SIZE;
 		win->lfr++;
+
+		// fragments received while an earlier one was lost?
+		while(win->lfr+1 < 45 && win->fragments[win->lfr+1] != NULL)
+			win->lfr++;
+
+		win->laf = win->lfr + WIN_SIZE;
 	}
-	// last fragment?
-	if(win->lfr == win->nof-1){
+	// last fragment? nof is unknown until the first fragment is received
+	if(win->nof && win->lfr == win->nof-1){
 		return 1;
 	}
 
@@ -701,6 +935,9 @@ int in_window(header_t *hdr, sender_t *win){
 		if(hdr->seqnum > win->lar && hdr->seqnum <= win->lfs){
 			temp = win->fragments[hdr->seqnum];
 			temp->ack = 1;
+
+			// no more retransmissions
+			start_timer(temp->timerfd, 0);
 			return 1;
 		}
 	}
@@ -709,7 +946,7 @@ int in_window(header_t *hdr, sender_t *win){
 }
 
 int update_sender(int sockfd, fdcontext_t *fdctx, int timeout){
-	int retv;
+	int retv = 0;
 	fragment_t *temp;
 	sender_t *win = fdctx->s_win;
 	// last fragment of file?
@@ -719,14 +956,25 @@ int update_sender(int sockfd, fdcontext_t *fdctx, int timeout){
 	}
 
 	temp = win->fragments[win->lar + 1];
-	// first fragment in windows ack'ed?
-	if(temp->ack == 1){
+	// first fragments in window ack'ed? acks after a lost fragment move the
+	// window once the lost one is acked
+	while(temp != NULL && temp->ack == 1){
 		win->lar++;
 		win->fragments[win->lar] = NULL;
 		close(temp->timerfd);
 		free(temp);
 
+		// growing one fragment for every window acked
+		if(win->cwnd < WIN_SIZE && ++win->acked >= win->cwnd){
+			win->cwnd++;
+			win->acked = 0;
+		}
+
 		retv = move_window(sockfd, fdctx, timeout);
+		if(retv == -1 || win->lar == win->nof - 1)
+			break;
+
+		temp = win->fragments[win->lar + 1];
 	}
 
 	return retv;
@@ -734,68 +982,47 @@ int update_sender(int sockfd, fdcontext_t *fdctx, int timeout){
 
 int move_window(int sockfd, fdcontext_t *fdctx, int timeout){
 	int retv, i;
-	char *hdr, *segment;
-	uint16_t seg_size;
 	sender_t *win = fdctx->s_win;
 	fragment_t *temp;
 	fdcontext_t *timer;
-
-	i = win->lar + WIN_SIZE;
+	int first = win->lfs + 1;
 
 	fprintf(stderr, "lar before sending window: %d\n", win->lar);
 	fprintf(stderr, "lfs before moving window: %d\n", win->lfs);
 	fprintf(stderr, "win->lfs - win->lar = %d\n", win->lfs - win->lar);
-	fprintf(stderr, "i+1 = %d\n", i+1);
+	if(debug)
+		fprintf(stderr, "cwnd: %d\n", win->cwnd);
 	fprintf(stderr, "nof: %d\n", win->nof);
 
-	if(win->lfs - win->lar <= WIN_SIZE){
-		if(i > win->nof - 1){
-			return 0;
-		}
+	// room in the congestion window?
+	while(win->lfs - win->lar < win->cwnd && win->lfs + 1 < win->nof){
+		i = win->lfs + 1;
 
 		temp = win->fragments[i];
 
-		hdr = create_tphdr(temp->data_size, fdctx->port, i);
-		segment = add_hdr(hdr, TP_SIZE, temp->data, temp->data_size);
-		seg_size = temp->data_size + TP_SIZE;
-
 		timer = malloc(sizeof(fdcontext_t));
 		init_fdctx(timer, 0, fdctx->port, fdctx->mip_addr, win, NULL, 1);
 
 		retv = add_timer(timer);
-		if(retv == -1){
-			free(hdr);
-			free(segment);
+		if(retv == -1)
 			return -1;
-		}
 
 		// adding to fragment
 		temp->timerfd = timer->fd;
 		temp->resent = 0;
 
 		retv = start_timer(timer->fd, timeout);
-		if(retv == -1){
-			free(hdr);
-			free(segment);
+		if(retv == -1)
 			return -1;
-		}
-
-		retv = send_segment(sockfd, fdctx->mip_addr, segment, seg_size);
-		if(retv == -1){
-			free(hdr);
-			free(segment);
-			return retv;	
-		}
 
-		// test print
-		fprintf(stderr, "Number of bytes sent: %d\n", retv);
-		// end of test
-
-		free(hdr);
-		free(segment);
 		win->lfs++;
 	}
 
+	// fragments that fit in the window sent in one go
+	retv = send_fragments(sockfd, fdctx, first, win->lfs);
+	if(retv == -1)
+		return -1;
+
 	return 0;
 }
 
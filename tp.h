@@ -16,6 +16,10 @@
 #define FRAG_SIZE 1492
 #define TP_SIZE 4
 #define FDMAX 200
+// largest message from the MIP daemon, a batch of coalesced segments
+#define BATCH_SIZE (2 + TP_BATCH * (2 + FRAG_SIZE + TP_SIZE))
+// super-segment header past its leading 0, see sock.h
+#define SUPER_HDR_SIZE (1 + TP_SIZE + 2 * sizeof(uint16_t))
 
 typedef struct{
 	uint8_t ack, resent;
@@ -29,9 +33,16 @@ VARIABLES
 	- lar: last ack received
 	- lfs: last frame sent
 	- nof: number of fragments
+	- cwnd: congestion window, fragments that can be unacked
+	- acked: acks since cwnd last grew
+	- recover: lfs when cwnd was last halved
+
+A congestion notice from a daemon on the path halves cwnd, at most once per 
+window of fragments, and every cwnd acks let it grow by one up to WIN_SIZE.
 */
 typedef struct{
 	int lar, lfs, nof;
+	int cwnd, acked, recover;
 	fragment_t *fragments[];
 } sender_t;
 
@@ -108,10 +119,26 @@ int new_client(fdcontext_t *fdctx, uint16_t filesize);
 
 int send_window(int sockfd, fdcontext_t *fdctx, int timeout);
 
+int send_fragment(int sockfd, fdcontext_t *fdctx, int seqnum);
+
+int send_super(int sockfd, fdcontext_t *fdctx, int first, int last);
+
+int send_fragments(int sockfd, fdcontext_t *fdctx, int first, int last);
+
+int resend_fragment(int sockfd, fdcontext_t *fdctx, int seqnum, int timeout);
+
 int timeout_event(int sockfd, fdcontext_t *fdctx, int timeout);
 
+int congestion_event(int sockfd, fdcontext_t *fdctx, header_t *hdr, \
+																									uint8_t reason, int timeout);
+
 int app_event(fdcontext_t *fdctx, fdcontext_t *list[], int epoll_fd);
 
+int handle_segment(int mipfd, uint8_t mip_src, char *segment, int seg_size, \
+																																int timeout);
+
+int handle_batch(int mipfd, char *batch, int batch_size, int timeout);
+
 int find_port(uint16_t port, fdcontext_t *array[], int arrlen);
 
 int receiver_check(uint16_t mip_addr, header_t *hdr);